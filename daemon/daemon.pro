@@ -24,43 +24,65 @@ MOBILITY += sensors systeminfo location
 HEADERS += \
     ../src/binder.h \
     ../src/daemon.h \
+    ../src/encoding.h \
+    ../src/flightRecorder.h \
     ../src/localizer.h \
+    ../src/latencyHistogram.h \
+    ../src/metrics.h \
+    ../src/localizerWorker.h \
     ../src/localServer.h \
+    ../src/monitor.h \
+    ../src/sessionEngine.h \
     ../src/scanner.h \
     ../src/scan.h \
+    ../src/logger.h \
     ../src/util.h \
     ../src/source.h \
     ../src/scanQueue.h \
+    ../src/scanTrace.h \
     ../src/proximity.h \
     ../src/speedsensor.h \
     ../src/dbus.h \
     ../src/mole.h \
     ../src/network.h \
+    ../src/networkTelemetry.h \
     ../src/overlap.h \
     ../src/sig.h \
     ../src/math.h \
     ../src/settings_access.h \
+    ../src/virtualAP.h \
     ../src/version.h
 
 SOURCES += \
     ../src/binder.cpp \
     ../src/daemon.cpp \
+    ../src/encoding.cpp \
+    ../src/flightRecorder.cpp \
     ../src/localizer.cpp \
+    ../src/latencyHistogram.cpp \
+    ../src/metrics.cpp \
+    ../src/localizerWorker.cpp \
     ../src/localServer.cpp \
+    ../src/monitor.cpp \
+    ../src/sessionEngine.cpp \
     ../src/localizer_statistics.cpp \
     ../src/scanner.cpp \
 #    ../src/scan.cpp \
     ../src/scanQueue.cpp \
+    ../src/scanTrace.cpp \
     ../src/space_parser.cpp \
     ../src/proximity.cpp \
     ../src/speedsensor.cpp \
     ../src/mole.cpp \
     ../src/network.cpp \
+    ../src/networkTelemetry.cpp \
     ../src/overlap.cpp \
     ../src/sig.cpp \
     ../src/settings_access.cpp \
     ../src/math.cpp \
+    ../src/logger.cpp \
     ../src/util.cpp \
+    ../src/virtualAP.cpp \
     ../src/source.cpp
 
 unix:LIBS += -L/usr/lib -lqjson
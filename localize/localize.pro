@@ -0,0 +1,73 @@
+! include (../common.pri) {
+  error(Could not find common.pri)
+}
+
+TEMPLATE = app
+TARGET = mole-localize
+
+QT += core xml network
+QT -= gui
+CONFIG += debug
+
+# no D-Bus: traces are localized offline
+DEFINES += MOLE_NO_DBUS
+
+HEADERS += \
+    ../src/batchLocalize.h \
+    ../src/encoding.h \
+    ../src/flightRecorder.h \
+    ../src/localizer.h \
+    ../src/latencyHistogram.h \
+    ../src/metrics.h \
+    ../src/localizerWorker.h \
+    ../src/monitor.h \
+    ../src/scanner.h \
+    ../src/scan.h \
+    ../src/scanQueue.h \
+    ../src/scanTrace.h \
+    ../src/logger.h \
+    ../src/util.h \
+    ../src/mole.h \
+    ../src/network.h \
+    ../src/networkTelemetry.h \
+    ../src/overlap.h \
+    ../src/sig.h \
+    ../src/settings_access.h \
+    ../src/math.h \
+    ../src/virtualAP.h \
+    ../src/version.h
+
+SOURCES += \
+    ../src/batchLocalize.cpp \
+    ../src/encoding.cpp \
+    ../src/flightRecorder.cpp \
+    ../src/localizer.cpp \
+    ../src/latencyHistogram.cpp \
+    ../src/metrics.cpp \
+    ../src/localizerWorker.cpp \
+    ../src/localizer_statistics.cpp \
+    ../src/monitor.cpp \
+    ../src/scanner.cpp \
+    ../src/scanQueue.cpp \
+    ../src/scanTrace.cpp \
+    ../src/space_parser.cpp \
+    ../src/mole.cpp \
+    ../src/network.cpp \
+    ../src/networkTelemetry.cpp \
+    ../src/overlap.cpp \
+    ../src/sig.cpp \
+    ../src/settings_access.cpp \
+    ../src/math.cpp \
+    ../src/logger.cpp \
+    ../src/util.cpp \
+    ../src/virtualAP.cpp
+
+unix:LIBS += -L/usr/lib -lqjson
+
+unix:!symbian {
+    isEmpty(PREFIX) {
+      PREFIX = "/usr"
+    }
+    target.path = $$PREFIX/local/bin
+    INSTALLS += target
+}
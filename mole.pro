@@ -4,7 +4,10 @@ SUBDIRS = scanner-daemon \
           daemon \
           cli \
           gui \
-          ws-client
+          ws-client \
+          replay \
+          bench \
+          localize
 
 
 
@@ -12,6 +12,7 @@ MOBILITY += sensors systeminfo
 HEADERS += \
     ../src/scannerDaemon.h \
     ../src/ports.h \
+    ../src/logger.h \
     ../src/util.h \
     ../src/source.h \
     ../src/version.h \
@@ -20,6 +21,7 @@ HEADERS += \
     ../src/simpleScanQueue.h
 
 SOURCES += \
+    ../src/logger.cpp \
     ../src/util.cpp \
     ../src/source.cpp \
     ../src/scannerDaemon.cpp \
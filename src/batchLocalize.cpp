@@ -0,0 +1,329 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mole.h"
+#include "util.h"
+#include "batchLocalize.h"
+#include "localizer.h"
+#include "scanQueue.h"
+#include "scanTrace.h"
+#include "virtualAP.h"
+
+#include <cstdio>
+
+#include <qjson/serializer.h>
+
+// ranked spaces per scan, by default
+const int DEFAULT_BATCH_RANKS = 5;
+
+void usage();
+
+BatchLocalize::BatchLocalize()
+  : runAllAlgorithms(false)
+  // as the daemon runs without a movement detector
+  , maxActiveQueueLength(12)
+  , json(false)
+  , ranks(DEFAULT_BATCH_RANKS)
+  , maps(0)
+{
+}
+
+void BatchLocalize::write(const QByteArray &lines)
+{
+  QMutexLocker locker (&m_outputLock);
+  fwrite(lines.constData(), 1, lines.size(), stdout);
+  fflush(stdout);
+}
+
+TraceLocalization::TraceLocalization(BatchLocalize *batch, const QString &path)
+  : m_batch(batch)
+  , m_path(path)
+{
+}
+
+void TraceLocalization::run()
+{
+  ScanTraceReader reader;
+  if (!reader.open(m_path)) {
+    m_batch->failedCount.ref();
+    return;
+  }
+
+  Localizer localizer (0, m_batch->runAllAlgorithms, m_batch->maps);
+  localizer.setOffline();
+  ScanQueue scanQueue (0, &localizer, m_batch->maxActiveQueueLength);
+
+  // scores arrive as queued signals on this thread
+  QEventLoop scoring;
+  QObject::connect(&localizer, SIGNAL(scoringIdle()), &scoring, SLOT(quit()));
+
+  int scanCount = 0;
+  TraceEvent event;
+  while (reader.next(event)) {
+    switch (event.type) {
+    case TRACE_SCAN: {
+      quint32 lastSeq = localizer.lastTimings().seq;
+      QElapsedTimer timer;
+      timer.start();
+      foreach (const TraceReading &reading, event.readings) {
+        scanQueue.addReading(reading.mac, reading.ssid, reading.frequency, reading.strength);
+      }
+      scanQueue.scanCompleted();
+      qint64 queueNsec = timer.nsecsElapsed();
+      if (localizer.scoringPending())
+        scoring.exec();
+      qint64 totalNsec = timer.nsecsElapsed();
+
+      ++scanCount;
+      report(scanCount, event.msec, queueNsec, totalNsec,
+             localizer.lastTimings().seq != lastSeq, localizer);
+      break;
+    }
+    case TRACE_MOTION:
+      scanQueue.handleMotionChange(event.motion);
+      break;
+    case TRACE_BIND:
+      localizer.bind(event.area, event.space);
+      break;
+    case TRACE_REMOVE:
+      localizer.removeSpace(event.area, event.space);
+      break;
+    }
+  }
+
+  m_batch->write(m_output);
+  m_batch->traceCount.ref();
+  m_batch->scanCount.fetchAndAddRelaxed(scanCount);
+}
+
+bool higherScore(const QPair<QString,double> &a, const QPair<QString,double> &b)
+{
+  return a.second > b.second;
+}
+
+QByteArray csvField(const QString &field)
+{
+  QByteArray utf8 = field.toUtf8();
+  if (!utf8.contains(',') && !utf8.contains('"') && !utf8.contains('\n'))
+    return utf8;
+  utf8.replace('"', "\"\"");
+  return '"' + utf8 + '"';
+}
+
+// One line per scan: the estimate, the top ranked spaces and how long
+// each stage took.  Stages other than the scan queue are only there
+// if the scan was scored.
+void TraceLocalization::report(int scan, qint64 msec, qint64 queueNsec, qint64 totalNsec,
+                               bool scored, const Localizer &localizer)
+{
+  QSharedPointer<const LocalizerSnapshot> snapshot = localizer.snapshot();
+  const LocalizeTimings &timings = localizer.lastTimings();
+
+  QList<QPair<QString,double> > ranked;
+  if (scored) {
+    QMapIterator<QString,QVariant> i (snapshot->ranks);
+    while (i.hasNext()) {
+      i.next();
+      ranked.append(qMakePair(i.key(), i.value().toDouble()));
+    }
+    qSort(ranked.begin(), ranked.end(), higherScore);
+    ranked = ranked.mid(0, m_batch->ranks);
+  }
+
+  qint64 selectNsec = scored ? timings.selectNsec : 0;
+  QString estimate = localizer.currentEstimate();
+  double score = snapshot->estimate.value("score").toDouble();
+
+  if (m_batch->json) {
+    QVariantMap line;
+    line.insert("trace", m_path);
+    line.insert("scan", scan);
+    line.insert("msec", msec);
+    line.insert("estimate", estimate);
+    line.insert("score", score);
+
+    QVariantList ranks;
+    for (int i = 0; i < ranked.size(); ++i) {
+      QVariantMap rank;
+      rank.insert("space", ranked.at(i).first);
+      rank.insert("score", ranked.at(i).second);
+      ranks << rank;
+    }
+    line.insert("ranks", ranks);
+
+    QVariantMap usec;
+    usec.insert("queue", (queueNsec - selectNsec) / 1000);
+    if (scored) {
+      usec.insert("select", timings.selectNsec / 1000);
+      usec.insert("wait", timings.waitNsec / 1000);
+      usec.insert("score", timings.scoreNsec / 1000);
+    }
+    usec.insert("total", totalNsec / 1000);
+    line.insert("usec", usec);
+
+    QJson::Serializer serializer;
+    m_output += serializer.serialize(line);
+    m_output += '\n';
+    return;
+  }
+
+  QStringList ranks;
+  for (int i = 0; i < ranked.size(); ++i) {
+    ranks << QString("%1=%2").arg(ranked.at(i).first).arg(ranked.at(i).second);
+  }
+
+  QList<QByteArray> fields;
+  fields << csvField(m_path) << QByteArray::number(scan) << QByteArray::number(msec)
+         << csvField(estimate) << QByteArray::number(score)
+         << QByteArray::number((queueNsec - selectNsec) / 1000);
+  if (scored) {
+    fields << QByteArray::number(timings.selectNsec / 1000)
+           << QByteArray::number(timings.waitNsec / 1000)
+           << QByteArray::number(timings.scoreNsec / 1000);
+  } else {
+    fields << "" << "" << "";
+  }
+  fields << QByteArray::number(totalNsec / 1000) << csvField(ranks.join(";"));
+
+  for (int i = 0; i < fields.size(); ++i) {
+    if (i > 0)
+      m_output += ',';
+    m_output += fields.at(i);
+  }
+  m_output += '\n';
+}
+
+// trace files, and the *.trace files under directories
+QStringList tracePaths(const QStringList &args)
+{
+  QStringList paths;
+  foreach (const QString &arg, args) {
+    if (!QFileInfo(arg).isDir()) {
+      paths << arg;
+      continue;
+    }
+    QStringList found;
+    QDirIterator it (arg, QStringList() << "*.trace", QDir::Files,
+                     QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+      found << it.next();
+    }
+    found.sort();
+    paths << found;
+  }
+  return paths;
+}
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app (argc, argv);
+
+  BatchLocalize batch;
+  int threads = QThread::idealThreadCount();
+  QStringList traceArgs;
+
+  QStringList args = QCoreApplication::arguments();
+  QStringListIterator argsIter(args);
+  argsIter.next(); // mole-localize
+
+  while (argsIter.hasNext()) {
+    QString arg = argsIter.next();
+    if (arg == "-h") {
+      usage();
+    } else if (arg == "-d") {
+      debug = true;
+    } else if (arg == "-r" && argsIter.hasNext()) {
+      rootPathname = argsIter.next();
+    } else if (arg == "-j" && argsIter.hasNext()) {
+      threads = argsIter.next().toInt();
+    } else if (arg == "-f" && argsIter.hasNext()) {
+      QString format = argsIter.next();
+      if (format != "csv" && format != "json")
+        usage();
+      batch.json = (format == "json");
+    } else if (arg == "-k" && argsIter.hasNext()) {
+      batch.ranks = argsIter.next().toInt();
+    } else if (arg == "-q" && argsIter.hasNext()) {
+      batch.maxActiveQueueLength = argsIter.next().toInt();
+    } else if (arg == "-A") {
+      batch.runAllAlgorithms = true;
+    } else if (arg == "-V") {
+      groupVirtualAPs = true;
+    } else if (!arg.startsWith("-")) {
+      traceArgs << arg;
+    } else {
+      usage();
+    }
+  }
+  if (traceArgs.isEmpty() || threads < 1 || batch.ranks < 0)
+    usage();
+
+  initLogger(NULL);
+  qInstallMsgHandler(outputHandler);
+
+  QStringList paths = tracePaths(traceArgs);
+
+  // maps come from the map cache under the root path, loaded once
+  QElapsedTimer clock;
+  clock.start();
+  rootDir.setPath(rootPathname);
+  batch.maps = new Localizer(0, batch.runAllAlgorithms);
+  batch.maps->setOffline();
+  qint64 loadMsec = clock.elapsed();
+
+  if (!batch.json) {
+    batch.write("trace,scan,msec,estimate,score,queue_usec,select_usec,"
+                "wait_usec,score_usec,total_usec,ranks\n");
+  }
+
+  QThreadPool pool;
+  pool.setMaxThreadCount(threads);
+  foreach (const QString &path, paths) {
+    pool.start(new TraceLocalization(&batch, path));
+  }
+  pool.waitForDone();
+
+  qint64 elapsed = clock.elapsed() - loadMsec;
+  int scans = batch.scanCount;
+  fprintf(stderr, "localized %d traces (%d failed), %d scans on %d threads "
+          "in %lld msec (%.1f scans/sec), maps loaded in %lld msec\n",
+          (int) batch.traceCount, (int) batch.failedCount, scans, threads,
+          (long long) elapsed, elapsed > 0 ? scans * 1000. / elapsed : 0.,
+          (long long) loadMsec);
+
+  delete batch.maps;
+  return batch.failedCount > 0 ? 1 : 0;
+}
+
+void usage()
+{
+  qCritical() << "mole-localize usage: mole-localize [options] trace|dir...\n"
+              << "Localizes every scan of recorded traces (moled -S) against the\n"
+              << "map cache, one trace per thread, and prints a line per scan.\n"
+              << "Directories are searched for *.trace files.\n"
+              << "-h print usage\n"
+              << "-d debug\n"
+              << "-r root path, whose map cache is used [" << DEFAULT_ROOT_PATH << "]\n"
+              << "-j threads [" << QThread::idealThreadCount() << "]\n"
+              << "-f output format, csv or json (one object per line) [csv]\n"
+              << "-k ranked spaces per scan [" << DEFAULT_BATCH_RANKS << "]\n"
+              << "-q scans used for localization, 0 to rely on motion events [12]\n"
+              << "-A run all localization algorithms for comparison\n"
+              << "-V group virtual APs (BSSIDs from the same radio)\n";
+
+  exit(0);
+}
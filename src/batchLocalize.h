@@ -0,0 +1,69 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BATCH_LOCALIZE_H_
+#define BATCH_LOCALIZE_H_
+
+#include <QtCore>
+
+class Localizer;
+
+// Settings and shared state of one mole-localize run.
+class BatchLocalize
+{
+ public:
+  BatchLocalize();
+
+  bool runAllAlgorithms;
+  int maxActiveQueueLength;
+  bool json;
+  // ranked spaces reported per scan
+  int ranks;
+  // loads the maps once; only read while traces run
+  Localizer *maps;
+
+  QAtomicInt traceCount;
+  QAtomicInt failedCount;
+  QAtomicInt scanCount;
+
+  // a whole trace at a time, so each trace's lines stay together
+  void write(const QByteArray &lines);
+
+ private:
+  QMutex m_outputLock;
+};
+
+// Localizes every scan of one recorded trace on a pool thread,
+// through its own ScanQueue and Localizer as mole-replay does.
+// The localizer shares the maps of BatchLocalize::maps.
+class TraceLocalization : public QRunnable
+{
+ public:
+  TraceLocalization(BatchLocalize *batch, const QString &path);
+
+  void run();
+
+ private:
+  BatchLocalize *m_batch;
+  QString m_path;
+  QByteArray m_output;
+
+  void report(int scan, qint64 msec, qint64 queueNsec, qint64 totalNsec,
+              bool scored, const Localizer &localizer);
+};
+
+#endif /* BATCH_LOCALIZE_H_ */
@@ -0,0 +1,562 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mole.h"
+#include "util.h"
+#include "flightRecorder.h"
+#include "localizer.h"
+#include "overlap.h"
+#include "scan.h"
+#include "sig.h"
+#include "syntheticMaps.h"
+#include "version.h"
+
+#include <cstdio>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <qjson/serializer.h>
+
+// scans behind the benchmark fingerprint, as the daemon keeps them
+const int BENCH_FINGERPRINT_SCANS = 12;
+// map corpora for -I, in spaces
+const char *DEFAULT_INGEST_SIZES = "10,100,1000,10000";
+
+#ifdef __GLIBC__
+// Counts heap allocations, including Qt's, by wrapping glibc's malloc.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+}
+
+static volatile qint64 allocationCount = 0;
+
+extern "C" void *malloc(size_t size) __THROW
+{
+  __sync_fetch_and_add(&allocationCount, 1);
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) __THROW
+{
+  __sync_fetch_and_add(&allocationCount, 1);
+  return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) __THROW
+{
+  if (!ptr)
+    __sync_fetch_and_add(&allocationCount, 1);
+  return __libc_realloc(ptr, size);
+}
+
+bool countingAllocations() { return true; }
+qint64 allocations() { return allocationCount; }
+#else
+bool countingAllocations() { return false; }
+qint64 allocations() { return 0; }
+#endif
+
+void usage();
+
+// Each benchmark is a function object running one unit of work.
+// measure() runs it in doubling batches until targetMsec have passed
+// and reports the time per run and, when a run covers several spaces
+// or histograms, per space or histogram.
+template <class Op>
+QVariantMap measure(const QString &name, Op &op, int targetMsec,
+                    int unitsPerRun, const QString &unit)
+{
+  // warm up caches and lazily computed means
+  op();
+
+  qint64 runs = 0;
+  qint64 nsec = 0;
+  int batch = 1;
+  QElapsedTimer timer;
+  while (nsec < targetMsec * 1000000LL) {
+    timer.start();
+    for (int i = 0; i < batch; ++i) {
+      op();
+    }
+    nsec += timer.nsecsElapsed();
+    runs += batch;
+    if (batch < (1 << 20))
+      batch *= 2;
+  }
+
+  double nsPerRun = nsec / (double) runs;
+  QVariantMap result;
+  result.insert("name", name);
+  result.insert("runs", runs);
+  result.insert("ns_per_run", nsPerRun);
+  result.insert("runs_per_sec", 1e9 / nsPerRun);
+  if (unitsPerRun > 0) {
+    result.insert(unit + "s_per_run", unitsPerRun);
+    result.insert("ns_per_" + unit, nsPerRun / unitsPerRun);
+  }
+
+  fprintf(stderr, "%-22s %10lld runs %14.1f ns/run", qPrintable(name),
+          (long long) runs, nsPerRun);
+  if (unitsPerRun > 0)
+    fprintf(stderr, " %12.1f ns/%s", nsPerRun / unitsPerRun, qPrintable(unit));
+  fprintf(stderr, "\n");
+  return result;
+}
+
+// Histogram::computeOverlap over every fingerprint AP a candidate space shares
+class HistogramOverlapOp
+{
+ public:
+  QList<QPair<Sig*,Sig*> > pairs;
+  double sink;
+
+  HistogramOverlapOp() : sink(0.) {}
+  void operator()() {
+    for (int i = 0; i < pairs.size(); ++i) {
+      sink += Sig::computeHistOverlap(pairs.at(i).first, pairs.at(i).second);
+    }
+  }
+};
+
+// Overlap::compareHistOverlap or compareSigOverlap against every candidate space
+class CompareOp
+{
+ public:
+  Overlap overlap;
+  const QMap<QString,Sig*> *fingerprint;
+  QList<SpaceDescPtr> spaces;
+  bool histograms;
+  double sink;
+
+  CompareOp(bool _histograms) : fingerprint(0), histograms(_histograms), sink(0.) {}
+  void operator()() {
+    for (int i = 0; i < spaces.size(); ++i) {
+      if (histograms) {
+        sink += overlap.compareHistOverlap(fingerprint, spaces.at(i)->signatures(), BEST_PENALTY);
+      } else {
+        sink += overlap.compareSigOverlap(fingerprint, spaces.at(i)->signatures());
+      }
+    }
+  }
+};
+
+// Localizer::localize, from the scan to its scores being applied
+class LocalizeOp
+{
+ public:
+  Localizer *localizer;
+  QEventLoop loop;
+
+  LocalizeOp(Localizer *_localizer) : localizer(_localizer) {
+    QObject::connect(localizer, SIGNAL(scoringIdle()), &loop, SLOT(quit()));
+  }
+  void operator()() {
+    localizer->localize(0);
+    if (localizer->scoringPending())
+      loop.exec();
+  }
+};
+
+// The flight recorder events of one scan: the scan, its candidates and
+// its top scores
+class TraceScanOp
+{
+ public:
+  FlightRecorder *recorder;
+  QList<QPair<QString,double> > top;
+  int readings;
+  int candidates;
+
+  TraceScanOp() : recorder(flightRecorder()), readings(0), candidates(0) {}
+  void operator()() {
+    qint64 start = recorder->now();
+    recorder->record(FLIGHT_CANDIDATES, start, candidates);
+    recorder->recordScores(start, 0, candidates, top);
+    recorder->record(FLIGHT_SCAN, start, readings);
+  }
+};
+
+// Parses area maps as Localizer::parseMap does, without keeping them
+class ParseOp
+{
+ public:
+  QList<QByteArray> xmls;
+
+  void operator()() {
+    foreach (const QByteArray &xml, xmls) {
+      MapParser parser;
+      QXmlInputSource source;
+      source.setData(QString(xml));
+      QXmlSimpleReader reader;
+      reader.setContentHandler(&parser);
+      reader.parse(source);
+      AreaDescPtr area (parser.areaDesc());
+    }
+  }
+};
+
+// Builds map signatures, whose Histogram(QString) parses the histogram
+class HistogramParseOp
+{
+ public:
+  QStringList histograms;
+
+  void operator()() {
+    foreach (const QString &histogram, histograms) {
+      Sig sig (60., 4., 0.1, histogram);
+    }
+  }
+};
+
+void removeTree(const QString &path)
+{
+  QDir dir (path);
+  foreach (const QFileInfo &info,
+           dir.entryInfoList(QDir::NoDotAndDotDot | QDir::AllEntries | QDir::Hidden)) {
+    if (info.isDir()) {
+      removeTree(info.absoluteFilePath());
+    } else {
+      dir.remove(info.fileName());
+    }
+  }
+  dir.rmdir(dir.absolutePath());
+}
+
+// from /proc, 0 where there is none
+qint64 residentKB()
+{
+  QFile statm ("/proc/self/statm");
+  if (!statm.open(QIODevice::ReadOnly))
+    return 0;
+  QList<QByteArray> fields = statm.readAll().split(' ');
+  if (fields.size() < 2)
+    return 0;
+  return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+// Waits for the localizer to apply the scores of its last scan.
+void waitForScoring(Localizer *localizer)
+{
+  if (!localizer->scoringPending())
+    return;
+  QEventLoop loop;
+  QObject::connect(localizer, SIGNAL(scoringIdle()), &loop, SLOT(quit()));
+  loop.exec();
+}
+
+QVariantList benchScoring(const SyntheticMapConfig &config, int targetMsec,
+                          const QString &benchRoot, QVariantMap &report)
+{
+  QVariantList results;
+
+  QDir mapRoot (benchRoot + "/map");
+  SyntheticMaps maps (config);
+  if (!QDir().mkpath(mapRoot.absolutePath()) || !maps.writeMapCache(mapRoot))
+    return results;
+
+  rootDir.setPath(benchRoot);
+  Localizer *localizer = new Localizer(0, false);
+  localizer->setOffline();
+
+  // a scan heard in the middle of the deployment,
+  // where it has the most neighbouring spaces
+  int space = config.spaceCount() / 2;
+  localizer->replaceFingerprint(maps.fingerprint(space, BENCH_FINGERPRINT_SCANS));
+  const QMap<QString,Sig*> *fingerprint =
+    (const QMap<QString,Sig*> *) localizer->fingerprint();
+
+  QMap<QString,SpaceDescPtr> candidates = localizer->candidateSpaces(localizer->fingerprint());
+  if (candidates.isEmpty()) {
+    qCritical() << "no candidate spaces for" << maps.fqSpace(space);
+    delete localizer;
+    return results;
+  }
+
+  HistogramOverlapOp histogramOp;
+  CompareOp histCompareOp (true);
+  CompareOp sigCompareOp (false);
+  histCompareOp.fingerprint = fingerprint;
+  sigCompareOp.fingerprint = fingerprint;
+
+  foreach (const SpaceDescPtr &desc, candidates) {
+    histCompareOp.spaces.append(desc);
+    sigCompareOp.spaces.append(desc);
+
+    QMapIterator<QString,Sig*> i (*desc->signatures());
+    while (i.hasNext()) {
+      i.next();
+      if (fingerprint->contains(i.key()))
+        histogramOp.pairs.append(qMakePair(fingerprint->value(i.key()), i.value()));
+    }
+  }
+
+  LocalizeOp localizeOp (localizer);
+
+  TraceScanOp traceOp;
+  traceOp.readings = fingerprint->size();
+  traceOp.candidates = candidates.size();
+  QMapIterator<QString,SpaceDescPtr> c (candidates);
+  while (c.hasNext() && traceOp.top.size() < FLIGHT_NAMES) {
+    c.next();
+    traceOp.top.append(qMakePair(c.key(), 0.5));
+  }
+
+  fprintf(stderr, "%d areas, %d spaces, %d candidate spaces for %s\n",
+          config.areaCount(), config.spaceCount(), candidates.size(),
+          qPrintable(maps.fqSpace(space)));
+
+  results << measure("histogram_overlap", histogramOp, targetMsec,
+                     histogramOp.pairs.size(), "histogram");
+  results << measure("compare_hist_overlap", histCompareOp, targetMsec,
+                     candidates.size(), "space");
+  results << measure("compare_sig_overlap", sigCompareOp, targetMsec,
+                     candidates.size(), "space");
+  results << measure("localize", localizeOp, targetMsec,
+                     candidates.size(), "space");
+  results << measure("trace_scan", traceOp, targetMsec, 3, "event");
+
+  report.insert("fingerprint_space", maps.fqSpace(space));
+  report.insert("fingerprint_aps", fingerprint->size());
+  report.insert("candidate_spaces", candidates.size());
+
+  delete localizer;
+  return results;
+}
+
+// One corpus: save, cold load and first localize, then parsing.
+QVariantMap benchIngestion(const SyntheticMapConfig &config, int targetMsec,
+                           const QString &benchRoot)
+{
+  QVariantMap result;
+  result.insert("config", config.toVariant());
+
+  SyntheticMaps maps (config);
+  ParseOp parseOp;
+  qint64 bytes = 0;
+  for (int area = 0; area < config.areaCount(); ++area) {
+    parseOp.xmls << maps.areaXml(area);
+    bytes += parseOp.xmls.last().size();
+  }
+  result.insert("map_bytes", bytes);
+  double mb = bytes / (1024. * 1024.);
+
+  fprintf(stderr, "%d areas, %d spaces, %.2f MB of maps\n",
+          config.areaCount(), config.spaceCount(), mb);
+
+  // save, as the localizer caches fetched maps
+  QDir mapRoot (benchRoot + "/map");
+  if (!QDir().mkpath(mapRoot.absolutePath()))
+    return QVariantMap();
+  QElapsedTimer timer;
+  timer.start();
+  for (int area = 0; area < config.areaCount(); ++area) {
+    if (!maps.writeMap(mapRoot, area, parseOp.xmls.at(area)))
+      return QVariantMap();
+  }
+  qint64 saveNsec = timer.nsecsElapsed();
+  result.insert("save_msec", saveNsec / 1e6);
+  result.insert("save_mb_per_sec", saveNsec > 0 ? mb * 1e9 / saveNsec : 0.);
+
+  // cold start: the localizer loads the map cache as at daemon startup,
+  // then localizes its first scan
+  rootDir.setPath(benchRoot);
+  qint64 residentBefore = residentKB();
+  qint64 allocationsBefore = allocations();
+  timer.restart();
+  Localizer *localizer = new Localizer(0, false);
+  qint64 loadNsec = timer.nsecsElapsed();
+  qint64 loadAllocations = allocations() - allocationsBefore;
+  qint64 residentAfter = residentKB();
+
+  localizer->setOffline();
+  localizer->replaceFingerprint(maps.fingerprint(config.spaceCount() / 2,
+                                                 BENCH_FINGERPRINT_SCANS));
+  localizer->localize(0);
+  waitForScoring(localizer);
+  qint64 firstLocalizeNsec = timer.nsecsElapsed();
+  QString estimate = localizer->currentEstimate();
+  delete localizer;
+
+  result.insert("load_msec", loadNsec / 1e6);
+  result.insert("load_mb_per_sec", loadNsec > 0 ? mb * 1e9 / loadNsec : 0.);
+  result.insert("first_localize_msec", firstLocalizeNsec / 1e6);
+  result.insert("first_estimate", estimate);
+  result.insert("resident_kb_before_load", residentBefore);
+  result.insert("resident_kb_after_load", residentAfter);
+  if (countingAllocations())
+    result.insert("load_allocations_per_space", loadAllocations / (double) config.spaceCount());
+
+  fprintf(stderr, "  save %.1f msec, load %.1f msec, first localize %.1f msec, "
+          "resident %lld -> %lld KB\n",
+          saveNsec / 1e6, loadNsec / 1e6, firstLocalizeNsec / 1e6,
+          (long long) residentBefore, (long long) residentAfter);
+
+  // parsing alone, from the xml in memory
+  allocationsBefore = allocations();
+  parseOp();
+  qint64 parseAllocations = allocations() - allocationsBefore;
+  QVariantMap parse = measure("parse_map", parseOp, targetMsec,
+                              config.spaceCount(), "space");
+  double parseNsec = parse.value("ns_per_run").toDouble();
+  parse.insert("mb_per_sec", parseNsec > 0 ? mb * 1e9 / parseNsec : 0.);
+  if (countingAllocations())
+    parse.insert("allocations_per_space", parseAllocations / (double) config.spaceCount());
+  result.insert("parse_map", parse);
+
+  // the histograms of the first area, as Histogram(QString) parses them
+  HistogramParseOp histogramOp;
+  QXmlStreamReader xml (parseOp.xmls.at(0));
+  while (!xml.atEnd()) {
+    if (xml.readNext() == QXmlStreamReader::StartElement && xml.name() == QLatin1String("mac"))
+      histogramOp.histograms << xml.attributes().value("histogram").toString();
+  }
+  result.insert("parse_histogram", measure("parse_histogram", histogramOp, targetMsec,
+                                           histogramOp.histograms.size(), "histogram"));
+
+  removeTree(benchRoot);
+  return result;
+}
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app (argc, argv);
+
+  SyntheticMapConfig config;
+  int targetMsec = 1000;
+  QString outputPath;
+  bool ingestion = false;
+  QString ingestSizes = DEFAULT_INGEST_SIZES;
+
+  QStringList args = QCoreApplication::arguments();
+  QStringListIterator argsIter(args);
+  argsIter.next(); // mole-bench
+
+  while (argsIter.hasNext()) {
+    QString arg = argsIter.next();
+    if (arg == "-h") {
+      usage();
+    } else if (arg == "-d") {
+      debug = true;
+    } else if (arg == "-b" && argsIter.hasNext()) {
+      config.buildings = argsIter.next().toInt();
+    } else if (arg == "-f" && argsIter.hasNext()) {
+      config.floors = argsIter.next().toInt();
+    } else if (arg == "-s" && argsIter.hasNext()) {
+      config.spacesPerFloor = argsIter.next().toInt();
+    } else if (arg == "-a" && argsIter.hasNext()) {
+      config.apsPerSpace = argsIter.next().toInt();
+    } else if (arg == "-w" && argsIter.hasNext()) {
+      config.histogramWidth = argsIter.next().toDouble();
+    } else if (arg == "-S" && argsIter.hasNext()) {
+      config.seed = argsIter.next().toUInt();
+    } else if (arg == "-t" && argsIter.hasNext()) {
+      targetMsec = argsIter.next().toInt();
+    } else if (arg == "-o" && argsIter.hasNext()) {
+      outputPath = argsIter.next();
+    } else if (arg == "-I") {
+      ingestion = true;
+    } else if (arg == "-n" && argsIter.hasNext()) {
+      ingestSizes = argsIter.next();
+    } else {
+      usage();
+    }
+  }
+  if (config.buildings < 1 || config.floors < 1 || config.spacesPerFloor < 1 ||
+      config.apsPerSpace < 1 || config.histogramWidth <= 0. || targetMsec < 1)
+    usage();
+
+  QList<int> sizes;
+  foreach (const QString &size, ingestSizes.split(',', QString::SkipEmptyParts)) {
+    if (size.toInt() < 1)
+      usage();
+    sizes << size.toInt();
+  }
+
+  initLogger(NULL);
+  qInstallMsgHandler(outputHandler);
+
+  // the localizer loads the synthetic maps from a throwaway map cache
+  QString benchRoot = QDir::temp().absoluteFilePath(
+    QString("mole-bench-%1").arg(QCoreApplication::applicationPid()));
+  removeTree(benchRoot);
+
+  QVariantMap report;
+  report.insert("version", MOLE_VERSION);
+  report.insert("target_msec", targetMsec);
+
+  QVariantList results;
+  if (ingestion) {
+    report.insert("mode", "ingestion");
+    foreach (int size, sizes) {
+      QVariantMap result = benchIngestion(config.withSpaces(size), targetMsec, benchRoot);
+      if (result.isEmpty()) {
+        results.clear();
+        break;
+      }
+      results << result;
+    }
+  } else {
+    report.insert("mode", "scoring");
+    report.insert("config", config.toVariant());
+    results = benchScoring(config, targetMsec, benchRoot, report);
+  }
+  removeTree(benchRoot);
+  if (results.isEmpty())
+    return -1;
+  report.insert("results", results);
+
+  QJson::Serializer serializer;
+  QByteArray json = serializer.serialize(report);
+  json.append('\n');
+
+  if (outputPath.isEmpty()) {
+    fwrite(json.constData(), 1, json.size(), stdout);
+  } else {
+    QFile file (outputPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      qCritical() << "could not write" << outputPath;
+      return -1;
+    }
+    file.write(json);
+  }
+  return 0;
+}
+
+void usage()
+{
+  SyntheticMapConfig defaults;
+  qCritical() << "mole-bench usage: mole-bench [options]\n"
+              << "Times scoring, or with -I map ingestion, on synthetic maps\n"
+              << "and prints the results as json.\n"
+              << "-h print usage\n"
+              << "-d debug\n"
+              << "-b buildings [" << defaults.buildings << "]\n"
+              << "-f floors per building [" << defaults.floors << "]\n"
+              << "-s spaces per floor [" << defaults.spacesPerFloor << "]\n"
+              << "-a APs heard per space [" << defaults.apsPerSpace << "]\n"
+              << "-w histogram width, the stddev of readings in dB [" << defaults.histogramWidth << "]\n"
+              << "-S random seed [" << defaults.seed << "]\n"
+              << "-t msec to run each benchmark for [1000]\n"
+              << "-o write the results to this file instead of stdout\n"
+              << "-I benchmark saving, loading and parsing maps instead of scoring\n"
+              << "-n map sizes for -I, in spaces, with buildings added to reach them ["
+              << DEFAULT_INGEST_SIZES << "]\n";
+
+  exit(0);
+}
@@ -255,8 +255,8 @@ QString Binder::handleBindRequest(QString source, QString country,
 
 void Binder::xmitBind()
 {
-  // push the timer back a little
-  m_xmitBindTimer.start(10000);
+  // push the timer back a little, more while the server is failing
+  m_xmitBindTimer.start(networkTelemetry()->backoffMsec(BIND_ENDPOINT, 10000));
 
   // only send one bind at a time
   //if (m_inFlight) {
@@ -308,7 +308,14 @@ void Binder::xmitBind()
 
   request.setRawHeader("Bind", bindFileName.toAscii());
 
+  if (m_sentBinds.contains(bindFileName)) {
+    networkTelemetry()->retried(BIND_ENDPOINT);
+  } else {
+    m_sentBinds.insert(bindFileName);
+  }
+
   QNetworkReply *reply = networkAccessManager->post(request, serialized);
+  networkTelemetry()->watch(reply, BIND_ENDPOINT);
   connect(reply, SIGNAL(finished()), SLOT (handleBindResponse()));
 
   qDebug() << "transmitted bind";
@@ -324,14 +331,17 @@ void Binder::handleBindResponse()
     qWarning() << "handle_bind_response request failed "
                << reply->errorString()
                << " url " << reply->url();
+    countServerReply("bind", "error");
     m_xmitBindTimer.stop();
   } else {
     qDebug() << "handle_bind_response request succeeded";
+    countServerReply("bind", "ok");
 
     // delete the file that we just transmitted
     if (reply->request().hasRawHeader("Bind")) {
       QVariant bindFileVar = reply->request().rawHeader("Bind");
       QString bindFileName = bindFileVar.toString();
+      m_sentBinds.remove(bindFileName);
 
       qDebug() << "bind file name " << bindFileName;
       QFile file(m_bindsDir->filePath(bindFileName));
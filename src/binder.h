@@ -22,6 +22,7 @@
 #include <QDir>
 #include <QNetworkReply>
 #include <QObject>
+#include <QSet>
 #include <QTimer>
 
 class Localizer;
@@ -60,6 +61,8 @@ class Binder : public QObject
   QDateTime m_oldestValidScan;
 
   QMap<QString,QString> m_bfn2area;
+  // bind files sent at least once, to count those sent again
+  QSet<QString> m_sentBinds;
   Localizer *m_localizer;
   ScanQueue *m_scanQueue;
 };
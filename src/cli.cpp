@@ -17,6 +17,7 @@
 
 #include <QtCore>
 #include <QCoreApplication>
+#include <QLocalSocket>
 #include <QTcpSocket>
 
 #include <qjson/parser.h>
@@ -25,7 +26,6 @@
 #include "ports.h"
 #include "version.h"
 
-#define BUFFER_SIZE 1024
 
 void usage();
 void version();
@@ -34,6 +34,7 @@ int main(int argc, char *argv[])
 {
   //initSettings();
   int port = DEFAULT_LOCAL_PORT;
+  QString localSocket;
   QCoreApplication *app = new QCoreApplication(argc, argv);
 
   // let user's settings override system's via fallback mechanism
@@ -52,6 +53,14 @@ int main(int argc, char *argv[])
     QString arg = argsIter.next();
     if (arg == "-p") {
       port = argsIter.next().toInt();
+    } else if (arg == "-u") {
+      localSocket = argsIter.next();
+    } else if (arg == "-U") {
+      localSocket = DEFAULT_LOCAL_SOCKET;
+      // a daemon not run as root listens in the user's runtime directory
+      QByteArray runtimeDir = qgetenv("XDG_RUNTIME_DIR");
+      if (!QFile::exists(localSocket) && !runtimeDir.isEmpty())
+        localSocket = QDir(runtimeDir).filePath(USER_LOCAL_SOCKET);
     } else if (arg == "-v") {
       version();
     } else if (arg == "query") {
@@ -97,14 +106,29 @@ int main(int argc, char *argv[])
   QJson::Serializer serializer;
   const QByteArray requestJson = serializer.serialize(request);
 
-  QTcpSocket *socket = new QTcpSocket ();
+  // the unix domain socket saves TCP setup
+  QIODevice *socket;
+  bool connected;
+  if (localSocket.isEmpty()) {
+    QTcpSocket *tcpSocket = new QTcpSocket ();
+    tcpSocket->connectToHost ("localhost", port);
+    connected = tcpSocket->waitForConnected ();
+    socket = tcpSocket;
+  } else {
+    QLocalSocket *unixSocket = new QLocalSocket ();
+    unixSocket->connectToServer (localSocket);
+    connected = unixSocket->waitForConnected ();
+    socket = unixSocket;
+  }
   app->connect (socket, SIGNAL(disconnected()),
 		socket, SLOT(deleteLater()));
-  socket->connectToHost ("localhost", port);
-  if (socket->waitForConnected ()) {
-    socket->write (requestJson);
-    if (socket->waitForReadyRead ()) {
-      QByteArray replyJson = socket->read (BUFFER_SIZE);
+  if (connected) {
+    // requests and replies are newline-delimited
+    socket->write (requestJson + '\n');
+    while (!socket->canReadLine () && socket->waitForReadyRead ()) {
+    }
+    if (socket->canReadLine ()) {
+      QByteArray replyJson = socket->readLine ();
       QJson::Parser parser;
       bool ok;
       QMap<QString, QVariant> reply = parser.parse (replyJson, &ok).toMap();
@@ -134,8 +158,13 @@ int main(int argc, char *argv[])
       return -1;
     }
   } else {
-    qWarning () << "Error: Could not connect on port" << port
-		<< "Is Mole Daemon running?";
+    if (localSocket.isEmpty()) {
+      qWarning () << "Error: Could not connect on port" << port
+		  << "Is Mole Daemon running?";
+    } else {
+      qWarning () << "Error: Could not connect on" << localSocket
+		  << "Is Mole Daemon running?";
+    }
     return -1;
   }
 
@@ -153,6 +182,10 @@ void usage()
     << "bind [fully-qualified place name] or [place name relative to current area]\n"
     << "stats -> print statistics\n"
     << "\n"
+    << "-p port -> talk to the daemon on this local port [" << DEFAULT_LOCAL_PORT << "]\n"
+    << "-u path -> talk to the daemon on this unix domain socket\n"
+    << "-U -> talk to the daemon on " << DEFAULT_LOCAL_SOCKET << "\n"
+    << "\n"
     << "Examples:\n\n"
     << "Add to the shared signature database:\n"
     << "mole bind --country \"USA\" --region \"Massachusetts\" --city \"Cambridge\" --area \"77 Massachusetts Ave\" --floor \"1\" --space \"Information Center\"\n"
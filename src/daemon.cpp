@@ -21,11 +21,15 @@
 #include "util.h"
 #include "daemon.h"
 #include "binder.h"
+#include "flightRecorder.h"
 #include "localizer.h"
 #include "localServer.h"
 #include "scanQueue.h"
+#include "scanTrace.h"
+#include "sessionEngine.h"
 #include "speedsensor.h"
 #include "proximity.h"
+#include "virtualAP.h"
 #include "settings_access.h"
 
 #ifdef Q_WS_MAEMO_5
@@ -54,11 +58,20 @@ Daemon::Daemon(int argc, char *argv[])
   char* logFilename = defaultLogFilename;
 
   int port = DEFAULT_LOCAL_PORT;
+  QString localSocket = DEFAULT_LOCAL_SOCKET;
+  int localSocketMode = DEFAULT_LOCAL_SOCKET_MODE;
+  bool localSocketSet = false;
   bool isDaemon = true;
   bool runWiFiScanner = true;
   bool runMovementDetector = true;
   bool recordScans = false;
+  QString scanTracePath;
   bool runAllAlgorithms = false;
+  bool runSessions = false;
+  int sessionIdleMsec = DEFAULT_SESSION_IDLE_MSEC;
+  int sessionThreads = 0;
+  int statsIntervalMsec = DEFAULT_STATS_INTERVAL_MSEC;
+  int statsTopSpaces = DEFAULT_STATS_TOP_SPACES;
 
   //////////////////////////////////////////////////////////
   // Make sure no other arguments have been given
@@ -74,6 +87,10 @@ Daemon::Daemon(int argc, char *argv[])
       version();
     } else if (arg == "-d") {
         debug = true;
+    } else if (arg == "-D") {
+        debug = true;
+        if (!setDebugCategories(argsIter.next()))
+          usage();
     } else if (arg == "-n") {
         isDaemon = false;
         logFilename = NULL;
@@ -87,6 +104,9 @@ Daemon::Daemon(int argc, char *argv[])
         rootPathname = argsIter.next();
     } else if (arg == "-p") {
         port = argsIter.next().toInt();
+    } else if (arg == "-u") {
+        localSocket = argsIter.next();
+        localSocketSet = true;
     } else if (arg == "--no-accelerometer") {
         runMovementDetector = false;
     } else if (arg == "--no-wifi") {
@@ -97,6 +117,10 @@ Daemon::Daemon(int argc, char *argv[])
       runAllAlgorithms = true;
     } else if (arg == "-H") {
       SpeedSensor::HibernateWhenInactive = true;
+    } else if (arg == "-V") {
+      groupVirtualAPs = true;
+    } else if (arg == "-M") {
+      runSessions = true;
     } else {
         usage();
     }
@@ -126,9 +150,59 @@ Daemon::Daemon(int argc, char *argv[])
   if (settings->contains("port")) {
     port = settings->value("port").toInt();
   }
+  if (settings->contains("local_socket")) {
+    localSocket = settings->value("local_socket").toString();
+    localSocketSet = true;
+  }
+  // only root can create sockets in /var/run
+  if (!localSocketSet && geteuid() != 0) {
+    QByteArray runtimeDir = qgetenv("XDG_RUNTIME_DIR");
+    if (runtimeDir.isEmpty()) {
+      qWarning() << "not root and no XDG_RUNTIME_DIR, so no local socket; use -u";
+      localSocket = "";
+    } else {
+      localSocket = QDir(runtimeDir).filePath(USER_LOCAL_SOCKET);
+    }
+  }
+  if (settings->contains("local_socket_mode")) {
+    bool ok;
+    int mode = settings->value("local_socket_mode").toString().toInt(&ok, 8);
+    if (ok) {
+      localSocketMode = mode;
+    } else {
+      qWarning() << "ignoring bad local_socket_mode" << settings->value("local_socket_mode");
+    }
+  }
   if (settings->contains("root_path")) {
     rootPathname = settings->value("root_path").toString();
   }
+  if (settings->contains("group_virtual_aps")) {
+    groupVirtualAPs = settings->value("group_virtual_aps").toBool();
+  }
+  if (settings->contains("scan_trace")) {
+    scanTracePath = settings->value("scan_trace").toString();
+  }
+  if (settings->contains("sessions")) {
+    runSessions = settings->value("sessions").toBool();
+  }
+  if (settings->contains("session_idle_secs")) {
+    sessionIdleMsec = settings->value("session_idle_secs").toInt() * 1000;
+  }
+  if (settings->contains("session_threads")) {
+    sessionThreads = settings->value("session_threads").toInt();
+  }
+  if (settings->contains("stats_interval_msec")) {
+    statsIntervalMsec = settings->value("stats_interval_msec").toInt();
+  }
+  if (settings->contains("stats_top_spaces")) {
+    statsTopSpaces = settings->value("stats_top_spaces").toInt();
+  }
+
+  // a session server localizes other devices, not this one
+  if (runSessions) {
+    runWiFiScanner = false;
+    runMovementDetector = false;
+  }
 
   if (isDaemon) {
     daemonize();
@@ -139,16 +213,20 @@ Daemon::Daemon(int argc, char *argv[])
   //////////////////////////////////////////////////////////
   // check a few things before daemonizing
   initCommon(this, logFilename);
+  new TraceDumpSignal(rootDir.absolutePath(), this);
 
   qWarning() << "Starting mole daemon "
              << "debug=" << debug
              << "port=" << port
+             << "localSocket=" << localSocket
              << "wifi_scanning=" << runWiFiScanner
              << "movement_detector=" << runMovementDetector
              << "logFilename=" << logFilename
              << "map_server_url=" << mapServerURL
              << "fingerprint_server_url=" << staticServerURL
-             << "rootPath=" << rootPathname;
+             << "rootPath=" << rootPathname
+             << "groupVirtualAPs=" << groupVirtualAPs
+             << "sessions=" << runSessions;
 
   // start create map directory
   if (!rootDir.exists("map")) {
@@ -165,19 +243,43 @@ Daemon::Daemon(int argc, char *argv[])
   resetSessionCookie();
 
   m_localizer = new Localizer(this, runAllAlgorithms);
+  m_localizer->stats()->setStatsInterval(statsIntervalMsec);
+  m_localizer->stats()->setStatsTopSpaces(statsTopSpaces);
+
+  m_trace = 0;
+  if (recordScans) {
+    if (scanTracePath.isEmpty())
+      scanTracePath = rootDir.absoluteFilePath("scans.trace");
+    m_trace = new ScanTraceWriter();
+    if (m_trace->open(scanTracePath)) {
+      m_localizer->setTrace(m_trace);
+    } else {
+      delete m_trace;
+      m_trace = 0;
+    }
+  }
 
   if (runMovementDetector && SpeedSensor::haveAccelerometer()) {
-    m_scanQueue = new ScanQueue(this, m_localizer, 0, recordScans);
+    m_scanQueue = new ScanQueue(this, m_localizer, 0, m_trace);
   } else {
     // since we are not detecting motion, only use this many scans
     // for localization
     const int maxActiveQueueLength = 12;
-    m_scanQueue = new ScanQueue(this, m_localizer, maxActiveQueueLength, recordScans);
+    m_scanQueue = new ScanQueue(this, m_localizer, maxActiveQueueLength, m_trace);
   }
 
   m_binder = new Binder(this, m_localizer, m_scanQueue);
   m_proximity = new Proximity(this, m_localizer);
-  m_localServer = new LocalServer(this, m_localizer, m_binder, port);
+  m_localServer = new LocalServer(this, m_localizer, m_binder, port,
+                                  localSocket, localSocketMode);
+
+  m_sessions = 0;
+  if (runSessions) {
+    // keep every cached map, as any session may need it
+    m_localizer->setExpireMaps(false);
+    m_sessions = new SessionEngine(this, m_localizer, sessionIdleMsec, sessionThreads);
+    m_localServer->setSessionEngine(m_sessions);
+  }
 
   m_scanner = 0;
   if (runWiFiScanner) {
@@ -217,9 +319,14 @@ void Daemon::handle_quit()
     delete m_scanner;
   if (m_speedSensor)
     delete m_speedSensor;
-  delete m_localizer;
+  // the server uses the session engine, which uses the localizer
   delete m_localServer;
+  if (m_sessions)
+    delete m_sessions;
+  delete m_localizer;
   delete m_binder;
+  if (m_trace)
+    delete m_trace;
 
   qWarning() << "Stopped mole daemon";
 }
@@ -308,6 +415,8 @@ void usage()
               << "-h print usage\n"
               << "-v version\n"
               << "-d debug\n"
+              << "-D debug, with per-scan lines only from these categories, e.g. scan,map"
+              << " [" << logCategoryNames() << "]\n"
               << "-n run in foreground\n"
               << "-s map server URL [" << DEFAULT_MAP_SERVER_URL << "] \n"
               << "-f fingerprint (static) server [" << DEFAULT_STATIC_SERVER_URL << "]\n"
@@ -315,11 +424,15 @@ void usage()
               << "-r root path [" << DEFAULT_ROOT_PATH << "]"
               << " (app data stored here)\n"
               << "-p local port [" << DEFAULT_LOCAL_PORT << "]\n"
+              << "-u local socket path, empty for none [" << DEFAULT_LOCAL_SOCKET << "]\n"
               << "--no-accelerometer turn off movement detection\n"
               << "--no-wifi turn off wifi scanner\n"
-              << "-S record all scans to log file\n"
+              << "-S record scans, motion and binds to a trace for mole-replay"
+              << " [<root path>/scans.trace, or the scan_trace setting]\n"
               << "-H hibernate when accelerometer detects idleness\n"
-              << "-A run all localization algorithms for comparison\n";
+              << "-A run all localization algorithms for comparison\n"
+              << "-V group virtual APs (BSSIDs from the same radio)\n"
+              << "-M localize remote devices by session (no wifi or accelerometer)\n";
 
   exit(0);
 }
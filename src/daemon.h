@@ -25,6 +25,8 @@ class Localizer;
 class LocalServer;
 class Scanner;
 class ScanQueue;
+class ScanTraceWriter;
+class SessionEngine;
 class SpeedSensor;
 class Proximity;
 
@@ -49,6 +51,8 @@ private:
   ScanQueue *m_scanQueue;
   SpeedSensor *m_speedSensor;
   Proximity *m_proximity;
+  SessionEngine *m_sessions;
+  ScanTraceWriter *m_trace;
 };
 
 #endif /* DAEMON_H_ */
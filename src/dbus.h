@@ -23,6 +23,8 @@
 #ifdef Q_OS_SYMBIAN
 // Exclude D-Bus on Symbian
 #warning symbian: no d-bus
+#elif defined(MOLE_NO_DBUS)
+// offline tools, such as mole-replay
 #else
 #include <QtDBus>
 #define USE_MOLE_DBUS 1
@@ -0,0 +1,202 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "encoding.h"
+
+#include <string.h>
+
+#include <qjson/serializer.h>
+
+bool encodingFromName(const QString &name, Encoding &encoding)
+{
+  if (name == "json") {
+    encoding = JSON_ENCODING;
+  } else if (name == "msgpack") {
+    encoding = MSGPACK_ENCODING;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+QString encodingName(Encoding encoding)
+{
+  return encoding == MSGPACK_ENCODING ? "msgpack" : "json";
+}
+
+QByteArray encodingContentType(Encoding encoding)
+{
+  return encoding == MSGPACK_ENCODING ? "application/x-msgpack" : "application/json";
+}
+
+QByteArray encodeVariant(const QVariant &value, Encoding encoding)
+{
+  QByteArray out;
+  if (encoding == MSGPACK_ENCODING) {
+    appendMsgPack(out, value);
+  } else {
+    QJson::Serializer serializer;
+    out = serializer.serialize(value);
+    out.append('\n');
+  }
+  return out;
+}
+
+static void appendBigEndian(QByteArray &out, quint64 value, int bytes)
+{
+  for (int shift = (bytes-1)*8; shift >= 0; shift -= 8) {
+    out.append((char)((value >> shift) & 0xff));
+  }
+}
+
+static void appendUnsigned(QByteArray &out, quint64 value)
+{
+  if (value < 128) {
+    out.append((char)value);
+  } else if (value <= 0xff) {
+    out.append((char)0xcc);
+    appendBigEndian(out, value, 1);
+  } else if (value <= 0xffff) {
+    out.append((char)0xcd);
+    appendBigEndian(out, value, 2);
+  } else if (value <= 0xffffffffULL) {
+    out.append((char)0xce);
+    appendBigEndian(out, value, 4);
+  } else {
+    out.append((char)0xcf);
+    appendBigEndian(out, value, 8);
+  }
+}
+
+static void appendSigned(QByteArray &out, qint64 value)
+{
+  if (value >= 0) {
+    appendUnsigned(out, value);
+  } else if (value >= -32) {
+    out.append((char)(value & 0xff));
+  } else if (value >= -128) {
+    out.append((char)0xd0);
+    appendBigEndian(out, value, 1);
+  } else if (value >= -32768) {
+    out.append((char)0xd1);
+    appendBigEndian(out, value, 2);
+  } else if (value >= -2147483647LL-1) {
+    out.append((char)0xd2);
+    appendBigEndian(out, value, 4);
+  } else {
+    out.append((char)0xd3);
+    appendBigEndian(out, value, 8);
+  }
+}
+
+// fix, 8, 16 and 32 bit forms share this layout for str, array and map
+static void appendHeader(QByteArray &out, quint32 length,
+                         int fixTag, quint32 fixMax, int tag8, int tag16, int tag32)
+{
+  if (length <= fixMax) {
+    out.append((char)(fixTag | length));
+  } else if (tag8 && length <= 0xff) {
+    out.append((char)tag8);
+    appendBigEndian(out, length, 1);
+  } else if (length <= 0xffff) {
+    out.append((char)tag16);
+    appendBigEndian(out, length, 2);
+  } else {
+    out.append((char)tag32);
+    appendBigEndian(out, length, 4);
+  }
+}
+
+static void appendString(QByteArray &out, const QString &string)
+{
+  QByteArray utf8 = string.toUtf8();
+  appendHeader(out, utf8.size(), 0xa0, 31, 0xd9, 0xda, 0xdb);
+  out.append(utf8);
+}
+
+static void appendDouble(QByteArray &out, double value)
+{
+  quint64 bits;
+  memcpy(&bits, &value, sizeof(bits));
+  out.append((char)0xcb);
+  appendBigEndian(out, bits, 8);
+}
+
+void appendMsgPack(QByteArray &out, const QVariant &value)
+{
+  switch (value.type()) {
+  case QVariant::Invalid:
+    out.append((char)0xc0);
+    break;
+  case QVariant::Bool:
+    out.append((char)(value.toBool() ? 0xc3 : 0xc2));
+    break;
+  case QVariant::Int:
+  case QVariant::LongLong:
+    appendSigned(out, value.toLongLong());
+    break;
+  case QVariant::UInt:
+  case QVariant::ULongLong:
+    appendUnsigned(out, value.toULongLong());
+    break;
+  case QVariant::Double:
+    appendDouble(out, value.toDouble());
+    break;
+  case QVariant::ByteArray: {
+    QByteArray bytes = value.toByteArray();
+    if (bytes.size() <= 0xff) {
+      out.append((char)0xc4);
+      appendBigEndian(out, bytes.size(), 1);
+    } else if (bytes.size() <= 0xffff) {
+      out.append((char)0xc5);
+      appendBigEndian(out, bytes.size(), 2);
+    } else {
+      out.append((char)0xc6);
+      appendBigEndian(out, bytes.size(), 4);
+    }
+    out.append(bytes);
+    break;
+  }
+  case QVariant::List:
+  case QVariant::StringList: {
+    QVariantList list = value.toList();
+    appendHeader(out, list.size(), 0x90, 15, 0, 0xdc, 0xdd);
+    foreach (const QVariant &item, list) {
+      appendMsgPack(out, item);
+    }
+    break;
+  }
+  case QVariant::Map: {
+    QVariantMap map = value.toMap();
+    appendHeader(out, map.size(), 0x80, 15, 0, 0xde, 0xdf);
+    QMapIterator<QString,QVariant> it (map);
+    while (it.hasNext()) {
+      it.next();
+      appendString(out, it.key());
+      appendMsgPack(out, it.value());
+    }
+    break;
+  }
+  default:
+    if (value.userType() == QMetaType::Float) {
+      appendDouble(out, value.toDouble());
+    } else {
+      appendString(out, value.toString());
+    }
+    break;
+  }
+}
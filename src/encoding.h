@@ -0,0 +1,41 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ENCODING_H_
+#define ENCODING_H_
+
+#include <QtCore>
+
+// Wire encodings for local API replies and monitor updates.
+// Json is the default; MessagePack (http://msgpack.org) carries the
+// same maps and is much cheaper to produce and parse at high rates.
+enum Encoding {
+  JSON_ENCODING,
+  MSGPACK_ENCODING
+};
+
+// "json" or "msgpack"
+bool encodingFromName(const QString &name, Encoding &encoding);
+QString encodingName(Encoding encoding);
+QByteArray encodingContentType(Encoding encoding);
+
+// Json replies are newline terminated; MessagePack is self-delimiting.
+QByteArray encodeVariant(const QVariant &value, Encoding encoding);
+
+void appendMsgPack(QByteArray &out, const QVariant &value);
+
+#endif /* ENCODING_H_ */
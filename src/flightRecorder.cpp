@@ -0,0 +1,248 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flightRecorder.h"
+#include "encoding.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+QString flightEventName(FlightEventKind kind)
+{
+  switch (kind) {
+  case FLIGHT_SCAN:
+    return "Scan";
+  case FLIGHT_DUPLICATE_SCAN:
+    return "DuplicateScan";
+  case FLIGHT_CANDIDATES:
+    return "Candidates";
+  case FLIGHT_SCORES:
+    return "Scores";
+  case FLIGHT_MAP_FETCH:
+    return "MapFetch";
+  case FLIGHT_MAP_PARSE:
+    return "MapParse";
+  case FLIGHT_MONITOR_PUSH:
+    return "MonitorPush";
+  default:
+    return "Unknown";
+  }
+}
+
+// what an event's count is of
+static const char *countName(int kind)
+{
+  switch (kind) {
+  case FLIGHT_SCAN:
+  case FLIGHT_DUPLICATE_SCAN:
+    return "readings";
+  case FLIGHT_CANDIDATES:
+    return "spaces";
+  case FLIGHT_SCORES:
+    return "candidates";
+  default:
+    return "bytes";
+  }
+}
+
+static void copyName(char *to, const QString &name)
+{
+  int from = qMax(0, name.size() - (FLIGHT_NAME_BYTES - 1));
+  int n = 0;
+  for (int i = from; i < name.size(); ++i)
+    to[n++] = name.at(i).toLatin1();
+  to[n] = 0;
+}
+
+Q_GLOBAL_STATIC(FlightRecorder, globalFlightRecorder)
+
+FlightRecorder *flightRecorder()
+{
+  return globalFlightRecorder();
+}
+
+FlightRecorder::FlightRecorder()
+{
+  m_clock.start();
+  for (int i = 0; i < FLIGHT_EVENTS; ++i)
+    m_written[i] = -1;
+}
+
+// A writer that laps the ring while another still writes the same
+// slot could mix two events; with this many slots that would take a
+// thread stalled for thousands of events.
+FlightEvent &FlightRecorder::claim(int &slot, int &position)
+{
+  position = m_next.fetchAndAddRelaxed(1) & INT_MAX;
+  slot = position & (FLIGHT_EVENTS - 1);
+  m_written[slot].fetchAndStoreOrdered(-1);
+  return m_events[slot];
+}
+
+void FlightRecorder::publish(int slot, int position)
+{
+  m_written[slot].fetchAndStoreRelease(position);
+}
+
+void FlightRecorder::record(FlightEventKind kind, qint64 startNsec, qint64 count,
+                            const QString &name)
+{
+  qint64 end = m_clock.nsecsElapsed();
+  int slot, position;
+  FlightEvent &event = claim(slot, position);
+  event.startNsec = startNsec;
+  event.durationNsec = end - startNsec;
+  event.count = count;
+  event.thread = (quintptr) QThread::currentThreadId();
+  event.kind = kind;
+  event.names = 0;
+  if (!name.isEmpty()) {
+    copyName(event.name[0], name);
+    event.names = 1;
+  }
+  publish(slot, position);
+}
+
+void FlightRecorder::recordScores(qint64 startNsec, qint64 durationNsec, int candidates,
+                                  const QList<QPair<QString,double> > &ranked)
+{
+  int slot, position;
+  FlightEvent &event = claim(slot, position);
+  event.startNsec = startNsec;
+  event.durationNsec = durationNsec;
+  event.count = candidates;
+  event.thread = (quintptr) QThread::currentThreadId();
+  event.kind = FLIGHT_SCORES;
+  event.names = qMin(ranked.size(), FLIGHT_NAMES);
+  for (int i = 0; i < event.names; ++i) {
+    copyName(event.name[i], ranked.at(i).first);
+    event.score[i] = ranked.at(i).second;
+  }
+  publish(slot, position);
+}
+
+static bool startsBefore(const FlightEvent &a, const FlightEvent &b)
+{
+  return a.startNsec < b.startNsec;
+}
+
+QVariantMap FlightRecorder::chromeTrace() const
+{
+  // copy out each event that was not being written meanwhile
+  QVector<FlightEvent> events;
+  events.reserve(FLIGHT_EVENTS);
+  for (int i = 0; i < FLIGHT_EVENTS; ++i) {
+    int before = m_written[i].fetchAndAddAcquire(0);
+    if (before < 0)
+      continue;
+    FlightEvent event = m_events[i];
+    if (m_written[i].fetchAndAddOrdered(0) == before)
+      events.append(event);
+  }
+  qSort(events.begin(), events.end(), startsBefore);
+
+  // Chrome wants small thread ids
+  QHash<quintptr,int> threads;
+  qint64 pid = QCoreApplication::applicationPid();
+
+  QVariantList traceEvents;
+  for (int i = 0; i < events.size(); ++i) {
+    const FlightEvent &event = events.at(i);
+    if (!threads.contains(event.thread))
+      threads.insert(event.thread, threads.size() + 1);
+
+    QVariantMap args;
+    args.insert(countName(event.kind), event.count);
+    if (event.kind == FLIGHT_SCORES) {
+      QVariantList scores;
+      for (int j = 0; j < event.names; ++j) {
+        QVariantMap score;
+        score.insert("space", QString::fromLatin1(event.name[j]));
+        score.insert("score", event.score[j]);
+        scores.append(score);
+      }
+      args.insert("top", scores);
+    } else if (event.names > 0) {
+      args.insert("name", QString::fromLatin1(event.name[0]));
+    }
+
+    QVariantMap map;
+    map.insert("name", flightEventName((FlightEventKind) event.kind));
+    map.insert("cat", "mole");
+    map.insert("ph", "X");
+    map.insert("ts", event.startNsec / 1000.);
+    map.insert("dur", event.durationNsec / 1000.);
+    map.insert("pid", pid);
+    map.insert("tid", threads.value(event.thread));
+    map.insert("args", args);
+    traceEvents.append(map);
+  }
+
+  QVariantMap trace;
+  trace.insert("traceEvents", traceEvents);
+  trace.insert("displayTimeUnit", "ms");
+  return trace;
+}
+
+bool FlightRecorder::dump(const QString &path) const
+{
+  QFile file (path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    qWarning() << "could not write trace" << path;
+    return false;
+  }
+  file.write(encodeVariant(chromeTrace(), JSON_ENCODING));
+  file.close();
+  qWarning() << "wrote trace" << path;
+  return true;
+}
+
+int TraceDumpSignal::s_fds[2];
+
+TraceDumpSignal::TraceDumpSignal(const QString &dir, QObject *parent)
+  : QObject(parent)
+  , m_dir(dir)
+{
+  if (::socketpair(AF_UNIX, SOCK_STREAM, 0, s_fds) != 0)
+    qFatal("could not create trace signal socket pair");
+  // the handler must never block
+  ::fcntl(s_fds[0], F_SETFL, ::fcntl(s_fds[0], F_GETFL) | O_NONBLOCK);
+  m_notifier = new QSocketNotifier(s_fds[1], QSocketNotifier::Read, this);
+  connect(m_notifier, SIGNAL(activated(int)), SLOT(handleSignal()));
+  ::signal(SIGUSR1, &TraceDumpSignal::signalHandler);
+}
+
+void TraceDumpSignal::signalHandler(int)
+{
+  char c = 1;
+  // a full socket already has a dump pending
+  if (::write(s_fds[0], &c, sizeof(c)) != sizeof(c))
+    return;
+}
+
+void TraceDumpSignal::handleSignal()
+{
+  char c;
+  if (::read(s_fds[1], &c, sizeof(c)) != sizeof(c))
+    return;
+  flightRecorder()->dump
+    (QDir(m_dir).filePath
+     ("trace-" + QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss") + ".json"));
+}
@@ -0,0 +1,125 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLIGHT_RECORDER_H_
+#define FLIGHT_RECORDER_H_
+
+#include <QtCore>
+
+// What the flight recorder keeps track of.
+enum FlightEventKind {
+  // ScanQueue::scanCompleted, count = readings
+  FLIGHT_SCAN,
+  // a scan rejected as a repeat of the last, count = readings
+  FLIGHT_DUPLICATE_SCAN,
+  // Localizer::localize picking candidates, count = spaces
+  FLIGHT_CANDIDATES,
+  // a scoring result applied, with the top scores, count = candidates
+  FLIGHT_SCORES,
+  // a map arriving from the server, name = area, count = bytes
+  FLIGHT_MAP_FETCH,
+  // Localizer::parseMap, name = area, count = bytes
+  FLIGHT_MAP_PARSE,
+  // an update written to a monitor, name = encoding, count = bytes
+  FLIGHT_MONITOR_PUSH,
+  FLIGHT_EVENT_KINDS
+};
+
+QString flightEventName(FlightEventKind kind);
+
+// must be a power of two
+const int FLIGHT_EVENTS = 2048;
+const int FLIGHT_NAMES = 3;
+const int FLIGHT_NAME_BYTES = 48;
+
+class FlightEvent
+{
+ public:
+  qint64 startNsec;
+  qint64 durationNsec;
+  qint64 count;
+  quintptr thread;
+  int kind;
+  // names (and for FLIGHT_SCORES, scores) set
+  int names;
+  // the ends of long names, which say the most
+  char name[FLIGHT_NAMES][FLIGHT_NAME_BYTES];
+  float score[FLIGHT_NAMES];
+};
+
+// The last FLIGHT_EVENTS things the pipeline did, always on, so a bad
+// estimate or a stall can be looked at after the fact.  Recording an
+// event is an atomic increment and a copy into a fixed slot, with no
+// locks or allocation, from any thread; mole-bench measures its cost.
+//
+// Dumped as Chrome trace event json (chrome://tracing, Perfetto) by the
+// "trace" action of the local API, or to a file on SIGUSR1.
+class FlightRecorder
+{
+ public:
+  FlightRecorder();
+
+  // nsec since the recorder started, for the start of an event
+  qint64 now() const { return m_clock.nsecsElapsed(); }
+
+  // an event that started at startNsec and ends now
+  void record(FlightEventKind kind, qint64 startNsec, qint64 count = 0,
+              const QString &name = QString());
+  // the first FLIGHT_NAMES of ranked (best first) spaces and scores
+  void recordScores(qint64 startNsec, qint64 durationNsec, int candidates,
+                    const QList<QPair<QString,double> > &ranked);
+
+  // {"traceEvents":[...]}, oldest first
+  QVariantMap chromeTrace() const;
+  bool dump(const QString &path) const;
+
+ private:
+  QElapsedTimer m_clock;
+  QAtomicInt m_next;
+  // the position each slot was last written at, -1 while being written
+  mutable QAtomicInt m_written[FLIGHT_EVENTS];
+  FlightEvent m_events[FLIGHT_EVENTS];
+
+  FlightEvent &claim(int &slot, int &position);
+  void publish(int slot, int position);
+
+  Q_DISABLE_COPY(FlightRecorder)
+};
+
+FlightRecorder *flightRecorder();
+
+// Writes the trace to <dir>/trace-<time>.json each time the process
+// gets SIGUSR1.  The handler only wakes the event loop, which dumps.
+class TraceDumpSignal : public QObject
+{
+  Q_OBJECT
+
+ public:
+  TraceDumpSignal(const QString &dir, QObject *parent = 0);
+
+ private slots:
+  void handleSignal();
+
+ private:
+  QString m_dir;
+  QSocketNotifier *m_notifier;
+
+  static int s_fds[2];
+  static void signalHandler(int);
+};
+
+#endif /* FLIGHT_RECORDER_H_ */
@@ -59,6 +59,8 @@ BinderGUI::BinderGUI(QWidget *parent)
     (QString(), QString(), "com.nokia.moled", "LocationEstimate", this,
      SLOT(handleLocationEstimate(QString)));
 
+  subscribeStatistics();
+
   //QDBusConnection::systemBus().connect
   //(QString(), QString(), "com.nokia.moled", "MotionEstimate", this,
   //SLOT(onSpeedStatusChanged(int)));
@@ -640,6 +642,8 @@ void BinderGUI::setDaemonLabel(bool online)
 
 void BinderGUI::onDaemonTimerTimeout () {
   qDebug () << "onDaemonTimerTimeout";
+  // the daemon may have restarted and forgotten us
+  subscribeStatistics();
   if (!m_daemonOnline) {
     setSubmitState (SCANNING);
   }
@@ -655,6 +659,14 @@ void BinderGUI::receivedDaemonMsg () {
   }
 }
 
+// moled only sends LocationStats while someone has subscribed
+void BinderGUI::subscribeStatistics()
+{
+  QDBusMessage msg = QDBusMessage::createSignal("/", "com.nokia.moled", "SubscribeStatistics");
+  msg << QString("full");
+  QDBusConnection::systemBus().send(msg);
+}
+
 void BinderGUI::requestLocationEstimate()
 {
   qDebug() << "BinderGUI: request location estimate";
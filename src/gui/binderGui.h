@@ -100,6 +100,7 @@ private:
   void sendBindMsg(BindSource);
   void setSubmitState(SubmitState state, int scanCount = 0);
   void setDaemonLabel(bool);
+  void subscribeStatistics();
   void receivedDaemonMsg ();
 
 private slots:
@@ -0,0 +1,129 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "latencyHistogram.h"
+
+#include <math.h>
+
+QString pipelineStageName(PipelineStage stage)
+{
+  switch (stage) {
+  case SCAN_STAGE:
+    return "Scan";
+  case LOCALIZE_STAGE:
+    return "Localize";
+  case SCORE_WAIT_STAGE:
+    return "ScoreWait";
+  case SCORE_STAGE:
+    return "Score";
+  case PARSE_MAP_STAGE:
+    return "ParseMap";
+  case REQUEST_STAGE:
+    return "Request";
+  case ENCODE_STAGE:
+    return "Encode";
+  default:
+    return "Unknown";
+  }
+}
+
+// Values below LATENCY_SUB_BUCKETS have a bucket each.  Above, a value
+// is shifted down into [LATENCY_SUB_BUCKETS, 2*LATENCY_SUB_BUCKETS);
+// the shift picks the range and what is left the bucket within it.
+int LatencyHistogram::bucket(qint64 nsec)
+{
+  if (nsec < LATENCY_SUB_BUCKETS)
+    return nsec < 0 ? 0 : (int) nsec;
+
+  quint64 value = nsec;
+  int magnitude = 0;
+  while (value >= (quint64) 2 * LATENCY_SUB_BUCKETS) {
+    value >>= 1;
+    ++magnitude;
+  }
+  int index = (magnitude + 1) * LATENCY_SUB_BUCKETS + (int) (value - LATENCY_SUB_BUCKETS);
+  return qMin(index, LATENCY_BUCKETS - 1);
+}
+
+qint64 LatencyHistogram::bucketMiddle(int index)
+{
+  if (index < LATENCY_SUB_BUCKETS)
+    return index;
+
+  int magnitude = index / LATENCY_SUB_BUCKETS - 1;
+  qint64 lowest = (qint64) (LATENCY_SUB_BUCKETS + index % LATENCY_SUB_BUCKETS) << magnitude;
+  return lowest + (((qint64) 1 << magnitude) >> 1);
+}
+
+qint64 LatencyHistogram::count() const
+{
+  qint64 total = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+    total += m_counts[i];
+  }
+  return total;
+}
+
+qint64 LatencyHistogram::percentile(double pct) const
+{
+  qint64 total = count();
+  if (total == 0)
+    return 0;
+
+  // values recorded meanwhile may push the rank past the last bucket
+  qint64 rank = qMax((qint64) 1, (qint64) ceil(total * pct / 100.));
+  qint64 seen = 0;
+  int last = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+    if (m_counts[i] == 0)
+      continue;
+    seen += m_counts[i];
+    last = i;
+    if (seen >= rank)
+      break;
+  }
+  return bucketMiddle(last);
+}
+
+qint64 LatencyHistogram::max() const
+{
+  for (int i = LATENCY_BUCKETS - 1; i >= 0; --i) {
+    if (m_counts[i] != 0)
+      return bucketMiddle(i);
+  }
+  return 0;
+}
+
+void LatencyHistogram::snapshot(QVector<int> &counts) const
+{
+  counts.resize(LATENCY_BUCKETS);
+  for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+    counts[i] = m_counts[i];
+  }
+}
+
+QVariantMap LatencyHistogram::asMap() const
+{
+  QVariantMap map;
+  map.insert("Count", count());
+  map.insert("P50", percentile(50.) / 1000.);
+  map.insert("P90", percentile(90.) / 1000.);
+  map.insert("P99", percentile(99.) / 1000.);
+  map.insert("P999", percentile(99.9) / 1000.);
+  map.insert("Max", max() / 1000.);
+  return map;
+}
@@ -0,0 +1,102 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LATENCY_HISTOGRAM_H_
+#define LATENCY_HISTOGRAM_H_
+
+#include <QtCore>
+
+// Stages of the localization pipeline whose latency is recorded.
+enum PipelineStage {
+  // ScanQueue::scanCompleted, including localize
+  SCAN_STAGE,
+  // Localizer::localize: picking candidates and submitting the scan
+  LOCALIZE_STAGE,
+  // a submitted scan waiting for the scoring worker
+  SCORE_WAIT_STAGE,
+  // scoring a scan's candidates on the worker
+  SCORE_STAGE,
+  // Localizer::parseMap
+  PARSE_MAP_STAGE,
+  // LocalServer handling a request, up to writing its reply
+  REQUEST_STAGE,
+  // LocalServer encoding a reply
+  ENCODE_STAGE,
+  PIPELINE_STAGES
+};
+
+QString pipelineStageName(PipelineStage stage);
+
+// Log-linear histogram of latencies, as in HdrHistogram: each power of
+// two range of nsec is split into LATENCY_SUB_BUCKETS linear buckets,
+// so a recorded value is off by at most 1/LATENCY_SUB_BUCKETS.
+// Recording only increments an atomic counter, so any thread may
+// record while others record or read.
+const int LATENCY_SUB_BUCKETS = 32;
+// ranges of powers of two above the first LATENCY_SUB_BUCKETS nsec,
+// up to about half an hour
+const int LATENCY_MAGNITUDES = 36;
+const int LATENCY_BUCKETS = (LATENCY_MAGNITUDES + 2) * LATENCY_SUB_BUCKETS;
+
+class LatencyHistogram
+{
+ public:
+  LatencyHistogram() {}
+
+  void record(qint64 nsec) { m_counts[bucket(nsec)].ref(); }
+
+  qint64 count() const;
+  // nsec below which pct percent of the recorded values lie
+  qint64 percentile(double pct) const;
+  qint64 max() const;
+
+  // Count, and P50, P90, P99, P999 and Max in usec
+  QVariantMap asMap() const;
+
+  // a copy of the counts of all LATENCY_BUCKETS buckets
+  void snapshot(QVector<int> &counts) const;
+  // the nsec a bucket's values are taken to be
+  static qint64 bucketMiddle(int index);
+
+ private:
+  QAtomicInt m_counts[LATENCY_BUCKETS];
+
+  static int bucket(qint64 nsec);
+
+  Q_DISABLE_COPY(LatencyHistogram)
+};
+
+// Records the time from its construction to its destruction,
+// across any early returns.  A null histogram records nothing.
+class LatencyTimer
+{
+ public:
+  LatencyTimer(LatencyHistogram *histogram) : m_histogram(histogram) {
+    if (m_histogram)
+      m_timer.start();
+  }
+  ~LatencyTimer() {
+    if (m_histogram)
+      m_histogram->record(m_timer.nsecsElapsed());
+  }
+
+ private:
+  LatencyHistogram *m_histogram;
+  QElapsedTimer m_timer;
+};
+
+#endif /* LATENCY_HISTOGRAM_H_ */
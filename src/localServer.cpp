@@ -18,100 +18,604 @@
 
 #include "localServer.h"
 #include "binder.h"
+#include "flightRecorder.h"
 #include "localizer.h"
+#include "sessionEngine.h"
 
 #include <QTcpSocket>
 
+#include <sys/stat.h>
+
 #include <qjson/parser.h>
-#include <qjson/serializer.h>
 
-const int  BUFFER_SIZE = 1024;
+// larger incomplete requests are dropped
+const int MAX_REQUEST_SIZE = 64*1024;
+// connections without a request for this long are closed
+const int IDLE_CONNECTION_MSEC = 30000;
+// longest a query may wait for the estimate to change
+const int MAX_QUERY_WAIT_MSEC = 60000;
 
-LocalServer::LocalServer(QObject *parent, Localizer *_localizer, Binder *_binder, int port)
+LocalServer::LocalServer(QObject *parent, Localizer *_localizer, Binder *_binder, int port,
+                         const QString &socketPath, int socketMode)
   :QTcpServer(parent)
   , m_localizer(_localizer)
   , m_binder(_binder)
+  , m_sessions(0)
 {
+  m_connectionCount = metrics()->counter
+    ("mole_local_connections", "Client connections accepted by the local server.");
+  m_requestCount = metrics()->counter
+    ("mole_local_requests", "Requests handled by the local server.");
+  m_replyByteCount = metrics()->counter
+    ("mole_local_reply_bytes", "Bytes of replies written by the local server.");
+
   bool ok = listen(QHostAddress::LocalHost, port);
   if (!ok)
     qFatal ("LocalServer cannot listen on port");
 
-  connect(this, SIGNAL(newConnection()), this, SLOT(handleRequest()));
+  connect(this, SIGNAL(newConnection()), this, SLOT(handleConnection()));
 
   if (!isListening())
     qFatal ("LS: not listening");
 
+  if (!socketPath.isEmpty())
+    listenLocalSocket(socketPath, socketMode);
+
+  connect(&m_idleTimer, SIGNAL(timeout()), this, SLOT(closeIdleConnections()));
+  m_idleTimer.start(IDLE_CONNECTION_MSEC/2);
+
+  m_parkTimer.setSingleShot(true);
+  connect(&m_parkTimer, SIGNAL(timeout()), this, SLOT(handleParkTimeout()));
+  // queued, as estimates can change while a bind request is handled
+  connect(m_localizer, SIGNAL(estimateChanged()), this, SLOT(handleEstimateChanged()),
+          Qt::QueuedConnection);
+
   qDebug() << "LocalServer started on" << serverAddress() << ":" << serverPort();
 }
 
 LocalServer::~LocalServer()
 {
   close();
+  m_localSocketServer.close();
 }
 
-void LocalServer::handleRequest()
+// Local clients can skip TCP setup by using a unix domain socket.
+// Who may connect is controlled by the mode of the socket file.
+void LocalServer::listenLocalSocket(const QString &socketPath, int socketMode)
 {
-  if (!hasPendingConnections()) {
-    qWarning() << "LS: handleRequest had no pending connection";
+  // remove a socket file left over from an earlier run
+  QLocalServer::removeServer(socketPath);
+
+  if (!m_localSocketServer.listen(socketPath)) {
+    qWarning() << "LS: cannot listen on local socket" << socketPath
+               << m_localSocketServer.errorString()
+               << "- serving TCP only; set another path with -u or local_socket";
     return;
   }
 
-  QTcpSocket *socket = nextPendingConnection();
+  QByteArray path = QFile::encodeName(m_localSocketServer.fullServerName());
+  if (chmod(path.constData(), socketMode) != 0) {
+    qWarning() << "LS: cannot set mode of local socket" << path;
+  }
+
+  connect(&m_localSocketServer, SIGNAL(newConnection()),
+          this, SLOT(handleLocalConnection()));
+
+  qDebug() << "LocalServer started on" << m_localSocketServer.fullServerName();
+}
+
+void LocalServer::setSessionEngine(SessionEngine *sessions)
+{
+  m_sessions = sessions;
+  connect(m_sessions, SIGNAL(localized(quint32,QVariantList)),
+          this, SLOT(handleLocalized(quint32,QVariantList)));
+}
+
+// Connections are never read from synchronously.
+// Input is buffered per connection and each complete request
+// is answered in order, so clients can pipeline several requests
+// and keep the connection open between them.
+void LocalServer::handleConnection()
+{
+  while (hasPendingConnections()) {
+    addConnection(nextPendingConnection());
+  }
+}
+
+void LocalServer::handleLocalConnection()
+{
+  while (m_localSocketServer.hasPendingConnections()) {
+    addConnection(m_localSocketServer.nextPendingConnection());
+  }
+}
+
+void LocalServer::addConnection(QIODevice *socket)
+{
+  connect(socket, SIGNAL(readyRead()), this, SLOT(handleReadyRead()));
+  connect(socket, SIGNAL(disconnected()), this, SLOT(handleDisconnected()));
   connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
-  // This blocks everything...
-  // so can be used for testing (sending request via telnet)
-  socket->waitForReadyRead(10000);
-  bool monitor = false;
-  QByteArray reply;
-  if (socket->bytesAvailable() > 0) {
-    QByteArray request = socket->read(BUFFER_SIZE);
+  m_buffers.insert(socket, QByteArray());
+  m_lastActivity[socket].start();
+  m_connectionCount->increment();
+}
+
+void LocalServer::closeConnection(QIODevice *socket)
+{
+  m_buffers.remove(socket);
+  m_lastActivity.remove(socket);
+  m_encodings.remove(socket);
+  m_keepAlive.remove(socket);
+  m_parked.remove(socket);
+  m_pending.remove(socket);
+
+  QTcpSocket *tcpSocket = qobject_cast<QTcpSocket *>(socket);
+  if (tcpSocket) {
+    tcpSocket->disconnectFromHost();
+    return;
+  }
+  QLocalSocket *localSocket = qobject_cast<QLocalSocket *>(socket);
+  if (localSocket) {
+    localSocket->disconnectFromServer();
+  }
+}
+
+void LocalServer::handleReadyRead()
+{
+  QIODevice *socket = qobject_cast<QIODevice *>(sender());
+  if (!socket || !m_buffers.contains(socket))
+    return;
 
+  m_buffers[socket].append(socket->readAll());
+  m_lastActivity[socket].start();
+  processInput(socket);
+}
+
+void LocalServer::handleDisconnected()
+{
+  QIODevice *socket = qobject_cast<QIODevice *>(sender());
+  m_buffers.remove(socket);
+  m_lastActivity.remove(socket);
+  m_encodings.remove(socket);
+  m_keepAlive.remove(socket);
+  m_parked.remove(socket);
+  m_pending.remove(socket);
+}
+
+void LocalServer::closeIdleConnections()
+{
+  QList<QIODevice*> idle;
+  QMapIterator<QIODevice*,QElapsedTimer> it (m_lastActivity);
+  while (it.hasNext()) {
+    it.next();
+    if (it.value().elapsed() > IDLE_CONNECTION_MSEC &&
+        !m_parked.contains(it.key()) && !m_pending.contains(it.key()))
+      idle << it.key();
+  }
+  foreach (QIODevice *socket, idle) {
+    moleDebug(SERVER_LOG) << "LS: closing idle connection";
+    closeConnection(socket);
+  }
+}
+
+void LocalServer::processInput(QIODevice *socket)
+{
+  while (m_buffers.contains(socket) &&
+         !m_parked.contains(socket) && !m_pending.contains(socket)) {
+    QByteArray &buffer = m_buffers[socket];
+
+    // skip any whitespace between requests
+    int start = 0;
+    while (start < buffer.size() && isspace((unsigned char) buffer.at(start)))
+      ++start;
+    buffer.remove(0, start);
+    if (buffer.isEmpty())
+      return;
+
+    LocalRequest request;
+    int length = 0;
+    if (buffer.startsWith("GET ") || buffer.startsWith("POST ")) {
+      length = frameHttp(buffer, request);
+    } else if (QByteArray("GET ").startsWith(buffer) ||
+               QByteArray("POST ").startsWith(buffer)) {
+      length = 0;
+    } else {
+      length = frameJson(buffer);
+      request.content = buffer.left(length);
+    }
+
+    if (length == 0) {
+      if (buffer.size() > MAX_REQUEST_SIZE) {
+        qWarning() << "LS: request too large, closing connection";
+        closeConnection(socket);
+      }
+      return;
+    }
+
+    if (length < 0) {
+      qWarning() << "LS: cannot frame request" << buffer.left(80);
+      if (request.isHttp) {
+        QByteArray reply;
+        contentToHttp(reply, 400, false, RequestContext());
+        socket->write(reply);
+      } else {
+        socket->write("{ \"status\" : \"Error: could not parse json in request\" }\n");
+      }
+      closeConnection(socket);
+      return;
+    }
+
+    buffer.remove(0, length);
+    handleRequest(socket, request);
+  }
+}
+
+// Returns the length of the json object or array at the start of the
+// buffer, 0 if it is not complete yet, or -1 if it is not json.
+int LocalServer::frameJson(const QByteArray &buffer)
+{
+  if (buffer.isEmpty())
+    return 0;
+  if (buffer.at(0) != '{' && buffer.at(0) != '[')
+    return -1;
+
+  int depth = 0;
+  bool inString = false;
+  for (int i = 0; i < buffer.size(); ++i) {
+    char c = buffer.at(i);
+    if (inString) {
+      if (c == '\\')
+        ++i;
+      else if (c == '"')
+        inString = false;
+    } else if (c == '"') {
+      inString = true;
+    } else if (c == '{' || c == '[') {
+      ++depth;
+    } else if (c == '}' || c == ']') {
+      --depth;
+      if (depth == 0)
+        return i + 1;
+    }
+  }
+  return 0;
+}
+
+// Returns the length of the HTTP request at the start of the buffer,
+// including its body, 0 if it is not complete yet, or -1 if its
+// Content-Length is not a length.
+int LocalServer::frameHttp(const QByteArray &buffer, LocalRequest &request)
+{
+  int headerLength = buffer.indexOf("\r\n\r\n");
+  if (headerLength >= 0) {
+    headerLength += 4;
+  } else {
+    headerLength = buffer.indexOf("\n\n");
+    if (headerLength < 0)
+      return 0;
+    headerLength += 2;
+  }
+
+  QList<QByteArray> lines = buffer.left(headerLength).split('\n');
+  QList<QByteArray> requestLine = lines.at(0).trimmed().split(' ');
+  request.isHttp = true;
+  request.method = requestLine.value(0);
+  request.path = requestLine.value(1);
+  request.keepAlive = (requestLine.value(2) == "HTTP/1.1");
+
+  for (int i = 1; i < lines.size(); ++i) {
+    int colon = lines.at(i).indexOf(':');
+    if (colon > 0) {
+      QByteArray name = lines.at(i).left(colon).trimmed().toLower();
+      request.headers.insert(name, lines.at(i).mid(colon+1).trimmed());
+    }
+  }
+
+  QByteArray connection = request.headers.value("connection").toLower();
+  if (connection == "close") {
+    request.keepAlive = false;
+  } else if (connection == "keep-alive") {
+    request.keepAlive = true;
+  }
+
+  int contentLength = 0;
+  if (request.headers.contains("content-length")) {
     bool ok;
-    bool isHttp = httpToContent (request, ok);
+    contentLength = request.headers.value("content-length").toInt(&ok);
+    if (!ok || contentLength < 0)
+      return -1;
+  } else if (request.method == "POST") {
+    // older clients send the json body without a length
+    contentLength = frameJson(buffer.mid(headerLength));
+    if (contentLength <= 0)
+      return contentLength;
+  }
+
+  if (buffer.size() < headerLength + contentLength)
+    return 0;
 
-    if (ok) {
-      QVariantMap replyMap = handleRequest(request, monitor);
-      QJson::Serializer serializer;
-      reply = serializer.serialize(replyMap);
+  request.content = buffer.mid(headerLength, contentLength);
+  return headerLength + contentLength;
+}
+
+void LocalServer::handleRequest(QIODevice *socket, LocalRequest &request)
+{
+  LatencyTimer latency (m_localizer->latency(REQUEST_STAGE));
+  RequestContext context;
+  int status = 200;
+  QVariant replyValue;
+  m_requestCount->increment();
+
+  // requests are always json; replies are in the connection's encoding,
+  // which a request can change by naming an "encoding"
+  context.encoding = m_encodings.value(socket, JSON_ENCODING);
+  context.knownVersion = request.knownVersion;
+  if (request.isHttp &&
+      request.headers.value("accept").contains(encodingContentType(MSGPACK_ENCODING))) {
+    context.encoding = MSGPACK_ENCODING;
+  }
+
+  if (request.isHttp && request.method == "GET" &&
+      QUrl::fromEncoded(request.path).path() == "/metrics") {
+    context.contentType = OPENMETRICS_CONTENT_TYPE;
+    context.content = metrics()->openMetrics();
+  } else if (request.isHttp && request.method == "GET") {
+    QVariantMap getRequest;
+    if (httpGetToRequest(request, getRequest)) {
+      replyValue = handleAction(getRequest, context);
+    } else {
+      status = 404;
     }
-    if (isHttp) {
-      contentToHttp (reply, ok);
+  } else if (request.isHttp && request.method != "POST") {
+    status = 400;
+  } else {
+    replyValue = handleRequest(request.content, context);
+  }
+
+  if (!request.isHttp) {
+    if (context.encoding == JSON_ENCODING) {
+      m_encodings.remove(socket);
+    } else {
+      m_encodings.insert(socket, context.encoding);
     }
+    if (context.keepAlive)
+      m_keepAlive.insert(socket);
+    request.keepAlive = m_keepAlive.contains(socket);
   }
 
-  if (!monitor) {
-    socket->write(reply);
-    qDebug () << "wrote reply" << reply;
-    qDebug() << "handleRequest from port" << socket->peerPort();
-    socket->disconnectFromHost();
+  if (context.monitor) {
+    // the localizer writes to this connection from now on
+    disconnect(socket, SIGNAL(readyRead()), this, SLOT(handleReadyRead()));
+    m_buffers.remove(socket);
+    m_lastActivity.remove(socket);
+    m_encodings.remove(socket);
+    context.monitorOptions.encoding = context.encoding;
+    m_localizer->addMonitor(socket, context.monitorOptions);
+    return;
+  }
+
+  if (context.ticket != 0) {
+    // handleLocalized replies once the sessions are scored
+    PendingRequest pending;
+    pending.request = request;
+    pending.context = context;
+    m_pending.insert(socket, pending);
+    return;
+  }
+
+  writeReply(socket, request, replyValue, status, context);
+}
+
+void LocalServer::writeReply(QIODevice *socket, const LocalRequest &request,
+                             const QVariant &replyValue, int status, const RequestContext &context)
+{
+  QByteArray reply;
+  if (status == 200 && !context.contentType.isEmpty()) {
+    reply = context.content;
+  } else if (status == 200) {
+    LatencyTimer latency (m_localizer->latency(ENCODE_STAGE));
+    reply = encodeVariant(replyValue, context.encoding);
+  }
+  if (request.isHttp) {
+    if (status == 200 && context.notModified)
+      status = 304;
+    contentToHttp (reply, status, request.keepAlive, context);
+  }
+
+  if (context.notModified && context.waitMsec > 0) {
+    LocalRequest parked = request;
+    parked.knownVersion = context.etag;
+    park(socket, parked, reply, context.waitMsec);
+    return;
+  }
+
+  socket->write(reply);
+  m_replyByteCount->increment(reply.size());
+  // a long poll or a pending localize may have waited past the idle limit
+  if (m_lastActivity.contains(socket))
+    m_lastActivity[socket].start();
+  if (!context.contentType.isEmpty()) {
+    moleDebug(SERVER_LOG) << "wrote" << context.contentType << "reply of" << reply.size() << "bytes";
+  } else if (context.encoding == JSON_ENCODING) {
+    moleDebug(SERVER_LOG) << "wrote reply" << reply;
+  } else {
+    moleDebug(SERVER_LOG) << "wrote" << encodingName(context.encoding) << "reply of" << reply.size() << "bytes";
+  }
+
+  if (!request.keepAlive) {
+    closeConnection(socket);
+  }
+}
+
+// Holds a not modified query until the estimate changes,
+// or sends the not modified reply once the wait runs out.
+void LocalServer::park(QIODevice *socket, const LocalRequest &request,
+                       const QByteArray &timeoutReply, int waitMsec)
+{
+  ParkedRequest parked;
+  parked.request = request;
+  parked.timeoutReply = timeoutReply;
+  parked.waitMsec = waitMsec;
+  parked.parked.start();
+  m_parked.insert(socket, parked);
+  scheduleParkTimer();
+}
+
+void LocalServer::unpark(QIODevice *socket, bool estimateChanged)
+{
+  if (!m_parked.contains(socket))
+    return;
+
+  ParkedRequest parked = m_parked.take(socket);
+  if (estimateChanged) {
+    // the version no longer matches knownVersion,
+    // so this replies straight away
+    handleRequest(socket, parked.request);
+  } else {
+    socket->write(parked.timeoutReply);
+    if (m_lastActivity.contains(socket))
+      m_lastActivity[socket].start();
+    if (!parked.request.keepAlive)
+      closeConnection(socket);
+  }
+
+  // requests pipelined behind the parked one
+  if (m_buffers.contains(socket))
+    processInput(socket);
+}
+
+void LocalServer::scheduleParkTimer()
+{
+  int next = -1;
+  foreach (const ParkedRequest &parked, m_parked) {
+    int remaining = qMax((qint64)0, parked.waitMsec - parked.parked.elapsed());
+    if (next < 0 || remaining < next)
+      next = remaining;
+  }
+  if (next < 0) {
+    m_parkTimer.stop();
   } else {
-    m_localizer->addMonitor(socket);
+    m_parkTimer.start(next);
+  }
+}
+
+void LocalServer::handleEstimateChanged()
+{
+  foreach (QIODevice *socket, m_parked.keys()) {
+    unpark(socket, true);
+  }
+  scheduleParkTimer();
+}
+
+void LocalServer::handleLocalized(quint32 ticket, const QVariantList &replies)
+{
+  QIODevice *socket = 0;
+  QMapIterator<QIODevice*,PendingRequest> it (m_pending);
+  while (it.hasNext()) {
+    it.next();
+    if (it.value().context.ticket == ticket) {
+      socket = it.key();
+      break;
+    }
   }
+  if (!socket) {
+    moleDebug(SERVER_LOG) << "LS: localize reply for a closed connection" << ticket;
+    return;
+  }
+
+  PendingRequest pending = m_pending.take(socket);
+  QVariantMap resMap;
+  resMap["status"] = "OK";
+  resMap["sessions"] = replies;
+  writeReply(socket, pending.request, resMap, 200, pending.context);
 
+  // requests pipelined behind this one
+  if (m_buffers.contains(socket))
+    processInput(socket);
 }
 
-QVariantMap LocalServer::handleRequest(QByteArray &rawJson, bool &monitor)
+void LocalServer::handleParkTimeout()
+{
+  QList<QIODevice*> expired;
+  QMapIterator<QIODevice*,ParkedRequest> it (m_parked);
+  while (it.hasNext()) {
+    it.next();
+    if (it.value().parked.elapsed() >= it.value().waitMsec)
+      expired << it.key();
+  }
+  foreach (QIODevice *socket, expired) {
+    unpark(socket, false);
+  }
+  scheduleParkTimer();
+}
+
+QVariant LocalServer::handleRequest(QByteArray &rawJson, RequestContext &context)
 {
   QJson::Parser parser;
   bool ok;
   QVariantMap resMap;
 
-  qDebug () << "rawJson " << rawJson;
+  moleDebug(SERVER_LOG) << "rawJson " << rawJson;
 
-  QVariantMap request = parser.parse(rawJson, &ok).toMap();
+  QVariant request = parser.parse(rawJson, &ok);
   if (!ok) {
     qWarning() << "LS: failed to parse json" << rawJson;
     resMap["status"] = "Error: could not parse json in request";
     return resMap;
   }
+
+  if (request.type() == QVariant::List) {
+    return handleBatch(request.toList(), context);
+  }
+  return handleAction(request.toMap(), context);
+}
+
+// An array of requests gets an array of replies, in the same order.
+// The localizer only changes between events, so every request in
+// the batch sees the same estimate and stats, apart from changes
+// made by binds earlier in the same batch.
+// Queries in a batch never wait.
+QVariantList LocalServer::handleBatch(const QVariantList &requests, RequestContext &context)
+{
+  QVariantList replies;
+  foreach (const QVariant &request, requests) {
+    QVariantMap map = request.toMap();
+    QString action = map.value("action").toString();
+    if (action == "monitor" || action == "localize") {
+      QVariantMap resMap;
+      resMap["status"] = "Error: " + action + " cannot be batched";
+      replies.append(resMap);
+      continue;
+    }
+    RequestContext batchContext;
+    batchContext.encoding = context.encoding;
+    replies.append(handleAction(map, batchContext));
+    context.encoding = batchContext.encoding;
+    if (batchContext.keepAlive)
+      context.keepAlive = true;
+  }
+  moleDebug(SERVER_LOG) << "LS: handled batch of" << replies.size();
+  return replies;
+}
+
+QVariantMap LocalServer::handleAction(const QVariantMap &request, RequestContext &context)
+{
+  QVariantMap resMap;
   QString action;
   if (request.contains("action")) {
     action = request["action"].toString();
   } else {
-    qWarning() << "LS: no action found in json" << rawJson;
+    qWarning() << "LS: no action found in json" << request;
     resMap["status"] = "Error: no action in request";
     return resMap;
   }
+  if (request.value("keepalive").toBool())
+    context.keepAlive = true;
+  if (request.contains("encoding") &&
+      !encodingFromName(request["encoding"].toString(), context.encoding)) {
+    qWarning() << "LS: unknown encoding" << request["encoding"];
+    resMap["status"] = "Error: unknown encoding in request";
+    return resMap;
+  }
   QVariantMap params;
   if (request.contains("params"))
     params = request["params"].toMap();
@@ -129,9 +633,13 @@ QVariantMap LocalServer::handleRequest(QByteArray &rawJson, bool &monitor)
   } else if (action == "stats") {
     return handleStats(params);
   } else if (action == "query") {
-    return handleQuery(params);
+    return handleQuery(params, context);
   } else if (action == "monitor") {
-    monitor = true;
+    return handleMonitor(params, context);
+  } else if (action == "localize") {
+    return handleLocalize(params, context);
+  } else if (action == "trace") {
+    return flightRecorder()->chromeTrace();
   } else {
     qWarning() << "LS: unknown action " << action;
     resMap["status"] = "Error: unknown action in request";
@@ -196,18 +704,86 @@ QVariantMap LocalServer::handleBind(QVariantMap &params, QString source)
   return resMap;
 }
 
+QVariantMap LocalServer::handleMonitor(QVariantMap &params, RequestContext &context)
+{
+  QVariantMap resMap;
+  QString error;
+  if (!context.monitorOptions.setParams(params, error)) {
+    qWarning() << "LS:" << error;
+    resMap["status"] = error;
+    return resMap;
+  }
+  context.monitor = true;
+  return resMap;
+}
+
+// Localizes remote devices, each by its own session:
+// params are {"session","scans"}, or {"sessions":[...]} of these.
+// The reply holds one ranked estimate per session, in the same order.
+QVariantMap LocalServer::handleLocalize(QVariantMap &params, RequestContext &context)
+{
+  QVariantMap resMap;
+  if (!m_sessions) {
+    resMap["status"] = "Error: sessions are not enabled";
+    return resMap;
+  }
+
+  QVariantList entries;
+  if (params.contains("sessions")) {
+    entries = params["sessions"].toList();
+  } else {
+    entries.append(params);
+  }
+
+  QString error;
+  context.ticket = m_sessions->submit(entries, error);
+  if (context.ticket == 0) {
+    qWarning() << "LS:" << error;
+    resMap["status"] = error;
+  }
+  return resMap;
+}
+
 QVariantMap LocalServer::handleStats(QVariantMap&)
 {
-  QVariantMap statsMap;
-  m_localizer->stats()->statsAsMap(statsMap);
+  QVariantMap statsMap = m_localizer->snapshot()->stats;
+  statsMap["Monitors"] = m_localizer->monitorStats();
+  if (m_sessions)
+    statsMap["Sessions"] = m_sessions->stats();
   statsMap["status"] = "OK";
   return statsMap;
 }
 
-QVariantMap LocalServer::handleQuery(QVariantMap&)
+// With "version" (the last version the client saw) or "wait",
+// the query is conditional: if the estimate is still at that version,
+// the reply is "Not Modified", after waiting up to "wait" msec for
+// the estimate to change.
+QVariantMap LocalServer::handleQuery(QVariantMap &params, RequestContext &context)
 {
-  QVariantMap placeMap;
-  m_localizer->estimateAsMap(placeMap);
+  // one snapshot, so the estimate and its version agree
+  QSharedPointer<const LocalizerSnapshot> snapshot = m_localizer->snapshot();
+  const quint32 version = snapshot->version;
+  context.etag = version;
+
+  int wait = qBound(0, params.value("wait").toInt(), MAX_QUERY_WAIT_MSEC);
+  if (context.knownVersion != 0 || params.contains("version") || wait > 0) {
+    quint32 known = version;
+    if (context.knownVersion != 0) {
+      known = context.knownVersion;
+    } else if (params.contains("version")) {
+      known = params["version"].toUInt();
+    }
+    if (known == version) {
+      context.notModified = true;
+      context.waitMsec = wait;
+      QVariantMap resMap;
+      resMap["status"] = "Not Modified";
+      resMap["version"] = version;
+      return resMap;
+    }
+  }
+
+  QVariantMap placeMap = snapshot->estimate;
 
   if (placeMap["country"] == "NOK") {
     QString building = placeMap["area"].toString();
@@ -215,6 +791,7 @@ QVariantMap LocalServer::handleQuery(QVariantMap&)
     placeMap.clear ();
     placeMap["building"] = building;
     placeMap["space"] = space;
+    placeMap["version"] = version;
   }
 
   placeMap["status"] = "OK";
@@ -222,44 +799,61 @@ QVariantMap LocalServer::handleQuery(QVariantMap&)
   return placeMap;
 }
 
-// if the request is preceded by http headers,
-// discard them
-bool LocalServer::httpToContent (QByteArray &request, bool &ok) {
-  ok = true;
-  QList<QByteArray> reqLines = request.split('\n');
-  if (reqLines[0].startsWith("GET")) {
-    ok = false;
-    return true;
-  }
-  if (reqLines.size() == 1) {
+// GET /query or /stats, with any url parameters as params.
+// If-None-Match carries the estimate version of an earlier reply.
+bool LocalServer::httpGetToRequest (const LocalRequest &request, QVariantMap &getRequest) {
+  QUrl url = QUrl::fromEncoded(request.path);
+  QString action = url.path().section('/', 1);
+  if (action != "query" && action != "stats" && action != "trace")
     return false;
+
+  QVariantMap params;
+  QList<QPair<QString, QString> > items = url.queryItems();
+  for (int i = 0; i < items.size(); ++i) {
+    params.insert(items.at(i).first, items.at(i).second);
   }
-  if (!reqLines[0].startsWith("POST")) {
-    ok = false;
-    return true;
-  }
-  request = reqLines[reqLines.size()-1];
+
+  QByteArray etag = request.headers.value("if-none-match");
+  if (etag.startsWith("W/"))
+    etag.remove(0, 2);
+  etag.replace('"', "");
+  bool ok;
+  quint32 version = etag.toUInt(&ok);
+  if (ok)
+    params.insert("version", version);
+
+  getRequest.insert("action", action);
+  getRequest.insert("params", params);
   return true;
 }
 
 // this request came from an http client,
 // so put http response headers at the front
-void LocalServer::contentToHttp (QByteArray &reply, bool ok) {
-  //const QByteArray header = "HTTP/1.0 200 OK\n\n";
-  const QByteArray header = "HTTP/1.0 200 OK\nContent-Type: application/json\nServer: Mole/"+QByteArray(MOLE_VERSION)+"\n";
-  const QByteArray notOkHeader = "HTTP/1.0 400 Bad Request\n\n";
-
-  if (ok) {
-  qDebug () << "old content" << reply;
-  QString contentLength = "Content-length: "+ QString::number(reply.size()) + "\n";
-  QByteArray originalReply (reply);
-  reply = header;
-  reply += contentLength;
-  reply += "\n";
-  reply += originalReply;
-  //reply = header;
-  qDebug () << "new content" << reply;
-  } else {
-    reply = notOkHeader + reply;
+void LocalServer::contentToHttp (QByteArray &reply, int status, bool keepAlive,
+                                 const RequestContext &context) {
+  QByteArray header;
+  switch (status) {
+  case 200:
+    header = "HTTP/1.1 200 OK\r\nContent-Type: "
+      + (context.contentType.isEmpty() ? encodingContentType(context.encoding) : context.contentType)
+      + "\r\nServer: Mole/"+QByteArray(MOLE_VERSION)+"\r\n";
+    break;
+  case 304:
+    header = "HTTP/1.1 304 Not Modified\r\n";
+    reply.clear();
+    break;
+  case 404:
+    header = "HTTP/1.1 404 Not Found\r\n";
+    break;
+  default:
+    header = "HTTP/1.1 400 Bad Request\r\n";
+    break;
+  }
+  if (context.etag != 0 && (status == 200 || status == 304)) {
+    header += "ETag: \"" + QByteArray::number(context.etag) + "\"\r\n";
   }
+  header += "Content-Length: " + QByteArray::number(reply.size()) + "\r\n";
+  header += keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+  header += "\r\n";
+  reply.prepend(header);
 }
@@ -18,38 +18,170 @@
 #ifndef LOCAL_SERVER_H
 #define LOCAL_SERVER_H
 
+#include <QElapsedTimer>
+#include <QLocalServer>
+#include <QLocalSocket>
 #include <QTcpServer>
+#include <QTcpSocket>
 #include <QVariant>
 
+#include "encoding.h"
 #include "mole.h"
+#include "monitor.h"
 #include "network.h"
 
 class Binder;
+class Counter;
 class Localizer;
+class SessionEngine;
+
+// One request framed out of a connection's input buffer.
+// Requests are either bare json objects (optionally newline-delimited)
+// or HTTP requests, whose body is read using Content-Length.
+// Bare json connections close after the reply, as they always have,
+// unless a request on them asked for "keepalive".
+class LocalRequest
+{
+ public:
+  LocalRequest() : isHttp(false), keepAlive(false), knownVersion(0) {}
+
+  bool isHttp;
+  bool keepAlive;
+  // set when a parked query is run again
+  quint32 knownVersion;
+  QByteArray method;
+  QByteArray path;
+  // header names are lower case
+  QMap<QByteArray,QByteArray> headers;
+  QByteArray content;
+};
+
+// What handling a request decided, beyond the reply itself.
+class RequestContext
+{
+ public:
+  RequestContext()
+    : encoding(JSON_ENCODING), monitor(false), notModified(false), waitMsec(0),
+    knownVersion(0), etag(0), ticket(0), keepAlive(false) {}
+
+  Encoding encoding;
+  // the connection becomes a monitor
+  bool monitor;
+  Monitor monitorOptions;
+  // a query whose client already has the current estimate,
+  // which may wait this long for it to change
+  bool notModified;
+  int waitMsec;
+  // overrides the query's "version" param, 0 for none
+  quint32 knownVersion;
+  // estimate version the reply describes, 0 for none
+  quint32 etag;
+  // the reply comes later from the session engine, 0 for none
+  quint32 ticket;
+  // a reply already in its own format, sent as is; empty for none
+  QByteArray contentType;
+  QByteArray content;
+  // a bare json request asked to keep its connection open
+  bool keepAlive;
+};
+
+// A not modified query waiting for the estimate to change.
+// Later requests on the same connection wait behind it.
+class ParkedRequest
+{
+ public:
+  LocalRequest request;
+  QByteArray timeoutReply;
+  int waitMsec;
+  QElapsedTimer parked;
+};
+
+// A localize request whose sessions are being scored.
+// Later requests on the same connection wait behind it.
+class PendingRequest
+{
+ public:
+  LocalRequest request;
+  RequestContext context;
+};
 
 class LocalServer : public QTcpServer
 {
   Q_OBJECT
 
  public:
-  LocalServer(QObject *parent = 0, Localizer *localizer = 0, Binder *binder = 0, int port = DEFAULT_LOCAL_PORT);
+  // If socketPath is not empty, the same API is also served
+  // on a unix domain socket at that path.
+  LocalServer(QObject *parent = 0, Localizer *localizer = 0, Binder *binder = 0,
+              int port = DEFAULT_LOCAL_PORT, const QString &socketPath = QString(),
+              int socketMode = DEFAULT_LOCAL_SOCKET_MODE);
   ~LocalServer ();
 
+  // serve "localize" requests; without one they are refused
+  void setSessionEngine(SessionEngine *sessions);
+
  private:
   Localizer *m_localizer;
   Binder *m_binder;
+  SessionEngine *m_sessions;
+  QLocalServer m_localSocketServer;
+
+  // partial input and last activity of each open connection,
+  // which is either a QTcpSocket or a QLocalSocket
+  QMap<QIODevice*,QByteArray> m_buffers;
+  QMap<QIODevice*,QElapsedTimer> m_lastActivity;
+  // connections that asked for something other than json
+  QMap<QIODevice*,Encoding> m_encodings;
+  // bare json connections that asked to stay open
+  QSet<QIODevice*> m_keepAlive;
+  QMap<QIODevice*,ParkedRequest> m_parked;
+  QMap<QIODevice*,PendingRequest> m_pending;
+  // fires when the next parked request runs out of time
+  QTimer m_parkTimer;
+  QTimer m_idleTimer;
+
+  // from the metrics registry
+  Counter *m_connectionCount;
+  Counter *m_requestCount;
+  Counter *m_replyByteCount;
+
+  void listenLocalSocket(const QString &socketPath, int socketMode);
+  void addConnection(QIODevice *socket);
+  void closeConnection(QIODevice *socket);
+  void processInput(QIODevice *socket);
+  void handleRequest(QIODevice *socket, LocalRequest &request);
+  int frameJson(const QByteArray &buffer);
+  int frameHttp(const QByteArray &buffer, LocalRequest &request);
+
+  void park(QIODevice *socket, const LocalRequest &request,
+            const QByteArray &timeoutReply, int waitMsec);
+  void unpark(QIODevice *socket, bool estimateChanged);
+  void scheduleParkTimer();
+  void writeReply(QIODevice *socket, const LocalRequest &request,
+                  const QVariant &replyValue, int status, const RequestContext &context);
 
-  QVariantMap handleRequest(QByteArray &rawJson, bool &monitor);
+  QVariant handleRequest(QByteArray &rawJson, RequestContext &context);
+  QVariantList handleBatch(const QVariantList &requests, RequestContext &context);
+  QVariantMap handleAction(const QVariantMap &request, RequestContext &context);
   QVariantMap handleBind(QVariantMap &params, QString source);
   QVariantMap handleStats(QVariantMap &params);
-  QVariantMap handleQuery(QVariantMap &params);
-  QVariantMap handleMonitor(QVariantMap &params);
+  QVariantMap handleQuery(QVariantMap &params, RequestContext &context);
+  QVariantMap handleMonitor(QVariantMap &params, RequestContext &context);
+  QVariantMap handleLocalize(QVariantMap &params, RequestContext &context);
 
-  bool httpToContent (QByteArray &request, bool &ok);
-  void contentToHttp (QByteArray &reply, bool ok);
+  bool httpGetToRequest (const LocalRequest &request, QVariantMap &getRequest);
+  void contentToHttp (QByteArray &reply, int status, bool keepAlive,
+                      const RequestContext &context);
 
  private slots:
-  void handleRequest();
+  void handleConnection();
+  void handleLocalConnection();
+  void handleReadyRead();
+  void handleDisconnected();
+  void closeIdleConnections();
+  void handleEstimateChanged();
+  void handleParkTimeout();
+  void handleLocalized(quint32 ticket, const QVariantList &replies);
 
 };
 
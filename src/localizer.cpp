@@ -18,6 +18,9 @@
 #include "mole.h"
 #include "network.h"
 #include "localizer.h"
+#include "flightRecorder.h"
+#include "scanTrace.h"
+#include "virtualAP.h"
 
 #include <QNetworkReply>
 #include <QNetworkRequest>
@@ -33,24 +36,52 @@ const int AREA_FILL_PERIOD = 60000;
 const int MAP_FILL_PERIOD_SHORT = 1000;
 const int MAP_FILL_PERIOD_SOON = 10000;
 const int MAP_FILL_PERIOD = 60000;
-const int BEST_PENALTY = 4;
 
-Localizer::Localizer(QObject *parent, bool _runAllAlgorithms)
+Localizer::Localizer(QObject *parent, bool _runAllAlgorithms, const Localizer *mapSource)
   : QObject(parent)
   , m_runAllAlgorithms(_runAllAlgorithms)
   , m_firstAddScan(true)
   , m_forceMapCacheUpdate(true)
   , m_hibernating(false)
-  , m_overlap(new Overlap())
+  , m_expireMaps(true)
+  , m_offline(false)
+  , m_sharedMaps(mapSource != 0)
+  , m_trace(0)
   , m_stats(new LocalizerStats(this))
+  , m_estimateVersion(1)
+  , m_worker(new LocalizerWorker())
+  , m_scoringSeq(0)
+  , m_appliedSeq(0)
+  , m_jobsInFlight(0)
   , m_fingerprint(new QMap<QString,APDesc*>())
-  , m_signalMaps(new QMap<QString,AreaDesc*>())
+  , m_signalMaps(new QMap<QString,AreaDescPtr>())
 {
   // map dir created/checked in init_mole_app
   QString mapDirName = rootDir.absolutePath();
   mapDirName.append ("/map");
   m_mapRoot = new QDir(mapDirName);
 
+  m_localizedCount = metrics()->counter
+    ("mole_localized_scans", "Scans localized.");
+  m_skippedScoringCount = metrics()->counter
+    ("mole_skipped_scorings", "Scans not scored because scoring was behind.");
+  m_estimateChangeCount = metrics()->counter
+    ("mole_estimate_changes", "Times the estimated space changed.");
+  m_mapParseCount = metrics()->counter
+    ("mole_map_parses", "Area maps parsed.", "result=\"ok\"");
+  m_mapParseErrorCount = metrics()->counter
+    ("mole_map_parses", "Area maps parsed.", "result=\"error\"");
+  m_areaGauge = metrics()->gauge("mole_map_areas", "Areas with a map in memory.");
+  m_spaceGauge = metrics()->gauge("mole_map_spaces", "Spaces with a signature in memory.");
+
+  m_monitorTimer.setSingleShot(true);
+  connect(&m_monitorTimer, SIGNAL(timeout()), this, SLOT(flushMonitors()));
+
+  connect(m_worker, SIGNAL(resultsReady()), this, SLOT(handleScoringResults()),
+          Qt::QueuedConnection);
+  m_worker->start();
+  publishSnapshot();
+
 #ifdef USE_MOLE_DBUS
   QDBusConnection::systemBus().registerObject("/", this);
   QDBusConnection::systemBus().connect(QString(), QString(), "com.nokia.moled", "GetLocationEstimate", this, SLOT(emitLocationAndStats()));
@@ -110,7 +141,13 @@ Localizer::Localizer(QObject *parent, bool _runAllAlgorithms)
   connect(&m_mapCacheFillTimer, SIGNAL(timeout()), this, SLOT(fillMapCache()));
   m_mapCacheFillTimer.start(MAP_FILL_PERIOD);
 
-  loadMaps();
+  if (mapSource) {
+    *m_signalMaps = *mapSource->m_signalMaps;
+    qDebug() << "sharing" << m_signalMaps->size() << "maps";
+  } else {
+    loadMaps();
+  }
+  updateMapGauges();
 
 }
 
@@ -144,8 +181,10 @@ Localizer::~Localizer()
 {
   qDebug() << "deleting localizer";
 
+  // stop scoring before the maps it reads go away
+  delete m_worker;
+
   // signal_maps
-  qDeleteAll(m_signalMaps->begin(), m_signalMaps->end());
   m_signalMaps->clear();
   delete m_signalMaps;
 
@@ -154,7 +193,6 @@ Localizer::~Localizer()
   m_fingerprint->clear();
   delete m_fingerprint;
 
-  delete m_overlap;
   delete m_stats;
   delete m_mapRoot;
 
@@ -190,7 +228,7 @@ void Localizer::replaceFingerprint(QMap<QString,APDesc*> *newFP)
 
 void Localizer::emitLocationAndStats()
 {
-  qDebug() << "location estimate request";
+  moleDebug(GENERAL_LOG) << "location estimate request";
   m_stats->emitStatistics();
   emitLocationEstimate();
 }
@@ -202,22 +240,27 @@ void Localizer::emitLocationEstimate()
   QDBusMessage msg = QDBusMessage::createSignal("/", "com.nokia.moled", "LocationEstimate");
   msg << currentEstimateSpace;
   QDBusConnection::systemBus().send(msg);
-  qDebug () << "emitLocationEstimate on dbus" << currentEstimateSpace;
+  moleDebug(GENERAL_LOG) << "emitLocationEstimate on dbus" << currentEstimateSpace;
 #endif
 }
 
 void Localizer::localize(const int scanQueueSize)
 {
+  LatencyTimer latency (m_stats->latency(LOCALIZE_STAGE));
+  qint64 traceStart = flightRecorder()->now();
+  m_localizeTimer.start();
+  m_localizedCount->increment();
+  ++m_scoringSeq;
   m_stats->addApPerScanCount(m_fingerprint->size());
   m_stats->receivedScan();
 
   /*
   // for debugging
-  QMapIterator<QString,AreaDesc*> i (*m_signalMaps);
+  QMapIterator<QString,AreaDescPtr> i (*m_signalMaps);
   while (i.hasNext()) {
     i.next();
     QString area = i.key();
-    AreaDesc *desc = i.value();
+    AreaDescPtr desc = i.value();
     if (desc != NULL) {
       qDebug () << "new map loop C area " << desc->lastModifiedTime();      
     } else {
@@ -227,14 +270,14 @@ void Localizer::localize(const int scanQueueSize)
   */
 
   // now that we have a scan, start the first network timer
-  if (m_firstAddScan) {
+  if (m_firstAddScan && !m_offline) {
     m_areaCacheFillTimer.stop();
     m_areaCacheFillTimer.start(AREA_FILL_PERIOD_SHORT);
     m_firstAddScan = false;
   }
 
   if (m_fingerprint->isEmpty()) {
-    qDebug() << "no known macs to localize on";
+    moleDebug(LOCALIZE_LOG) << "no known macs to localize on";
     return;
   }
 
@@ -244,7 +287,7 @@ void Localizer::localize(const int scanQueueSize)
   const double minSpaceMacOverlapCoefficient = 0.01;
 
   QList<QString> potentialAreas;
-  QMapIterator<QString,AreaDesc*> i (*m_signalMaps);
+  QMapIterator<QString,AreaDescPtr> i (*m_signalMaps);
   double maxC = 0;
   QString maxCArea;
 
@@ -258,10 +301,11 @@ void Localizer::localize(const int scanQueueSize)
         maxC = c;
         maxCArea = i.key();
       }
-      qDebug() << "area " << i.key() << " c=" << c;
+      moleDebug(LOCALIZE_LOG) << "area " << i.key() << " c=" << c;
       if (c > minAreaMacOverlapCoefficient) {
         potentialAreas.push_back(i.key());
-        i.value()->accessed();
+        if (!m_sharedMaps)
+          i.value()->accessed();
       }
     }
   }
@@ -273,15 +317,17 @@ void Localizer::localize(const int scanQueueSize)
   m_stats->setTotalAreaCount(validAreas);
 
   if (verbose) {
-    qDebug() << "areas top "<< maxCArea << " c=" << maxC
-             << " count=" << potentialAreas.size()
-             << " valid=" << validAreas
-             << " nomap=" << (m_signalMaps->size() - validAreas);
+    moleDebug(LOCALIZE_LOG) << "areas top "<< maxCArea << " c=" << maxC
+                            << " count=" << potentialAreas.size()
+                            << " valid=" << validAreas
+                            << " nomap=" << (m_signalMaps->size() - validAreas);
   }
 
   if (potentialAreas.isEmpty()) {
-    qDebug() << "eliminated all areas";
+    moleDebug(LOCALIZE_LOG) << "eliminated all areas";
+    m_appliedSeq = m_scoringSeq;
     emitNewLocationEstimate(unknownSpace, -1);
+    publishSnapshot();
     return;
   }
 
@@ -289,21 +335,22 @@ void Localizer::localize(const int scanQueueSize)
 
   // next narrow down to a subset of spaces
   // from these areas
-  QMap<QString,SpaceDesc*> potentialSpaces;
+  QMap<QString,SpaceDescPtr> potentialSpaces;
   QListIterator<QString> j (potentialAreas);
   maxC = 0.;
   QString maxCSpace;
   int totalSpaceCount = 0;
 
-  qDebug () << "localizing on" << potentialAreas.size() << "areas";
+  moleDebug(LOCALIZE_LOG) << "localizing on" << potentialAreas.size() << "areas";
 
   while (j.hasNext()) {
     QString areaName = j.next();
-    AreaDesc *area = m_signalMaps->value(areaName);
-    QMap<QString,SpaceDesc*> *spaces = area->spaces();
-    QMapIterator<QString,SpaceDesc*> k (*spaces);
-    qDebug () << "about to touch" << areaName;
-    area->touch();
+    AreaDescPtr area = m_signalMaps->value(areaName);
+    QMapIterator<QString,SpaceDescPtr> k (area->spaces());
+    if (!m_sharedMaps) {
+      moleDebug(LOCALIZE_LOG) << "about to touch" << areaName;
+      area->touch();
+    }
 
     while (k.hasNext()) {
       k.next();
@@ -317,8 +364,8 @@ void Localizer::localize(const int scanQueueSize)
         ++totalSpaceCount;
 
         if (verbose) {
-          qDebug() << "potential space " << k.key() << " c=" << c
-                   << " ok=" << (c > minSpaceMacOverlapCoefficient);
+          moleDebug(LOCALIZE_LOG) << "potential space " << k.key() << " c=" << c
+                                  << " ok=" << (c > minSpaceMacOverlapCoefficient);
         }
         if (c > minSpaceMacOverlapCoefficient)
           potentialSpaces.insert(k.key(), k.value());
@@ -330,129 +377,214 @@ void Localizer::localize(const int scanQueueSize)
   int potentialSpacesSize = potentialSpaces.size();
 
   // note that scanQueueSize is 0 if we have been called by a new signal map download
-  qDebug() << "spaceCount=" << potentialSpacesSize
-           << "pct=" << potentialSpacesSize/(double)totalSpaceCount
-           << "scanCount=" << scanQueueSize;
+  moleDebug(LOCALIZE_LOG) << "spaceCount=" << potentialSpacesSize
+                          << "pct=" << potentialSpacesSize/(double)totalSpaceCount
+                          << "scanCount=" << scanQueueSize;
 
   m_stats->setTotalSpaceCount(totalSpaceCount);
   m_stats->setPotentialSpaceCount(potentialSpacesSize);
 
-  if (m_runAllAlgorithms) {
-    //makeBayesEstimate(potentialSpaces);
-    //makeBayesEstimateWithHist(potentialSpaces);
-    makeOverlapEstimateWithGaussians(potentialSpaces);
-    makeOverlapEstimateWithHist(potentialSpaces, 0);
-    makeOverlapEstimateWithHist(potentialSpaces, 1);
-  }
-  makeOverlapEstimateWithHist(potentialSpaces, BEST_PENALTY);
+  //if (m_runAllAlgorithms) {
+  //  makeBayesEstimate(potentialSpaces);
+  //  makeBayesEstimateWithHist(potentialSpaces);
+  //}
+  flightRecorder()->record(FLIGHT_CANDIDATES, traceStart, potentialSpacesSize);
+  submitScoring(potentialSpaces);
 
 }
 
-void Localizer::makeOverlapEstimateWithHist(QMap<QString,SpaceDesc*> &ps, int penalty)
+// Same mac overlap cut as localize, without its statistics.
+QMap<QString,SpaceDescPtr> Localizer::candidateSpaces(const QMap<QString,APDesc*> *fingerprint)
 {
-  QString maxSpace;
-  double maxScore = -5.;
-
-  m_stats->clearRankEntries();
-  QMapIterator<QString,SpaceDesc*> it (ps);
-
-  while (it.hasNext()) {
-    it.next();
-    double score = m_overlap->compareHistOverlap((QMap<QString,Sig*>*)m_fingerprint,
-                                                it.value()->signatures(), penalty);
+  const double minAreaMacOverlapCoefficient = 0.01;
+  const double minSpaceMacOverlapCoefficient = 0.01;
 
-    qDebug() << "overlap compute: space="<< it.key() << " score="<< score;
+  QMap<QString,SpaceDescPtr> candidates;
+  if (fingerprint->isEmpty())
+    return candidates;
 
-    if (score > maxScore) {
-      maxScore = score;
-      maxSpace = it.key();
+  QMapIterator<QString,AreaDescPtr> i (*m_signalMaps);
+  while (i.hasNext()) {
+    i.next();
+    AreaDescPtr area = i.value();
+    if (!area ||
+        macOverlapCoefficient(fingerprint, area->macs()) <= minAreaMacOverlapCoefficient)
+      continue;
+    if (!m_sharedMaps) {
+      area->accessed();
+      area->touch();
     }
 
-    if (penalty == BEST_PENALTY) {
-      m_stats->addRankEntry(it.key(), score);
+    QMapIterator<QString,SpaceDescPtr> k (area->spaces());
+    while (k.hasNext()) {
+      k.next();
+      if (k.value() &&
+          macOverlapCoefficient(fingerprint, k.value()->macs()) > minSpaceMacOverlapCoefficient)
+        candidates.insert(k.key(), k.value());
     }
+  }
+  return candidates;
+}
 
+// The scoring itself runs on the worker thread,
+// so the event loop keeps serving requests meanwhile.
+void Localizer::submitScoring(const QMap<QString,SpaceDescPtr> &candidateSpaces)
+{
+  if (m_jobsInFlight >= SCORING_QUEUE_SIZE) {
+    moleDebug(LOCALIZE_LOG) << "scoring is behind, skipping scan" << m_scoringSeq;
+    m_skippedScoringCount->increment();
+    return;
   }
 
-  double confidence = 0.;
-  if (penalty == BEST_PENALTY) {
-    m_stats->addOverlapMax(maxScore);
-    if (!maxSpace.isEmpty())
-      emitNewLocationEstimate(maxSpace, maxScore);
+  ScoringJob job;
+  job.seq = m_scoringSeq;
+  job.penalty = BEST_PENALTY;
+  job.selectNsec = m_localizeTimer.nsecsElapsed();
 
-    confidence = m_stats->getConfidence();
+  QMapIterator<QString,APDesc*> i (*m_fingerprint);
+  while (i.hasNext()) {
+    i.next();
+    job.fingerprint.insert(i.key(), new Sig(i.value()));
   }
+  if (groupVirtualAPs)
+    groupVirtualAPSigs(&job.fingerprint);
 
-  qDebug() <<"=== MAO ESTIMATE USING HISTOGRAM (KERNEL) ==="
-           << "penalty " << penalty
-	   << "estimate" << maxSpace << maxScore
-	   << "confidence" << confidence;
-
-}
+  // the job pins the spaces it scores, so a map swapped out
+  // meanwhile stays alive until the worker is done with it
+  QMapIterator<QString,SpaceDescPtr> j (candidateSpaces);
+  while (j.hasNext()) {
+    j.next();
+    job.spaces.append(qMakePair(j.key(), j.value()));
+  }
 
-void Localizer::makeOverlapEstimateWithGaussians
-(QMap<QString,SpaceDesc*> &potential_spaces) {
+  if (m_runAllAlgorithms) {
+    job.comparePenalties << GAUSSIAN_COMPARISON << 0 << 1;
+  }
 
-  QString maxSpace;
-  double maxScore = -5.;
-  const double init_overlap_diff = 10.;
-  double overlap_diff = init_overlap_diff;
-  QMapIterator<QString,SpaceDesc*> i (potential_spaces);
+  job.submitted.start();
+  if (!m_worker->submit(job)) {
+    qDeleteAll(job.fingerprint);
+    return;
+  }
+  ++m_jobsInFlight;
+}
 
-  while (i.hasNext()) {
-    i.next();
-    double score = m_overlap->compareSigOverlap
-      ((QMap<QString,Sig*>*)m_fingerprint, i.value()->signatures());
+void Localizer::handleScoringResults()
+{
+  ScoringResult result;
+  while (m_worker->takeResult(result)) {
+    --m_jobsInFlight;
+    m_stats->latency(SCORE_WAIT_STAGE)->record(result.waitNsec);
+    m_stats->latency(SCORE_STAGE)->record(result.scoreNsec);
+
+    if (result.seq <= m_appliedSeq) {
+      moleDebug(LOCALIZE_LOG) << "dropping stale scoring result" << result.seq;
+      continue;
+    }
+    m_appliedSeq = result.seq;
+
+    m_lastTimings.seq = result.seq;
+    m_lastTimings.selectNsec = result.selectNsec;
+    m_lastTimings.waitNsec = result.waitNsec;
+    m_lastTimings.scoreNsec = result.scoreNsec;
+    m_lastTimings.resultNsec = result.submitted.nsecsElapsed();
+
+    m_stats->clearRankEntries();
+    for (int i = 0; i < result.scores.size(); ++i) {
+      moleDebug(SCORE_LOG) << "overlap compute: space="<< result.scores.at(i).first
+                           << " score="<< result.scores.at(i).second;
+      m_stats->addRankEntry(result.scores.at(i).first, result.scores.at(i).second);
+    }
 
-    qDebug () << "overlap compute: space="<< i.key() << " score="<< score;
+    recordTopScores(result);
 
-    double diff = maxScore - score;
-    //qDebug () << "score " << score
-    //<< "diff " << diff;
+    m_stats->addOverlapMax(result.maxScore);
+    if (!result.maxSpace.isEmpty())
+      emitNewLocationEstimate(result.maxSpace, result.maxScore);
 
-    // Hmm. This is not correct and not computable the way we are doing it.
-    // It is also not that interesting a value.
+    moleDebug(SCORE_LOG) <<"=== MAO ESTIMATE USING HISTOGRAM (KERNEL) ==="
+                         << "penalty " << BEST_PENALTY
+                         << "estimate" << result.maxSpace << result.maxScore
+                         << "confidence" << m_stats->getConfidence();
 
-    // Maybe s
-    // difference between top and second-from-top
-    if (diff < overlap_diff) {
-      overlap_diff = diff;
+    for (int i = 0; i < result.comparisons.size(); ++i) {
+      const ScoringComparison &comparison = result.comparisons.at(i);
+      if (comparison.penalty == GAUSSIAN_COMPARISON) {
+        moleDebug(SCORE_LOG) <<"=== MAO ESTIMATE USING GAUSSIAN ==="
+                             << comparison.maxSpace << comparison.maxScore;
+      } else {
+        moleDebug(SCORE_LOG) <<"=== MAO ESTIMATE USING HISTOGRAM (KERNEL) ==="
+                             << "penalty " << comparison.penalty
+                             << "estimate" << comparison.maxSpace << comparison.maxScore;
+      }
     }
+  }
 
-    if (score > maxScore) {
-      maxScore = score;
-      maxSpace = i.key();
-    }
+  publishSnapshot();
+  if (m_jobsInFlight == 0)
+    emit scoringIdle();
+}
 
+// the best FLIGHT_NAMES scores, for the flight recorder
+void Localizer::recordTopScores(const ScoringResult &result)
+{
+  QList<QPair<QString,double> > top;
+  for (int i = 0; i < result.scores.size(); ++i) {
+    const QPair<QString,double> &score = result.scores.at(i);
+    int rank = top.size();
+    while (rank > 0 && top.at(rank-1).second < score.second)
+      --rank;
+    if (rank < FLIGHT_NAMES) {
+      top.insert(rank, score);
+      if (top.size() > FLIGHT_NAMES)
+        top.removeLast();
+    }
   }
 
-  //if (overlap_diff < init_overlap_diff) {
-  //stats->add_overlap_diff (overlap_diff);
-  // stats->add_overlap_max (maxScore);
-  //}
+  // scoring began once the job had waited for the worker
+  qint64 start = flightRecorder()->now() - result.submitted.nsecsElapsed() + result.waitNsec;
+  flightRecorder()->recordScores(start, result.scoreNsec, result.scores.size(), top);
+}
 
-  //qDebug () << "overlap max: space="<< maxSpace << " score="<< maxScore
-  // << " scans_used=" << scan_queue->size();
+QSharedPointer<const LocalizerSnapshot> Localizer::snapshot() const
+{
+  QMutexLocker locker (&m_snapshotLock);
+  return m_snapshot;
+}
 
-  qDebug() <<"=== MAO ESTIMATE USING GAUSSIAN ===" << maxSpace << maxScore;
+void Localizer::publishSnapshot()
+{
+  LocalizerSnapshot *snapshot = new LocalizerSnapshot();
+  snapshot->version = m_estimateVersion;
+  estimateAsMap(snapshot->estimate);
+  m_stats->statsAsMap(snapshot->stats);
+  snapshot->ranks = m_stats->ranks();
+
+  QSharedPointer<const LocalizerSnapshot> published (snapshot);
+  QMutexLocker locker (&m_snapshotLock);
+  m_snapshot.swap(published);
 }
 
 
 
+
 // TODO add coverage estimate, as int? suggested space?
 void Localizer::emitNewLocationEstimate(QString estimatedSpaceName, double estimatedSpaceScore)
 {
-  qDebug() << "emitNewLocationEstimate" << estimatedSpaceName
-           << "score" << estimatedSpaceScore
+  moleDebug(LOCALIZE_LOG) << "emitNewLocationEstimate" << estimatedSpaceName
+                          << "score" << estimatedSpaceScore
 	   << "currentEstimateSpace" << currentEstimateSpace;
 
   currentEstimateScore = estimatedSpaceScore;
   if (currentEstimateSpace != estimatedSpaceName) {
     currentEstimateSpace = estimatedSpaceName;
+    ++m_estimateVersion;
+    m_estimateChangeCount->increment();
     m_stats->emittedNewLocation();
     m_stats->emitStatistics();
     emitLocationEstimate();
     emitEstimateToMonitors();
+    emit estimateChanged();
   }
 }
 
@@ -497,60 +629,86 @@ void Localizer::queryCurrentEstimate(QString &country, QString &region,
   }
 }
 
+void Localizer::setOffline()
+{
+  m_offline = true;
+  m_areaCacheFillTimer.stop();
+  m_mapCacheFillTimer.stop();
+}
+
 void Localizer::fillAreaCache()
 {
+  // poll less while the server is not answering
   m_areaCacheFillTimer.stop();
-  m_areaCacheFillTimer.start(AREA_FILL_PERIOD);
+  m_areaCacheFillTimer.start(networkTelemetry()->backoffMsec(AREAS_ENDPOINT, AREA_FILL_PERIOD));
 
-  if (!networkConfigurationManager->isOnline()) {
-    qDebug() << "aborting fill_area_cache because offline";
+  if (m_offline || !networkConfigurationManager->isOnline()) {
+    moleDebug(NETWORK_LOG) << "aborting fill_area_cache because offline";
     return;
   }
   if (m_hibernating && haveValidEstimate()) {
-    qDebug() << "aborting fill_area_cache because hibernating";
+    moleDebug(NETWORK_LOG) << "aborting fill_area_cache because hibernating";
     return;
   }
 
   QString lMacA, lMacB;
-  loudMac(lMacA, lMacB);
+  loudMac(m_fingerprint, lMacA, lMacB);
+  requestAreas(lMacA, lMacB);
+}
+
+void Localizer::fetchAreasFor(const QMap<QString,APDesc*> *fingerprint)
+{
+  if (m_offline || !networkConfigurationManager->isOnline())
+    return;
+
+  QString lMacA, lMacB;
+  loudMac(fingerprint, lMacA, lMacB);
+  requestAreas(lMacA, lMacB);
+}
 
-  if (!lMacA.isEmpty() || !lMacB.isEmpty()) {
+void Localizer::requestAreas(const QString &macA, const QString &macB)
+{
+  if (macA.isEmpty() && macB.isEmpty())
+    return;
 
-    QNetworkRequest request;
-    QString urlStr = mapServerURL;
-    QUrl url(urlStr.append("/getAreas"));
+  QNetworkRequest request;
+  QString urlStr = mapServerURL;
+  QUrl url(urlStr.append("/getAreas"));
 
-    url.addQueryItem("mac", lMacA);
-    url.addQueryItem("mac2", lMacB);
-    request.setUrl(url);
+  url.addQueryItem("mac", macA);
+  url.addQueryItem("mac2", macB);
+  request.setUrl(url);
 
-    qDebug() << "req " << url;
+  moleDebug(NETWORK_LOG) << "req " << url;
 
-    setNetworkRequestHeaders(request);
-    QNetworkReply *reply = networkAccessManager->get(request);
-    connect(reply, SIGNAL(finished()), SLOT(macToAreasResponse()));
-  }
+  setNetworkRequestHeaders(request);
+  QNetworkReply *reply = networkAccessManager->get(request);
+  networkTelemetry()->watch(reply, AREAS_ENDPOINT);
+  connect(reply, SIGNAL(finished()), SLOT(macToAreasResponse()));
 }
 
 void Localizer::macToAreasResponse()
 {
-  qDebug() << "mac_to_areas_response";
+  moleDebug(NETWORK_LOG) << "mac_to_areas_response";
   QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
-  qDebug() << "reply" << reply;
+  moleDebug(NETWORK_LOG) << "reply" << reply;
   reply->deleteLater();
 
-  int elapsed = findReplyLatencyMsec(reply);
-  m_stats->addNetworkLatency(elapsed);
+  int elapsed = replyLatencyMsec(reply);
+  if (elapsed >= 0)
+    m_stats->addNetworkLatency(elapsed);
 
   if (reply->error() != QNetworkReply::NoError) {
     qWarning() << "mac_to_areas_response request failed "
                << reply->errorString()
                << " url " << reply->url();
     m_stats->addNetworkSuccessRate(0);
+    countServerReply("areas", "error");
     return;
   }
   m_stats->addNetworkSuccessRate(1);
-  qDebug() << "mac_to_areas_response request succeeded";
+  countServerReply("areas", "ok");
+  moleDebug(NETWORK_LOG) << "mac_to_areas_response request succeeded";
 
   // process response one line at a time
   // each line is the path to an area
@@ -565,22 +723,22 @@ void Localizer::macToAreasResponse()
     areaName = areaName.trimmed();
     if (areaName.length() > 1 && !m_signalMaps->contains(areaName)) {
       // create empty slot in signal map for this space
-      m_signalMaps->insert(areaName, 0);
+      m_signalMaps->insert(areaName, AreaDescPtr());
       newAreaFound = true;
-      qDebug() << "getArea found new area_name=" << areaName;
+      moleDebug(NETWORK_LOG) << "getArea found new area_name=" << areaName;
     } else {
       if (verbose) {
-        qDebug() << "getArea found existing area_name=" << areaName;
+        moleDebug(NETWORK_LOG) << "getArea found existing area_name=" << areaName;
       }
 
       // make sure we have an up-to-date map for the place
       // where probably are
-      AreaDesc *area = m_signalMaps->value(areaName);
+      AreaDescPtr area = m_signalMaps->value(areaName);
       if (area) {
-        qDebug() << "touching area" << areaName;
+        moleDebug(NETWORK_LOG) << "touching area" << areaName;
         area->touch();
       } else {
-        qDebug() << "NOT touching area" << areaName;
+        moleDebug(NETWORK_LOG) << "NOT touching area" << areaName;
       }
     }
     memset(buffer, 0, bufferSize);
@@ -598,18 +756,18 @@ void Localizer::macToAreasResponse()
 // request this area name soon -- called by binder
 void Localizer::touch(QString areaName)
 {
-  AreaDesc *area = m_signalMaps->value(areaName);
+  AreaDescPtr area = m_signalMaps->value(areaName);
   if (area) {
-    qDebug() << "touching area" << areaName;
+    moleDebug(MAP_LOG) << "touching area" << areaName;
     area->touch();
   } else {
-    qDebug() << "touch did not find area" << areaName;
-    m_signalMaps->insert(areaName, 0);
+    moleDebug(MAP_LOG) << "touch did not find area" << areaName;
+    m_signalMaps->insert(areaName, AreaDescPtr());
   }
 
   // here we do want to potentially delay the fetch, to give the server time
   // to do its work updating the signal map
-  if (networkConfigurationManager->isOnline()) {
+  if (!m_offline && networkConfigurationManager->isOnline()) {
     m_mapCacheFillTimer.stop();
     m_mapCacheFillTimer.start(MAP_FILL_PERIOD_SOON);
   }
@@ -617,16 +775,16 @@ void Localizer::touch(QString areaName)
 
 void Localizer::fillMapCache()
 {
-  qDebug() << "fill_map_cache period " << MAP_FILL_PERIOD;
+  moleDebug(MAP_LOG) << "fill_map_cache period " << MAP_FILL_PERIOD;
   m_mapCacheFillTimer.stop();
   m_mapCacheFillTimer.start(MAP_FILL_PERIOD);
 
-  if (!networkConfigurationManager->isOnline()) {
-    qDebug() << "aborting fill_map_cache because offline";
+  if (m_offline || !networkConfigurationManager->isOnline()) {
+    moleDebug(MAP_LOG) << "aborting fill_map_cache because offline";
     return;
   }
   if (m_hibernating && haveValidEstimate()) {
-    qDebug() << "aborting fill_map_cache because hibernating";
+    moleDebug(MAP_LOG) << "aborting fill_map_cache because hibernating";
     return;
   }
 
@@ -641,18 +799,18 @@ void Localizer::fillMapCache()
 
   QDateTime expireStamp(QDateTime::currentDateTime().addSecs(EXPIRE_AREA_DESC_SECS));
 
-  QMutableMapIterator<QString,AreaDesc*> i (*m_signalMaps);
+  QMutableMapIterator<QString,AreaDescPtr> i (*m_signalMaps);
 
   while (i.hasNext()) {
     i.next();
-    AreaDesc *area = i.value();
+    AreaDescPtr area = i.value();
     if (!area || area->isTouched()) {
       QDateTime lastModifiedTime;
       if (!area) {
-        qDebug() << "last_modified: area is null";
+        moleDebug(MAP_LOG) << "last_modified: area is null";
       } else {
-        qDebug() << "last_update " << area->lastModifiedTime()
-                 << "touch=" << area->isTouched();
+        moleDebug(MAP_LOG) << "last_update " << area->lastModifiedTime()
+                           << "touch=" << area->isTouched();
         lastModifiedTime = area->lastModifiedTime();
         area->untouch();
       }
@@ -660,16 +818,15 @@ void Localizer::fillMapCache()
 
       int version = -1;
       if (area) {
-	qDebug () << "setting version from area";
+	moleDebug(MAP_LOG) << "setting version from area";
         version = area->mapVersion();
       }
 
       enqueueAreaMapRequest(i.key(), lastModifiedTime);
 
-    } else if (expireStamp > area->lastAccessTime()) {
-      qDebug() << "area expired= " << i.key();
+    } else if (m_expireMaps && expireStamp > area->lastAccessTime()) {
+      moleDebug(MAP_LOG) << "area expired= " << i.key();
       i.remove();
-      delete area;
     }
   }
 
@@ -679,7 +836,7 @@ void Localizer::fillMapCache()
 
 void Localizer::enqueueAreaMapRequest(QString areaName, QDateTime lastModifiedTime)
 {
-  qDebug() << "enqueueAreaMapRequest " << areaName << lastModifiedTime;
+  moleDebug(MAP_LOG) << "enqueueAreaMapRequest " << areaName << lastModifiedTime;
     QNetworkRequest request;
     QString areaUrl(staticServerURL);
     areaUrl.append("/map/");
@@ -687,13 +844,13 @@ void Localizer::enqueueAreaMapRequest(QString areaName, QDateTime lastModifiedTi
     areaUrl.append ("/sig.xml");
     areaUrl = areaUrl.trimmed ();
 
-    qDebug() << "enqueueAreaMap" << areaUrl;
+    moleDebug(MAP_LOG) << "enqueueAreaMap" << areaUrl;
     request.setUrl(areaUrl);
     setNetworkRequestHeaders(request);
 
     if (!lastModifiedTime.isNull() && lastModifiedTime.isValid()) {
       request.setRawHeader("If-Modified-Since", lastModifiedTime.toString().toAscii());
-      qDebug() << "if-modified-since" << lastModifiedTime;
+      moleDebug(MAP_LOG) << "if-modified-since" << lastModifiedTime;
     }
 
     m_areaMapRequests.enqueue(request);
@@ -701,7 +858,7 @@ void Localizer::enqueueAreaMapRequest(QString areaName, QDateTime lastModifiedTi
 
 void Localizer::issueAreaMapRequest()
 {
-  qDebug() << "issueAreaMapRequest size" << m_areaMapRequests.size();
+  moleDebug(MAP_LOG) << "issueAreaMapRequest size" << m_areaMapRequests.size();
   if (!m_areaMapRequests.isEmpty()) {
     QNetworkRequest request = m_areaMapRequests.dequeue();
     requestAreaMap(request);
@@ -710,10 +867,11 @@ void Localizer::issueAreaMapRequest()
 
 void Localizer::requestAreaMap(QNetworkRequest request)
 {
-  qDebug() << "requestAreaMap";
+  moleDebug(MAP_LOG) << "requestAreaMap";
 
   QNetworkReply *reply = networkAccessManager->get(request);
-  qDebug() << "area_map_reply creation " << reply->url().path();
+  networkTelemetry()->watch(reply, MAP_ENDPOINT);
+  moleDebug(MAP_LOG) << "area_map_reply creation " << reply->url().path();
   connect(reply, SIGNAL(finished()), SLOT(handleAreaMapResponseAndReissue()));
 }
 
@@ -725,15 +883,15 @@ void Localizer::handleAreaMapResponseAndReissue()
 
 void Localizer::handleAreaMapResponse()
 {
-  qDebug() << "handleAreaMapResponse";
+  moleDebug(MAP_LOG) << "handleAreaMapResponse";
 
   /*
   // for debugging
-  QMapIterator<QString,AreaDesc*> i (*m_signalMaps);
+  QMapIterator<QString,AreaDescPtr> i (*m_signalMaps);
   while (i.hasNext()) {
     i.next();
     QString area = i.key();
-    AreaDesc *desc = i.value();
+    AreaDescPtr desc = i.value();
     if (desc != NULL) {
       qDebug () << "new map loop A area " << desc->lastModifiedTime();      
     } else {
@@ -751,8 +909,9 @@ void Localizer::handleAreaMapResponse()
   if (!httpStatus.isNull()) {
     int status = httpStatus.toInt();
     if (status == 304) {
-      qDebug() << "area_map_response: not modified path" << path;
+      moleDebug(MAP_LOG) << "area_map_response: not modified path" << path;
       m_stats->addNetworkSuccessRate(1);
+      countServerReply("map", "not_modified");
       return;
     }
   }
@@ -783,16 +942,19 @@ void Localizer::handleAreaMapResponse()
                    << " count= " << count;
       } else {
         unlinkMap(path);
+        updateMapGauges();
       }
       m_stats->addNetworkSuccessRate (1);
     } else {
       m_stats->addNetworkSuccessRate (0);
     }
+    countServerReply("map", "error");
 
     return;
   }
 
   m_stats->addNetworkSuccessRate(1);
+  countServerReply("map", "ok");
 
   // pre-empt any parsing if we've already got the most recent
   // This could be made more effecient with a 'head'
@@ -802,31 +964,35 @@ void Localizer::handleAreaMapResponse()
 
   // Can be null if we've only inserted the key and not the value
   if (m_signalMaps->contains(path) && m_signalMaps->value(path)) {
-    AreaDesc *existingAreaDesc = m_signalMaps->value(path);
-    qDebug() << "testing age of new map vs old "
+    AreaDescPtr existingAreaDesc = m_signalMaps->value(path);
+    moleDebug(MAP_LOG) << "testing age of new map vs old "
 	     << "existing " << existingAreaDesc->lastModifiedTime() 
 	     << "new " << lastModified;
     if (existingAreaDesc->lastModifiedTime() == lastModified) {
-      qDebug() << "skipping map update because unchanged";
+      moleDebug(MAP_LOG) << "skipping map update because unchanged";
       return;
     }
   }
 
   // TODO sanity check on the response
   QByteArray mapAsByteArray = reply->readAll();
+  flightRecorder()->record(FLIGHT_MAP_FETCH,
+                           flightRecorder()->now() - qMax(0, replyLatencyMsec(reply)) * Q_INT64_C(1000000),
+                           mapAsByteArray.size(), path);
 
   saveMap(path, mapAsByteArray);
 
   if (!parseMap(mapAsByteArray, lastModified))
     qWarning() << "parseMap error " << path;
+  updateMapGauges();
 
   /*
   // for debugging
-  QMapIterator<QString,AreaDesc*> i (*m_signalMaps);
+  QMapIterator<QString,AreaDescPtr> i (*m_signalMaps);
   while (i.hasNext()) {
     i.next();
     QString area = i.key();
-    AreaDesc *desc = i.value();
+    AreaDescPtr desc = i.value();
     if (desc != NULL) {
       qDebug () << "new map loop B area " << desc->lastModifiedTime();      
     } else {
@@ -843,9 +1009,10 @@ void Localizer::handleAreaMapResponse()
 // Idea is to make selection of areas non-deterministic.
 
 // The power of two choices...
-void Localizer::loudMac(QString &loudMacA, QString &loudMacB)
+void Localizer::loudMac(const QMap<QString,APDesc*> *fingerprint,
+                        QString &loudMacA, QString &loudMacB)
 {
-  if (m_fingerprint->isEmpty()) {
+  if (fingerprint->isEmpty()) {
     return;
   }
 
@@ -853,7 +1020,7 @@ void Localizer::loudMac(QString &loudMacA, QString &loudMacB)
   QList<QString> loudMacs;
 
   // subset of observed macs, which are loud
-  QMapIterator<QString,APDesc*> i (*m_fingerprint);
+  QMapIterator<QString,APDesc*> i (*fingerprint);
   while (i.hasNext()) {
     i.next();
     if (i.value()->loudest() > minRssi) {
@@ -867,10 +1034,10 @@ void Localizer::loudMac(QString &loudMacA, QString &loudMacB)
     loudMacIndex = randInt(0, loudMacs.size() - 1);
     loudMacB = loudMacs[loudMacIndex];
   } else {
-    int loudMacIndexA = randInt(0, m_fingerprint->size() - 1);
-    int loudMacIndexB = randInt(0, m_fingerprint->size() - 1);
+    int loudMacIndexA = randInt(0, fingerprint->size() - 1);
+    int loudMacIndexB = randInt(0, fingerprint->size() - 1);
 
-    QMapIterator<QString,APDesc*> i (*m_fingerprint);
+    QMapIterator<QString,APDesc*> i (*fingerprint);
     int index = 0;
     while (i.hasNext()) {
       i.next();
@@ -885,7 +1052,7 @@ void Localizer::loudMac(QString &loudMacA, QString &loudMacB)
 }
 
 void Localizer::handleMotionChange(Motion currentMotion) { 
-  qDebug() << Q_FUNC_INFO << "motion=" << currentMotion;
+  moleDebug(GENERAL_LOG) << Q_FUNC_INFO << "motion=" << currentMotion;
     m_stats->setCurrentMotion(currentMotion);
     if (currentMotion == MOVING) {
       m_stats->clearAfterWalkDetection();
@@ -896,7 +1063,7 @@ void Localizer::handleMotionChange(Motion currentMotion) {
 
 void Localizer::handleHibernate(bool goToSleep)
 {
-  qDebug () << Q_FUNC_INFO << "hibernate=" << goToSleep;
+  moleDebug(GENERAL_LOG) << Q_FUNC_INFO << "hibernate=" << goToSleep;
   m_hibernating = goToSleep;
   m_stats->handleHibernate(goToSleep);
 }
@@ -927,15 +1094,21 @@ void Localizer::bind(QString fqArea, QString fqSpace)
 {
   qDebug() << "in-memory bind" << fqSpace;
 
+  // copy-on-write: readers holding the old area keep seeing it unchanged
+  AreaDescPtr oldAreaDesc = m_signalMaps->value(fqArea);
   AreaDesc *areaDesc;
-  if (!m_signalMaps->contains(fqArea)) {
+  if (oldAreaDesc) {
+    areaDesc = new AreaDesc(*oldAreaDesc);
+  } else {
     areaDesc = new AreaDesc();
-    m_signalMaps->insert(fqArea, areaDesc);
     qDebug() << "bind added new area" << fqArea;
   }
-  areaDesc = m_signalMaps->value(fqArea);
 
-  SpaceDesc *spaceDesc = new SpaceDesc((QMap<QString,Sig*> *) m_fingerprint);
+  // kept like a parsed map: the macs as heard, grouped for scoring
+  SpaceDesc *space = new SpaceDesc((QMap<QString,Sig*> *) m_fingerprint);
+  if (groupVirtualAPs)
+    space->groupSignatures();
+  SpaceDescPtr spaceDesc (space);
 
   // set the area's macs
   QMapIterator<QString,APDesc*> i (*m_fingerprint);
@@ -944,16 +1117,17 @@ void Localizer::bind(QString fqArea, QString fqSpace)
     areaDesc->insertMac(i.key());
   }
 
-  QMap<QString,SpaceDesc*> *spaces = areaDesc->spaces();
-  if (spaces->contains(fqSpace)) {
-    SpaceDesc *oldSpaceDesc = spaces->value(fqSpace);
-    delete oldSpaceDesc;
+  if (areaDesc->spaces().contains(fqSpace)) {
     qDebug () << "bind replaced space" << fqSpace << "in area" << fqArea;
   } else {
     qDebug () << "bind added new space" << fqSpace << "in area" << fqArea;
   }
 
-  spaces->insert(fqSpace, spaceDesc);
+  areaDesc->insertSpace(fqSpace, spaceDesc);
+  m_signalMaps->insert(fqArea, AreaDescPtr(areaDesc));
+  if (m_trace)
+    m_trace->bound(fqArea, fqSpace);
+  updateMapGauges();
   qDebug() << "fingerprint area count" << m_fingerprint->size();
 }
 
@@ -966,59 +1140,174 @@ bool Localizer::removeSpace(QString fqArea, QString fqSpace)
     qDebug () << "removeSpace did not find area" << fqArea;
     return false;
   }
-  AreaDesc *areaDesc = m_signalMaps->value(fqArea);
-
-  QMap<QString,SpaceDesc*> *spaces = areaDesc->spaces();
-  if (!spaces->contains(fqSpace)) {
+  AreaDescPtr oldAreaDesc = m_signalMaps->value(fqArea);
+  if (!oldAreaDesc || !oldAreaDesc->spaces().contains(fqSpace)) {
     qDebug () << "removeSpace did not find space" << fqArea;
     return false;
   }
+  if (m_trace)
+    m_trace->removed(fqArea, fqSpace);
 
-  spaces->remove(fqSpace);
-  if (spaces->size() == 0) {
+  if (oldAreaDesc->spaces().size() == 1) {
     qDebug () << "no spaces left in this area" << fqArea;
     m_signalMaps->remove(fqArea);
+    updateMapGauges();
+    return true;
   }
+
+  AreaDesc *areaDesc = new AreaDesc(*oldAreaDesc);
+  areaDesc->removeSpace(fqSpace);
+  m_signalMaps->insert(fqArea, AreaDescPtr(areaDesc));
+  updateMapGauges();
   return true;
 }
 
-void Localizer::addMonitor(QTcpSocket *socket)
+// areas whose map has not arrived yet are not counted
+void Localizer::updateMapGauges()
 {
-  qDebug() << "Localizer::addMonitor";
+  int areas = 0;
+  int spaces = 0;
+  QMapIterator<QString,AreaDescPtr> i (*m_signalMaps);
+  while (i.hasNext()) {
+    i.next();
+    if (i.value()) {
+      ++areas;
+      spaces += i.value()->spaces().size();
+    }
+  }
+  m_areaGauge->set(areas);
+  m_spaceGauge->set(spaces);
+}
+
+void Localizer::addMonitor(QIODevice *socket, const Monitor &monitor)
+{
+  qDebug() << "Localizer::addMonitor" << encodingName(monitor.encoding);
 
   if (!m_monitoringSockets.contains(socket)) {
-    m_monitoringSockets.insert(socket);
+    m_monitoringSockets.insert(socket, monitor);
+    connect(socket, SIGNAL(disconnected()), this, SLOT(removeMonitor()));
+    connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(handleMonitorWritten()));
   } else {
     qWarning("Localizer::addMonitor socket already present");
   }
 
 }
 
+void Localizer::removeMonitor()
+{
+  m_monitoringSockets.remove(qobject_cast<QIODevice *>(sender()));
+}
+
+// send the update held back while this monitor's backlog was full
+void Localizer::handleMonitorWritten()
+{
+  QIODevice *socket = qobject_cast<QIODevice *>(sender());
+  if (m_monitoringSockets.contains(socket))
+    flushMonitor(socket, m_monitoringSockets[socket]);
+}
+
+void Localizer::flushMonitors()
+{
+  QMutableMapIterator<QIODevice*,Monitor> it (m_monitoringSockets);
+  while (it.hasNext()) {
+    it.next();
+    flushMonitor(it.key(), it.value());
+  }
+}
+
+// Writes the monitor's pending update if its backlog has room and its
+// interval has passed.  Otherwise the update stays pending until
+// the socket drains or the monitor timer fires.
+void Localizer::flushMonitor(QIODevice *socket, Monitor &monitor, QByteArray *shared)
+{
+  if (!monitor.hasPending || socket->bytesToWrite() >= MAX_MONITOR_BACKLOG)
+    return;
+
+  int wait = monitor.msecUntilDue();
+  if (wait > 0) {
+    // the timer serves every monitor, so it must fire for the one due first
+    if (!m_monitorTimer.isActive() ||
+        wait < m_monitorTimer.interval() - m_monitorTimerStarted.elapsed()) {
+      m_monitorTimer.start(wait);
+      m_monitorTimerStarted.start();
+    }
+    return;
+  }
+
+  qint64 traceStart = flightRecorder()->now();
+  QByteArray update;
+  if (shared && monitor.isPlain()) {
+    if (shared->isEmpty())
+      *shared = monitor.encode(monitor.pending);
+    update = *shared;
+  } else {
+    update = monitor.encode(monitor.pending);
+  }
+  monitor.pending.clear();
+  monitor.hasPending = false;
+
+  if (!update.isEmpty()) {
+    socket->write(update);
+    monitor.written();
+    flightRecorder()->record(FLIGHT_MONITOR_PUSH, traceStart, update.size(),
+                             encodingName(monitor.encoding));
+  }
+}
+
+// lag of each monitor connection, computed when asked so it is current;
+// kept out of the stats pushed to monitors, where it would change on
+// every update
+QVariantList Localizer::monitorStats() const
+{
+  QVariantList monitors;
+  QMapIterator<QIODevice*,Monitor> it (m_monitoringSockets);
+  while (it.hasNext()) {
+    it.next();
+    QVariantMap map;
+    map.insert("Encoding", encodingName(it.value().encoding));
+    map.insert("Backlog", it.key()->bytesToWrite());
+    map.insert("Sent", it.value().sent);
+    map.insert("Dropped", it.value().dropped);
+    monitors.append(map);
+  }
+  return monitors;
+}
+
 // See LocalServer::handleStats and handleQuery
 void Localizer::emitEstimateToMonitors()
 {
   if (m_monitoringSockets.isEmpty())
     return;
 
-  qDebug() << "Localizer::emitEstimateToMonitors";
+  moleDebug(SERVER_LOG) << "Localizer::emitEstimateToMonitors";
 
-  QByteArray reply = estimateAndStatsAsJson();
-  QMutableSetIterator<QTcpSocket*> it (m_monitoringSockets);
+  // Build the update once.  Monitors without a filter or deltas
+  // share one encoded buffer per encoding.
+  QVariantMap map;
+  estimateAndStatsAsMap(map);
+  QByteArray updates[MSGPACK_ENCODING+1];
+
+  QMutableMapIterator<QIODevice*,Monitor> it (m_monitoringSockets);
 
   while (it.hasNext()) {
-    QTcpSocket *socket = it.next();
-    if (!socket || !(socket->state() == QAbstractSocket::ConnectedState)) {
+    it.next();
+    QIODevice *socket = it.key();
+    Monitor &monitor = it.value();
+    if (!socket || !socket->isOpen()) {
       it.remove();
-    } else {
-      qDebug() << "writing estimate to socket";
-      socket->write(reply);
+      continue;
     }
+    // a newer update always replaces one that is still pending
+    if (monitor.hasPending)
+      ++monitor.dropped;
+    monitor.pending = monitor.filter(map);
+    monitor.hasPending = true;
+    flushMonitor(socket, monitor, &updates[monitor.encoding]);
   }
 }
 
-QByteArray Localizer::estimateAndStatsAsJson()
+void Localizer::estimateAndStatsAsMap(QVariantMap &map)
 {
-  QVariantMap map;
   QVariantMap placeMap;
   QVariantMap statsMap;
 
@@ -1027,11 +1316,6 @@ QByteArray Localizer::estimateAndStatsAsJson()
 
   map.insert("estimate", placeMap);
   map.insert("stats", statsMap);
-
-  QJson::Serializer serializer;
-  const QByteArray json = serializer.serialize(map);
-
-  return json;
 }
 
 void Localizer::estimateAsMap(QVariantMap &placeMap)
@@ -1048,6 +1332,7 @@ void Localizer::estimateAsMap(QVariantMap &placeMap)
   placeMap.insert("tags", tags);
   placeMap.insert("floor", floor);
   placeMap.insert("score", score);
+  placeMap.insert("version", m_estimateVersion);
 }
 
 void Localizer::serializeSignature (QVariantMap &map) {
@@ -1069,11 +1354,11 @@ void Localizer::serializeSignature (QVariantMap &map) {
 
 /*
 void Localizer::dumpSignalMaps () {
-  QMapIterator<QString,AreaDesc*> i (*m_signalMaps);
+  QMapIterator<QString,AreaDescPtr> i (*m_signalMaps);
   while (i.hasNext()) {
     i.next();
     QString area = i.key();
-    AreaDesc *desc = i.value();
+    AreaDescPtr desc = i.value();
     
   }
 }
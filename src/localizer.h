@@ -18,8 +18,15 @@
 #ifndef LOCALIZER_H_
 #define LOCALIZER_H_
 
+#include "dbus.h"
+#include "encoding.h"
+#include "latencyHistogram.h"
+#include "localizerWorker.h"
+#include "metrics.h"
 #include "math.h"
+#include "monitor.h"
 #include "network.h"
+#include "networkTelemetry.h"
 #include "overlap.h"
 #include "scan.h"
 #include "motion.h"
@@ -46,6 +53,14 @@ QTM_USE_NAMESPACE
 */
 
 class Binder;
+class ScanTraceWriter;
+
+// Map state is published copy-on-write.  A SpaceDesc or AreaDesc is
+// built by one writer and never changed once it is in m_signalMaps;
+// a writer that wants to change an area builds a new AreaDesc (sharing
+// the unchanged spaces) and swaps it into m_signalMaps.  Readers pin
+// what they use by holding the shared pointer, so an area replaced or
+// expired meanwhile is freed only when its last reader lets go.
 
 class SpaceDesc
 {
@@ -54,23 +69,39 @@ class SpaceDesc
   SpaceDesc(QMap<QString,Sig*> *fingerprint);
   ~SpaceDesc();
 
+  // non-const only while the space is being built
   QMap<QString,Sig*>* signatures() { return m_sigs; }
-  QList<QString> macs() { return m_sigs->keys(); }
+  const QMap<QString,Sig*>* signatures() const { return m_sigs; }
+  // the macs as heard, even when the signatures are grouped
+  QList<QString> macs() const { return m_macs.isEmpty() ? m_sigs->keys() : m_macs; }
+
+  // only while the space is being built
+  void groupSignatures();
 
  private:
   QMap<QString,Sig*> *m_sigs;
+  QList<QString> m_macs;
 
+  Q_DISABLE_COPY(SpaceDesc)
 };
 
+// SpaceDescPtr is declared in localizerWorker.h
+
 class AreaDesc
 {
  public:
   AreaDesc();
-  ~AreaDesc();
 
-  QMap<QString,SpaceDesc*> *spaces() const { return m_spaces; }
-  QList<QString> macs() const { return m_macs->toList(); }
-  void insertMac(QString mac) { m_macs->insert(mac); }
+  const QMap<QString,SpaceDescPtr> &spaces() const { return m_spaces; }
+  QList<QString> macs() const { return m_macs.toList(); }
+
+  // only while the area is being built
+  void insertSpace(const QString &name, SpaceDescPtr space) { m_spaces.insert(name, space); }
+  void removeSpace(const QString &name) { m_spaces.remove(name); }
+  void insertMac(QString mac) { m_macs.insert(mac); }
+
+  // Bookkeeping for the map cache, not part of the published map.
+  // Only the main thread uses these.
   QDateTime lastAccessTime() const { return m_lastAccessTime; }
   QDateTime lastModifiedTime() const { return m_lastModifiedTime; }
   void setLastModifiedTime(const QDateTime ts) { m_lastModifiedTime = ts; }
@@ -83,8 +114,8 @@ class AreaDesc
   void untouch() { m_touch = false; }
 
  private:
-  QSet<QString> *m_macs;
-  QMap<QString,SpaceDesc*> *m_spaces;
+  QSet<QString> m_macs;
+  QMap<QString,SpaceDescPtr> m_spaces;
   // according to our local clock
   QDateTime m_lastAccessTime;
   // according to the server
@@ -94,14 +125,18 @@ class AreaDesc
 
 };
 
+// non-const only for the bookkeeping above
+typedef QSharedPointer<AreaDesc> AreaDescPtr;
+
 class MapParser : public QXmlDefaultHandler
 {
  public:
   bool startDocument() { return true; }
-  bool endElement(const QString&, const QString&, const QString&) { return true; }
+  bool endElement(const QString&, const QString&, const QString&);
   bool startElement(const QString&, const QString&, const QString&, const QXmlAttributes&);
   bool endDocument() { return true; }
 
+  // caller takes ownership
   AreaDesc* areaDesc() const { return m_areaDesc; }
   QString fqArea() const { return m_fqArea; }
 
@@ -113,7 +148,18 @@ class MapParser : public QXmlDefaultHandler
 
 };
 
+class QDBusServiceWatcher;
+
+// Defaults for the D-Bus LocationStats signal
+const int DEFAULT_STATS_INTERVAL_MSEC = 1000;
+const int DEFAULT_STATS_TOP_SPACES = 10;
+
+// Under D-Bus, a QDBusContext, so subscribers are known by the
+// bus name their signals come from rather than one they claim.
 class LocalizerStats : public QObject
+#ifdef USE_MOLE_DBUS
+  , protected QDBusContext
+#endif
 {
   Q_OBJECT
 
@@ -151,14 +197,33 @@ class LocalizerStats : public QObject
   void clearAfterWalkDetection();
   void handleMotionChange(Motion currentMotion);
 
+
+  // from the metrics registry: recording is lock-free, so any thread
+  // may record, and localizers in one process share them
+  LatencyHistogram *latency(PipelineStage stage) { return m_latency[stage]; }
+  // stage name -> percentiles
+  QVariantMap latencyAsMap() const;
+
+  QVariantMap ranks() const { return rankEntries; }
   void clearRankEntries();
   void addRankEntry(QString space, double score);
   double getConfidence();
 
+  // LocationStats goes out at most once per interval; requests in
+  // between are coalesced into one signal at the end of the interval
+  void setStatsInterval(int msec) { m_statsInterval = msec; }
+  // only the best scoring spaces go out on D-Bus, 0 sends them all
+  void setStatsTopSpaces(int count) { m_statsTopSpaces = count; }
+
  public slots:
   void emitStatistics();
   void handleHibernate(bool goToSleep);
 
+  // the senders of SubscribeStatistics and UnsubscribeStatistics;
+  // mode "changes" gets LocationStatsChanged instead of LocationStats
+  void addStatisticsSubscriber(QString mode);
+  void removeStatisticsSubscriber();
+
  private:
   QTimer *m_logTimer;
   int m_scanQueueSize;
@@ -189,17 +254,68 @@ class LocalizerStats : public QObject
   QTime m_lastScanTime;
   QTime m_lastEmitLocation;
   QTimer m_emitTimer;
+  QTimer m_coalesceTimer;
+  QElapsedTimer m_lastEmit;
+  int m_statsInterval;
+  int m_statsTopSpaces;
+
+  // unique bus name -> wants changed fields only
+  QMap<QString,bool> m_subscribers;
+  QDBusServiceWatcher *m_subscriberWatcher;
+  QVariantMap m_lastSentFields;
+  Counter *m_statsSent;
+  Counter *m_statsCoalesced;
+  Counter *m_statsUnsubscribed;
 
   double m_confidence;
+  LatencyHistogram *m_latency[PIPELINE_STAGES];
   QVariantMap rankEntries;
   QList<double> rankScores;
 
   double updateEwma(double current, int value) { return updateEwma(current, (double)value); }
   double updateEwma(double current, double value);
+  QVariantMap topRankEntries() const;
+  QVariantMap statsFields();
 
 private slots:
   void logStatistics();
+  void sendStatistics();
+  void dropStatisticsSubscriber(QString service);
+
+};
 
+// What readers see of the localizer, published after each change.
+// A published snapshot is never modified, so it can be read from any
+// thread while the localizer moves on.
+class LocalizerSnapshot
+{
+ public:
+  LocalizerSnapshot() : version(0) {}
+
+  quint32 version;
+  // as from Localizer::estimateAsMap and LocalizerStats::statsAsMap
+  QVariantMap estimate;
+  QVariantMap stats;
+  // space -> score from the last scoring
+  QVariantMap ranks;
+};
+
+// How long the stages of the last scored scan took, in nsec.
+class LocalizeTimings
+{
+ public:
+  LocalizeTimings() : seq(0), selectNsec(0), waitNsec(0), scoreNsec(0), resultNsec(0) {}
+
+  quint32 seq;
+  // picking the candidate spaces, on the localizer's thread
+  qint64 selectNsec;
+  // submitted until the worker picked the scan up
+  qint64 waitNsec;
+  // scoring on the worker (with runAllAlgorithms, the
+  // comparison estimates too)
+  qint64 scoreNsec;
+  // submitted until the scores were applied
+  qint64 resultNsec;
 };
 
 class Localizer : public QObject
@@ -207,7 +323,11 @@ class Localizer : public QObject
   Q_OBJECT
 
 public:
-  Localizer(QObject *parent = 0, bool runAllAlgorithms = false);
+  // Loads the map cache, unless it shares the maps of mapSource.
+  // Localizers on other threads may share one localizer's maps as long
+  // as none of them fetches or expires maps (see setOffline).
+  Localizer(QObject *parent = 0, bool runAllAlgorithms = false,
+            const Localizer *mapSource = 0);
   ~Localizer();
 
   void scanCompleted();
@@ -224,14 +344,42 @@ public:
                             QString&, QString&, int&, double&);
 
   LocalizerStats* stats() const { return m_stats; }
-  void addMonitor(QTcpSocket *socket);
-  QByteArray estimateAndStatsAsJson();
+  // socket is a QTcpSocket or QLocalSocket
+  void addMonitor(QIODevice *socket, const Monitor &monitor);
+  QVariantList monitorStats() const;
+  void estimateAndStatsAsMap(QVariantMap &map);
   void estimateAsMap(QVariantMap &placeMap);
+  // goes up by one each time the estimated space changes
+  quint32 estimateVersion() const { return m_estimateVersion; }
+  QSharedPointer<const LocalizerSnapshot> snapshot() const;
   void serializeSignature (QVariantMap &map);
 
   void bind(QString fqArea, QString fqSpace);
   bool removeSpace(QString fqArea, QString fqSpace);
 
+  // Spaces worth scoring some other fingerprint against,
+  // pinned so they can be scored off the main thread.
+  // Matched areas are touched, so the map cache keeps them fresh.
+  QMap<QString,SpaceDescPtr> candidateSpaces(const QMap<QString,APDesc*> *fingerprint);
+  // Asks the server which areas hold this fingerprint's loud macs,
+  // as fillAreaCache does for the local one.
+  void fetchAreasFor(const QMap<QString,APDesc*> *fingerprint);
+  // off when the maps serve sessions rather than this device
+  void setExpireMaps(bool expire) { m_expireMaps = expire; }
+  // never fetch areas or maps; the cached maps are all there is
+  void setOffline();
+  // binds and removes are recorded to the trace
+  void setTrace(ScanTraceWriter *trace) { m_trace = trace; }
+  // a scan is waiting for or in scoring
+  bool scoringPending() const { return m_jobsInFlight > 0; }
+  const LocalizeTimings &lastTimings() const { return m_lastTimings; }
+  LatencyHistogram *latency(PipelineStage stage) { return m_stats->latency(stage); }
+
+ signals:
+  void estimateChanged();
+  // the last scoring in flight has been applied
+  void scoringIdle();
+
  public slots:
   void handleHibernate(bool goToSleep);
   void handleMotionChange(Motion currentMotion);
@@ -242,11 +390,47 @@ private:
   bool m_firstAddScan;
   bool m_forceMapCacheUpdate;
   bool m_hibernating;
+  bool m_expireMaps;
+  bool m_offline;
+  // the maps are another localizer's too: leave their bookkeeping alone
+  bool m_sharedMaps;
+  ScanTraceWriter *m_trace;
 
   QDir *m_mapRoot;
-  Overlap *m_overlap;
   LocalizerStats *m_stats;
-  QSet<QTcpSocket*> m_monitoringSockets;
+  quint32 m_estimateVersion;
+
+  // Scoring runs on m_worker.  Results are only applied if no newer
+  // estimate has been made since their scan was submitted.
+  LocalizerWorker *m_worker;
+  quint32 m_scoringSeq;
+  quint32 m_appliedSeq;
+  int m_jobsInFlight;
+  // started as each scan is localized
+  QElapsedTimer m_localizeTimer;
+  LocalizeTimings m_lastTimings;
+  void submitScoring(const QMap<QString,SpaceDescPtr> &candidateSpaces);
+  void recordTopScores(const ScoringResult &result);
+
+  // from the metrics registry
+  Counter *m_localizedCount;
+  Counter *m_skippedScoringCount;
+  Counter *m_estimateChangeCount;
+  Counter *m_mapParseCount;
+  Counter *m_mapParseErrorCount;
+  Gauge *m_areaGauge;
+  Gauge *m_spaceGauge;
+  void updateMapGauges();
+
+  mutable QMutex m_snapshotLock;
+  QSharedPointer<const LocalizerSnapshot> m_snapshot;
+  void publishSnapshot();
+
+  QMap<QIODevice*,Monitor> m_monitoringSockets;
+  // fires when the earliest pending monitor's interval has passed
+  QTimer m_monitorTimer;
+  QElapsedTimer m_monitorTimerStarted;
+  void flushMonitor(QIODevice *socket, Monitor &monitor, QByteArray *shared = 0);
   double currentEstimateScore;
   //QPointer<QGeoPositionInfoSource> m_locationDataSource;
   //QGeoPositionInfoSource *m_locationDataSource;
@@ -261,7 +445,7 @@ private:
 
   QQueue<QNetworkRequest> m_areaMapRequests;
 
-  QMap<QString,AreaDesc*> *m_signalMaps;
+  QMap<QString,AreaDescPtr> *m_signalMaps;
 
   double macOverlapCoefficient(const QMap<QString,APDesc*> *macs_a,
                                const QList<QString> &macs_b);
@@ -272,7 +456,8 @@ private:
   void handleAreaMapResponse();
   bool haveValidEstimate();
 
-  void loudMac(QString &loudMacA, QString &loudMacB);
+  void loudMac(const QMap<QString,APDesc*> *fingerprint, QString &loudMacA, QString &loudMacB);
+  void requestAreas(const QString &macA, const QString &macB);
 
   void emitNewLocationEstimate(QString estimatedSpaceName,
                                double estimatedSpaceScore);
@@ -282,9 +467,6 @@ private:
   void emitNewLocalSignature();
   void emitEstimateToMonitors();
 
-  void makeOverlapEstimateWithGaussians(QMap<QString,SpaceDesc*> &);
-  void makeOverlapEstimateWithHist(QMap<QString,SpaceDesc*> &, int penalty);
-
   //Bayes
   void makeBayesEstimate(QMap<QString,SpaceDesc*> &);
   void makeBayesEstimateWithHist(QMap<QString,SpaceDesc*> &);
@@ -307,6 +489,10 @@ private slots:
   void loadMaps();
 
   void emitLocationAndStats();
+  void removeMonitor();
+  void handleMonitorWritten();
+  void flushMonitors();
+  void handleScoringResults();
 
   //void handleGeoSearch();
   //void searchError(QGeoSearchReply *reply, QGeoSearchReply::Error error, const QString &errorString);
@@ -0,0 +1,118 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "localizerWorker.h"
+#include "localizer.h"
+
+LocalizerWorker::LocalizerWorker(QObject *parent)
+  : QThread(parent)
+  , m_stopping(0)
+{
+}
+
+LocalizerWorker::~LocalizerWorker()
+{
+  m_stopping.fetchAndStoreRelease(1);
+  m_available.release();
+  wait();
+
+  ScoringJob job;
+  while (m_jobs.pop(job)) {
+    qDeleteAll(job.fingerprint);
+  }
+}
+
+bool LocalizerWorker::submit(const ScoringJob &job)
+{
+  if (!m_jobs.push(job))
+    return false;
+  m_available.release();
+  return true;
+}
+
+bool LocalizerWorker::takeResult(ScoringResult &result)
+{
+  return m_results.pop(result);
+}
+
+void LocalizerWorker::run()
+{
+  qDebug() << "localizer worker started";
+
+  while (true) {
+    m_available.acquire();
+    if (m_stopping.fetchAndAddAcquire(0))
+      break;
+
+    ScoringJob job;
+    if (!m_jobs.pop(job))
+      continue;
+
+    ScoringResult result;
+    result.selectNsec = job.selectNsec;
+    result.waitNsec = job.submitted.nsecsElapsed();
+    result.submitted = job.submitted;
+    QElapsedTimer timer;
+    timer.start();
+    score(m_overlap, job, result);
+    result.scoreNsec = timer.nsecsElapsed();
+    qDeleteAll(job.fingerprint);
+
+    // the localizer never has more jobs in flight than the ring holds
+    if (!m_results.push(result)) {
+      qWarning() << "localizer worker: dropping result" << result.seq;
+      continue;
+    }
+    emit resultsReady();
+  }
+
+  qDebug() << "localizer worker stopped";
+}
+
+void LocalizerWorker::score(Overlap &overlap, const ScoringJob &job, ScoringResult &result)
+{
+  result.seq = job.seq;
+
+  for (int i = 0; i < job.spaces.size(); ++i) {
+    const QString &space = job.spaces.at(i).first;
+    double score = overlap.compareHistOverlap(&job.fingerprint,
+                                              job.spaces.at(i).second->signatures(), job.penalty);
+    result.scores.append(qMakePair(space, score));
+
+    if (score > result.maxScore) {
+      result.maxScore = score;
+      result.maxSpace = space;
+    }
+  }
+
+  for (int c = 0; c < job.comparePenalties.size(); ++c) {
+    ScoringComparison comparison;
+    comparison.penalty = job.comparePenalties.at(c);
+    for (int i = 0; i < job.spaces.size(); ++i) {
+      const QMap<QString,Sig*> *signatures = job.spaces.at(i).second->signatures();
+      double score = comparison.penalty == GAUSSIAN_COMPARISON
+        ? overlap.compareSigOverlap(&job.fingerprint, signatures)
+        : overlap.compareHistOverlap(&job.fingerprint, signatures, comparison.penalty);
+
+      if (score > comparison.maxScore) {
+        comparison.maxScore = score;
+        comparison.maxSpace = job.spaces.at(i).first;
+      }
+    }
+    result.comparisons.append(comparison);
+  }
+}
@@ -0,0 +1,157 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LOCALIZER_WORKER_H_
+#define LOCALIZER_WORKER_H_
+
+#include <QtCore>
+
+#include "overlap.h"
+#include "sig.h"
+
+class SpaceDesc;
+typedef QSharedPointer<const SpaceDesc> SpaceDescPtr;
+
+// Scans that may be waiting for or in scoring at once.
+const int SCORING_QUEUE_SIZE = 4;
+// Histogram overlap penalty the estimate is made with.
+const int BEST_PENALTY = 4;
+// Comparison penalty that stands for Gaussian overlap instead of histograms.
+const int GAUSSIAN_COMPARISON = -1;
+
+// Ring shared by exactly one producer thread and one consumer thread.
+// Neither side takes a lock or blocks; push fails when full and pop
+// fails when empty.  N must be a power of two.
+template <class T, int N>
+class SpscRing
+{
+ public:
+  SpscRing() : m_head(0), m_tail(0) {}
+
+  // producer only
+  bool push(const T &item) {
+    uint head = m_head.fetchAndAddRelaxed(0);
+    uint tail = m_tail.fetchAndAddAcquire(0);
+    if (head - tail == (uint)N)
+      return false;
+    m_items[head % N] = item;
+    m_head.fetchAndStoreRelease(head + 1);
+    return true;
+  }
+
+  // consumer only
+  bool pop(T &item) {
+    uint tail = m_tail.fetchAndAddRelaxed(0);
+    uint head = m_head.fetchAndAddAcquire(0);
+    if (head == tail)
+      return false;
+    item = m_items[tail % N];
+    m_items[tail % N] = T();
+    m_tail.fetchAndStoreRelease(tail + 1);
+    return true;
+  }
+
+ private:
+  T m_items[N];
+  QAtomicInt m_head;
+  QAtomicInt m_tail;
+};
+
+// Everything the worker needs to score one scan.
+// The fingerprint is a private copy owned by the job.  The spaces are
+// immutable and pinned by the job, so the localizer may swap in new
+// maps while the job is scored.
+class ScoringJob
+{
+ public:
+  ScoringJob() : seq(0), penalty(0), selectNsec(0) {}
+
+  quint32 seq;
+  int penalty;
+  // picking the spaces took this long
+  qint64 selectNsec;
+  // started on submission
+  QElapsedTimer submitted;
+  QMap<QString,Sig*> fingerprint;
+  QList<QPair<QString,SpaceDescPtr> > spaces;
+  // with runAllAlgorithms, further estimates made for comparison only
+  QList<int> comparePenalties;
+};
+
+// The best space under one comparison penalty.
+class ScoringComparison
+{
+ public:
+  ScoringComparison() : penalty(0), maxScore(-5.) {}
+
+  int penalty;
+  QString maxSpace;
+  double maxScore;
+};
+
+class ScoringResult
+{
+ public:
+  ScoringResult() : seq(0), maxScore(-5.), selectNsec(0), waitNsec(0), scoreNsec(0) {}
+
+  quint32 seq;
+  QList<QPair<QString,double> > scores;
+  QString maxSpace;
+  double maxScore;
+  QList<ScoringComparison> comparisons;
+
+  // stage timings, carried over from the job
+  qint64 selectNsec;
+  // waiting for the worker
+  qint64 waitNsec;
+  qint64 scoreNsec;
+  QElapsedTimer submitted;
+};
+
+// Runs the histogram overlap scoring off the main event loop.
+// The localizer submits jobs and takes results from the main thread;
+// resultsReady is delivered there as a queued signal.
+class LocalizerWorker : public QThread
+{
+  Q_OBJECT
+
+ public:
+  LocalizerWorker(QObject *parent = 0);
+  ~LocalizerWorker();
+
+  bool submit(const ScoringJob &job);
+  bool takeResult(ScoringResult &result);
+
+  // also used by the session engine's thread pool
+  static void score(Overlap &overlap, const ScoringJob &job, ScoringResult &result);
+
+ signals:
+  void resultsReady();
+
+ protected:
+  void run();
+
+ private:
+  SpscRing<ScoringJob,SCORING_QUEUE_SIZE> m_jobs;
+  SpscRing<ScoringResult,SCORING_QUEUE_SIZE> m_results;
+  // counts jobs waiting in m_jobs
+  QSemaphore m_available;
+  QAtomicInt m_stopping;
+  Overlap m_overlap;
+};
+
+#endif /* LOCALIZER_WORKER_H_ */
@@ -33,7 +33,7 @@ void LocalizerStats::logStatistics()
 }
 
 void LocalizerStats::clearAfterWalkDetection() {
-  qDebug() << Q_FUNC_INFO;
+  moleDebug(GENERAL_LOG) << Q_FUNC_INFO;
   m_scanQueueSize = 0;
   m_macsSeenSize = 0;
   m_totalAreaCount = 0;
@@ -45,12 +45,36 @@ void LocalizerStats::clearAfterWalkDetection() {
 }
 
 
+// Ask for a LocationStats signal.  Signals are rate limited: a request
+// within the interval of the last one is folded into a single signal
+// sent when the interval is up.
 void LocalizerStats::emitStatistics()
 {
   m_emitTimer.stop();
   m_emitTimer.start(maxEmitStatisticsDelay);
 
+  if (m_lastEmit.isValid() && m_lastEmit.elapsed() < m_statsInterval) {
+    m_statsCoalesced->increment();
+    if (!m_coalesceTimer.isActive()) {
+      m_coalesceTimer.start(m_statsInterval - m_lastEmit.elapsed());
+    }
+    return;
+  }
+  sendStatistics();
+}
+
+void LocalizerStats::sendStatistics()
+{
+  m_coalesceTimer.stop();
+
 #ifdef USE_MOLE_DBUS
+  // nobody is listening, so do not build or send anything
+  if (m_subscribers.isEmpty()) {
+    m_statsUnsubscribed->increment();
+    return;
+  }
+  m_lastEmit.start();
+  m_statsSent->increment();
 
   int uptime = m_startTime.secsTo(QDateTime::currentDateTime());
   if (m_emitNewLocationCount > 0) {
@@ -59,58 +83,150 @@ void LocalizerStats::emitStatistics()
     m_emitNewLocationSec = 0;
   }
 
-  qDebug() << Q_FUNC_INFO
-           << "network_success_rate " << m_networkSuccessRate
-           << "emit_new_location_sec " << m_emitNewLocationSec
-           << "scan_rate_ms " << m_scanRateSec
+  moleDebug(GENERAL_LOG) << Q_FUNC_INFO
+                         << "network_success_rate " << m_networkSuccessRate
+                         << "emit_new_location_sec " << m_emitNewLocationSec
+                         << "scan_rate_ms " << m_scanRateSec
 	   << "scanQueueSize" << m_scanQueueSize
-	   << "currentMotion" << m_currentMotion;
+	   << "currentMotion" << m_currentMotion
+	   << "subscribers" << m_subscribers.size();
 
-  QString empty = "";
+  QVariantMap topRanks = topRankEntries();
 
-  //QVariantMap rankedSpaces;
+  if (m_subscribers.values().contains(false)) {
+    QString empty = "";
 
+    QDBusMessage statsMsg = QDBusMessage::createSignal("/", "com.nokia.moled", "LocationStats");
+    statsMsg << empty
 
-  QDBusMessage statsMsg = QDBusMessage::createSignal("/", "com.nokia.moled", "LocationStats");
-  statsMsg << empty
+      // convert to GMT for network recording
+            << m_startTime
 
-    // convert to GMT for network recording
-          << m_startTime
+      // integers
+            << m_scanQueueSize
+            << m_macsSeenSize
 
-    // integers
-          << m_scanQueueSize
-          << m_macsSeenSize
+            << m_totalAreaCount
+            << m_totalSpaceCount
+            << m_potentialAreaCount
+            << m_potentialSpaceCount
 
-          << m_totalAreaCount
-          << m_totalSpaceCount
-          << m_potentialAreaCount
-          << m_potentialSpaceCount
+            << m_currentMotion
 
-          << m_currentMotion
+	   << m_scanRateSec
 
-	 << m_scanRateSec
+      // doubles
+           << m_emitNewLocationSec
 
-    // doubles
-         << m_emitNewLocationSec
+           << m_networkLatency
+           << m_networkSuccessRate
 
-         << m_networkLatency
-         << m_networkSuccessRate
+           << m_overlapMax
+           << getConfidence()
 
-         << m_overlapMax
-         << getConfidence()
+      // best ranked spaces
 
-    // ranked spaces
+	     << topRanks
 
-	   << rankEntries;
+      // stage name -> latency percentiles
 
-  QDBusConnection::systemBus().send(statsMsg);
+	     << latencyAsMap();
+
+    QDBusConnection::systemBus().send(statsMsg);
+  }
+
+  // only the fields that differ from the last signal
+  QVariantMap fields = statsFields();
+  fields.insert("Ranks", topRanks);
+  QVariantMap changed;
+  QMapIterator<QString,QVariant> i (fields);
+  while (i.hasNext()) {
+    i.next();
+    if (m_lastSentFields.value(i.key()) != i.value()) {
+      changed.insert(i.key(), i.value());
+    }
+  }
+  m_lastSentFields = fields;
+
+  if (!changed.isEmpty() && m_subscribers.values().contains(true)) {
+    QDBusMessage changedMsg = QDBusMessage::createSignal("/", "com.nokia.moled", "LocationStatsChanged");
+    changedMsg << changed;
+    QDBusConnection::systemBus().send(changedMsg);
+  }
 #warning localizer statistics: using dbus
 #else
 #warning localizer statistics: no dbus
-  qDebug() << Q_FUNC_INFO << "no dbus";
+  moleDebug(GENERAL_LOG) << Q_FUNC_INFO << "no dbus";
+#endif
+}
+
+void LocalizerStats::addStatisticsSubscriber(QString mode)
+{
+#ifdef USE_MOLE_DBUS
+  if (!calledFromDBus())
+    return;
+  QString service = message().service();
+  if (service.isEmpty())
+    return;
+  bool changesOnly = (mode == "changes");
+  if (!m_subscribers.contains(service)) {
+    qWarning() << "stats subscriber" << service << mode;
+    // it may have left before we saw its signal
+    if (!QDBusConnection::systemBus().interface()->isServiceRegistered(service)) {
+      return;
+    }
+    m_subscriberWatcher->addWatchedService(service);
+  } else if (m_subscribers.value(service) == changesOnly) {
+    return;
+  }
+  m_subscribers.insert(service, changesOnly);
+  // a new listener starts from the full set of fields
+  m_lastSentFields.clear();
+  emitStatistics();
+#else
+  Q_UNUSED(mode);
+#endif
+}
+
+void LocalizerStats::removeStatisticsSubscriber()
+{
+#ifdef USE_MOLE_DBUS
+  if (calledFromDBus())
+    dropStatisticsSubscriber(message().service());
 #endif
 }
 
+void LocalizerStats::dropStatisticsSubscriber(QString service)
+{
+  if (m_subscribers.remove(service) == 0)
+    return;
+  qWarning() << "stats subscriber left" << service;
+#ifdef USE_MOLE_DBUS
+  m_subscriberWatcher->removeWatchedService(service);
+#endif
+}
+
+// the best m_statsTopSpaces entries of rankEntries
+QVariantMap LocalizerStats::topRankEntries() const
+{
+  if (m_statsTopSpaces <= 0 || rankEntries.size() <= m_statsTopSpaces) {
+    return rankEntries;
+  }
+  QList<double> scores = rankScores;
+  qSort(scores.begin(), scores.end(), qGreater<double>());
+  double cutoff = scores.at(m_statsTopSpaces - 1);
+
+  QVariantMap top;
+  QMapIterator<QString,QVariant> i (rankEntries);
+  while (i.hasNext() && top.size() < m_statsTopSpaces) {
+    i.next();
+    if (i.value().toDouble() >= cutoff) {
+      top.insert(i.key(), i.value());
+    }
+  }
+  return top;
+}
+
 void LocalizerStats::clearRankEntries() {
   m_confidence = 0.;
   rankEntries.clear();
@@ -131,11 +247,23 @@ double LocalizerStats::getConfidence() {
   }
   qSort(rankScores.begin(), rankScores.end(), qGreater<double>());
   m_confidence = rankScores.at(0) - rankScores.at(1);
-  qDebug () << "getConfidence" << rankScores.at(0) << rankScores.at(1) << "conf" << m_confidence;
+  moleDebug(LOCALIZE_LOG) << "getConfidence" << rankScores.at(0) << rankScores.at(1) << "conf" << m_confidence;
   return m_confidence;
 }
 
 
+// what LocationStats carries, by name
+QVariantMap LocalizerStats::statsFields()
+{
+  QVariantMap map;
+  statsAsMap(map);
+  map.insert("TotalSpaceCount", m_totalSpaceCount);
+  map.insert("PotentialAreaCount", m_potentialAreaCount);
+  map.insert("Motion", (int) m_currentMotion);
+  map.insert("StartTime", m_startTime);
+  return map;
+}
+
 void LocalizerStats::statsAsMap(QVariantMap &map)
 {
   map.insert("LocalizerQueueSize", m_scanQueueSize);
@@ -148,6 +276,16 @@ void LocalizerStats::statsAsMap(QVariantMap &map)
   map.insert("OverlapMax", m_overlapMax);
   map.insert("OverlapDiff", getConfidence());
   map.insert("Churn", (int)(round(m_emitNewLocationSec)));
+  map.insert("Latency", latencyAsMap());
+}
+
+QVariantMap LocalizerStats::latencyAsMap() const
+{
+  QVariantMap map;
+  for (int i = 0; i < PIPELINE_STAGES; ++i) {
+    map.insert(pipelineStageName((PipelineStage) i), m_latency[i]->asMap());
+  }
+  return map;
 }
 
 LocalizerStats::LocalizerStats(QObject *parent)
@@ -167,12 +305,27 @@ LocalizerStats::LocalizerStats(QObject *parent)
   , m_emitNewLocationCount(0)
   , m_overlapMax(0.)
     //, m_movementDetectedCount(0)
+  , m_statsInterval(DEFAULT_STATS_INTERVAL_MSEC)
+  , m_statsTopSpaces(DEFAULT_STATS_TOP_SPACES)
+  , m_subscriberWatcher(0)
+  , m_statsSent(metrics()->counter("mole_stats_signals", "LocationStats signals on D-Bus.",
+                                   "result=\"sent\""))
+  , m_statsCoalesced(metrics()->counter("mole_stats_signals", "LocationStats signals on D-Bus.",
+                                        "result=\"coalesced\""))
+  , m_statsUnsubscribed(metrics()->counter("mole_stats_signals", "LocationStats signals on D-Bus.",
+                                           "result=\"unsubscribed\""))
   , m_confidence(0)
 {
   m_startTime = QDateTime::currentDateTime();
   m_lastEmitLocation = QTime::currentTime();
   m_lastScanTime.start(); //= QTime::currentTime();
 
+  for (int i = 0; i < PIPELINE_STAGES; ++i) {
+    m_latency[i] = metrics()->histogram
+      ("mole_stage_latency_seconds", "Time taken by each stage of the localization pipeline.",
+       QString("stage=\"%1\"").arg(pipelineStageName((PipelineStage) i)));
+  }
+
   m_logTimer = new QTimer(this);
   connect(m_logTimer, SIGNAL(timeout()), SLOT(logStatistics()));
   m_logTimer->start(30000);
@@ -180,6 +333,23 @@ LocalizerStats::LocalizerStats(QObject *parent)
   connect (&m_emitTimer, SIGNAL(timeout()), this, SLOT(emitStatistics()));
   m_emitTimer.start(maxEmitStatisticsDelay);
 
+  m_coalesceTimer.setSingleShot(true);
+  connect (&m_coalesceTimer, SIGNAL(timeout()), this, SLOT(sendStatistics()));
+
+#ifdef USE_MOLE_DBUS
+  m_subscriberWatcher = new QDBusServiceWatcher
+    (QString(), QDBusConnection::systemBus(),
+     QDBusServiceWatcher::WatchForUnregistration, this);
+  connect(m_subscriberWatcher, SIGNAL(serviceUnregistered(QString)),
+          SLOT(dropStatisticsSubscriber(QString)));
+  QDBusConnection::systemBus().connect
+    (QString(), QString(), "com.nokia.moled", "SubscribeStatistics", this,
+     SLOT(addStatisticsSubscriber(QString)));
+  QDBusConnection::systemBus().connect
+    (QString(), QString(), "com.nokia.moled", "UnsubscribeStatistics", this,
+     SLOT(removeStatisticsSubscriber()));
+#endif
+
 }
 
 void LocalizerStats::addNetworkLatency(int value)
@@ -190,20 +360,20 @@ void LocalizerStats::addNetworkLatency(int value)
 void LocalizerStats::addNetworkSuccessRate(int value)
 {
   m_networkSuccessRate = updateEwma(m_networkSuccessRate, value);
-  qDebug() << "net success " << m_networkSuccessRate;
+  moleDebug(NETWORK_LOG) << "net success " << m_networkSuccessRate;
 }
 
 void LocalizerStats::receivedScan()
 {
   m_scanRateSec = ((int)(round(m_lastScanTime.elapsed()/1000)));
-  qDebug() << "receivedScan "
-           << "elapsed " << m_lastScanTime.elapsed();
+  moleDebug(SCAN_LOG) << "receivedScan "
+                      << "elapsed " << m_lastScanTime.elapsed();
   m_lastScanTime.restart();
 }
 
 void LocalizerStats::handleHibernate(bool goToSleep)
 {
-  qDebug () << "LocalizerStats handleHibernate" << goToSleep;
+  moleDebug(GENERAL_LOG) << "LocalizerStats handleHibernate" << goToSleep;
   if (goToSleep) {
     m_scanRateSec = 60;
   } else {
@@ -224,9 +394,9 @@ void LocalizerStats::addApPerScanCount(int count)
 
 void LocalizerStats::addOverlapMax(double value)
 {
-  qDebug() << "overlap "
-           << "max " << m_overlapMax
-           << "value " << value;
+  moleDebug(LOCALIZE_LOG) << "overlap "
+                          << "max " << m_overlapMax
+                          << "value " << value;
   m_overlapMax = value;
 }
 
@@ -0,0 +1,325 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+bool debug = false;
+FILE *logStream = NULL;
+quint32 debugCategories = ~0u;
+
+static const char *LOG_CATEGORY_NAMES[LOG_CATEGORIES] = {
+  "general", "scan", "localize", "score", "map", "network", "server"
+};
+
+// a power of two
+const int LOG_SLOTS = 1024;
+// longer debug messages are cut short, longer warnings take more slots
+const int LOG_LINE_BYTES = 512;
+// room for " [cut N bytes]"
+const int LOG_CUT_MARK_BYTES = 32;
+// the writer wakes at least this often
+const int LOG_FLUSH_MSEC = 100;
+
+// One queued message.  seq says whose turn the slot is: it is free for
+// the producer claiming position seq, and holds a message for the writer
+// when it is one past the position that filled it.  This is Vyukov's
+// bounded queue, here with many producers and a single consumer.
+class LogSlot
+{
+ public:
+  QAtomicInt seq;
+  uint time;
+  char level;
+  int length;
+  char text[LOG_LINE_BYTES];
+};
+
+static LogSlot logSlots[LOG_SLOTS];
+// next position to fill; positions wrap around as unsigned ints
+static QAtomicInt enqueuePos;
+// debug messages lost because the queue was full
+static QAtomicInt droppedLines;
+
+static QString logFilename;
+
+class LogWriter : public QThread
+{
+ public:
+  LogWriter() : m_dequeuePos(0), m_stopping(0), m_cachedTime(0) {}
+
+  void wake() { m_wake.wakeOne(); }
+  void stop();
+
+ protected:
+  void run();
+
+ private:
+  // only touched by the writer
+  uint m_dequeuePos;
+  QAtomicInt m_stopping;
+  QMutex m_lock;
+  QWaitCondition m_wake;
+
+  // formatting the time is slow, and many lines share a second
+  uint m_cachedTime;
+  QByteArray m_cachedStamp;
+  // written with one fwrite
+  QByteArray m_batch;
+
+  void drain();
+  void writeLine(uint time, char level, const char *text, int length);
+  void rotate();
+};
+
+static LogWriter *logWriter = 0;
+
+static int wrap(uint pos)
+{
+  return (int) pos;
+}
+
+bool setDebugCategories(const QString &names)
+{
+  quint32 categories = 0;
+  foreach (const QString &name, names.split(',', QString::SkipEmptyParts)) {
+    int i = 0;
+    while (i < LOG_CATEGORIES && name.trimmed() != LOG_CATEGORY_NAMES[i])
+      ++i;
+    if (i == LOG_CATEGORIES)
+      return false;
+    categories |= 1 << i;
+  }
+  debugCategories = categories;
+  return true;
+}
+
+QString logCategoryNames()
+{
+  QStringList names;
+  for (int i = 0; i < LOG_CATEGORIES; ++i)
+    names << LOG_CATEGORY_NAMES[i];
+  return names.join(",");
+}
+
+void initLogger(const char *filename)
+{
+  if (filename != NULL) {
+    if ((logStream = fopen(filename, "a")) == NULL) {
+      fprintf(stderr, "Could not open log file %s.\n\n", filename);
+      exit(-1);
+    }
+    logFilename = filename;
+  } else {
+    logStream = stderr;
+  }
+
+  if (logWriter)
+    return;
+  for (int i = 0; i < LOG_SLOTS; ++i)
+    logSlots[i].seq = i;
+  enqueuePos = 0;
+  logWriter = new LogWriter();
+  logWriter->start(QThread::LowPriority);
+  atexit(stopLogger);
+}
+
+void stopLogger()
+{
+  LogWriter *writer = logWriter;
+  if (!writer)
+    return;
+  logWriter = 0;
+  writer->stop();
+  // not deleted, as another thread may still be handing it a line
+}
+
+static void writeDirect(char level, const char *msg)
+{
+  fprintf(logStream ? logStream : stderr, "%s %c: %s\n",
+          QDateTime::currentDateTime().toString().toAscii().data(), level, msg);
+  fflush(logStream ? logStream : stderr);
+}
+
+// Queues one slot's worth of text.  Debug lines are dropped when the
+// queue is full; anything else waits for the writer to make room.
+// Returns false if the writer stopped meanwhile.
+static bool enqueue(LogWriter *writer, char level, const char *text, int length)
+{
+  for (;;) {
+    uint pos = (uint) (int) enqueuePos;
+    LogSlot &slot = logSlots[pos & (LOG_SLOTS - 1)];
+    int ahead = wrap((uint) slot.seq.fetchAndAddAcquire(0) - pos);
+    if (ahead == 0) {
+      if (enqueuePos.testAndSetRelaxed(wrap(pos), wrap(pos + 1))) {
+        slot.time = (uint) ::time(0);
+        slot.level = level;
+        slot.length = length;
+        memcpy(slot.text, text, length);
+        slot.seq.fetchAndStoreRelease(wrap(pos + 1));
+
+        // the writer sleeps through debug lines, unless they pile up
+        if (level != 'D' || (pos & (LOG_SLOTS / 2 - 1)) == 0)
+          writer->wake();
+        return true;
+      }
+    } else if (ahead < 0) {
+      // the writer has not freed this slot: the queue is full
+      if (level == 'D') {
+        droppedLines.ref();
+        return true;
+      }
+      if (logWriter != writer)
+        return false;
+      writer->wake();
+      QThread::yieldCurrentThread();
+    }
+    // another thread took this position first
+  }
+}
+
+// Without a writer, as before initLogger or after stopLogger,
+// lines are written straight away.
+// A debug line longer than a slot is cut short, and says so; longer
+// warnings go on in further slots, each marked '+'.
+static void logLine(char level, const char *msg)
+{
+  LogWriter *writer = logWriter;
+  if (!writer) {
+    writeDirect(level, msg);
+    return;
+  }
+
+  int length = strlen(msg);
+  if (length > LOG_LINE_BYTES && level == 'D') {
+    char text[LOG_LINE_BYTES];
+    int kept = LOG_LINE_BYTES - LOG_CUT_MARK_BYTES;
+    memcpy(text, msg, kept);
+    kept += qsnprintf(text + kept, LOG_CUT_MARK_BYTES, " [cut %d bytes]", length - kept);
+    enqueue(writer, level, text, kept);
+    return;
+  }
+
+  int done = 0;
+  do {
+    int part = qMin(length - done, LOG_LINE_BYTES);
+    if (!enqueue(writer, done == 0 ? level : '+', msg + done, part)) {
+      writeDirect(level, msg + done);
+      return;
+    }
+    done += part;
+  } while (done < length);
+}
+
+void outputHandler(QtMsgType type, const char *msg)
+{
+  switch(type) {
+  case QtDebugMsg:
+    if (debug)
+      logLine('D', msg);
+    break;
+  case QtWarningMsg:
+    logLine('I', msg);
+    break;
+  case QtCriticalMsg:
+    logLine('C', msg);
+    break;
+  case QtFatalMsg:
+    stopLogger();
+    logLine('F', msg);
+    exit(-1);
+  }
+}
+
+void LogWriter::stop()
+{
+  m_stopping.fetchAndStoreRelease(1);
+  wake();
+  wait();
+}
+
+void LogWriter::run()
+{
+  while (!m_stopping.fetchAndAddAcquire(0)) {
+    m_lock.lock();
+    m_wake.wait(&m_lock, LOG_FLUSH_MSEC);
+    m_lock.unlock();
+    drain();
+  }
+  drain();
+}
+
+void LogWriter::drain()
+{
+  int lines = 0;
+  for (;;) {
+    LogSlot &slot = logSlots[m_dequeuePos & (LOG_SLOTS - 1)];
+    if (slot.seq.fetchAndAddAcquire(0) != wrap(m_dequeuePos + 1))
+      break;
+    writeLine(slot.time, slot.level, slot.text, slot.length);
+    slot.seq.fetchAndStoreRelease(wrap(m_dequeuePos + LOG_SLOTS));
+    ++m_dequeuePos;
+    ++lines;
+  }
+
+  int dropped = droppedLines.fetchAndStoreRelaxed(0);
+  if (dropped > 0) {
+    QByteArray note = "log queue full, dropped " + QByteArray::number(dropped) + " debug lines";
+    writeLine((uint) ::time(0), 'I', note.constData(), note.size());
+    ++lines;
+  }
+
+  if (lines == 0)
+    return;
+  fwrite(m_batch.constData(), 1, m_batch.size(), logStream);
+  fflush(logStream);
+  m_batch.clear();
+  if (!logFilename.isEmpty() && ftell(logStream) > LOG_ROTATE_BYTES)
+    rotate();
+}
+
+void LogWriter::writeLine(uint time, char level, const char *text, int length)
+{
+  if (time != m_cachedTime) {
+    m_cachedTime = time;
+    m_cachedStamp = QDateTime::fromTime_t(time).toString().toAscii();
+  }
+  m_batch += m_cachedStamp;
+  m_batch += ' ';
+  m_batch += level;
+  m_batch += ": ";
+  m_batch.append(text, length);
+  m_batch += '\n';
+}
+
+// keeps one old log, <name>.1
+void LogWriter::rotate()
+{
+  QByteArray name = QFile::encodeName(logFilename);
+  QByteArray old = name + ".1";
+  fclose(logStream);
+  ::rename(name.constData(), old.constData());
+  logStream = fopen(name.constData(), "a");
+  if (logStream == NULL) {
+    logStream = stderr;
+    logFilename.clear();
+    fprintf(stderr, "Could not reopen log file %s after rotating.\n", name.constData());
+  }
+}
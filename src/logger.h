@@ -0,0 +1,73 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LOGGER_H_
+#define LOGGER_H_
+
+#include <stdio.h>
+
+#include <QtCore>
+
+extern bool debug;
+extern FILE *logStream;
+
+// Parts of mole whose debug output can be turned on by themselves.
+enum LogCategory {
+  GENERAL_LOG,
+  // ScanQueue, for each reading and scan
+  SCAN_LOG,
+  // Localizer picking candidate areas and spaces
+  LOCALIZE_LOG,
+  // the score of each candidate space
+  SCORE_LOG,
+  MAP_LOG,
+  NETWORK_LOG,
+  SERVER_LOG,
+  LOG_CATEGORIES
+};
+
+// bit per LogCategory, all by default
+extern quint32 debugCategories;
+
+inline bool debugEnabled(LogCategory category)
+{
+  return debug && (debugCategories & (1 << category));
+}
+
+// Like qDebug(), but the arguments are not even formatted unless
+// debug output is on for the category:
+//   moleDebug(SCAN_LOG) << "skipping duplicate mac" << mac;
+#define moleDebug(category) if (!debugEnabled(category)) {} else qDebug()
+
+// Takes names such as "scan,score"; false if one is unknown.
+bool setDebugCategories(const QString &names);
+// for usage messages
+QString logCategoryNames();
+
+// Messages are queued without locking and written out in batches by a
+// writer thread, so logging does not wait on the disk.  When the queue
+// is full, debug lines are dropped and other lines wait.  A log file is
+// rotated to <name>.1 once it outgrows LOG_ROTATE_BYTES.  NULL logs to
+// stderr.  Call after any fork, as the writer thread would not survive it.
+void initLogger(const char *logFilename);
+// Writes out what is queued and stops the writer; also run at exit.
+void stopLogger();
+void outputHandler(QtMsgType type, const char *msg);
+
+const long LOG_ROTATE_BYTES = 16 * 1024 * 1024;
+
+#endif /* LOGGER_H_ */
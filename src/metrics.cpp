@@ -0,0 +1,208 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "metrics.h"
+
+#include <unistd.h>
+
+// upper bounds of the exported histogram buckets, in seconds
+const double LATENCY_BOUNDS[] = {
+  0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005,
+  0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+  0.1, 0.25, 0.5, 1., 2.5, 5., 10.
+};
+const int LATENCY_BOUND_COUNT = sizeof(LATENCY_BOUNDS) / sizeof(LATENCY_BOUNDS[0]);
+
+Q_GLOBAL_STATIC(MetricsRegistry, globalMetrics)
+
+MetricsRegistry *metrics()
+{
+  return globalMetrics();
+}
+
+// replies are minutes apart, so looking the counters up each time is fine
+void countServerReply(const char *request, const char *result)
+{
+  metrics()->counter
+    ("mole_server_replies", "Replies from the map server.",
+     QString("request=\"%1\",result=\"%2\"").arg(request).arg(result))->increment();
+}
+
+MetricsRegistry::~MetricsRegistry()
+{
+  foreach (const Family &family, m_families) {
+    qDeleteAll(family.counters);
+    qDeleteAll(family.gauges);
+    qDeleteAll(family.histograms);
+  }
+}
+
+MetricsRegistry::Family &MetricsRegistry::family(const QString &name, Type type,
+                                                 const QString &help)
+{
+  if (!m_families.contains(name)) {
+    Family family;
+    family.type = type;
+    family.help = help;
+    m_families.insert(name, family);
+  }
+  Family &family = m_families[name];
+  if (family.type != type)
+    qWarning() << "metric" << name << "registered with two types";
+  return family;
+}
+
+Counter *MetricsRegistry::counter(const QString &name, const QString &help,
+                                  const QString &labels)
+{
+  QMutexLocker locker (&m_lock);
+  Family &f = family(name, COUNTER, help);
+  if (!f.counters.contains(labels))
+    f.counters.insert(labels, new Counter());
+  return f.counters.value(labels);
+}
+
+Gauge *MetricsRegistry::gauge(const QString &name, const QString &help,
+                              const QString &labels)
+{
+  QMutexLocker locker (&m_lock);
+  Family &f = family(name, GAUGE, help);
+  if (!f.gauges.contains(labels))
+    f.gauges.insert(labels, new Gauge());
+  return f.gauges.value(labels);
+}
+
+LatencyHistogram *MetricsRegistry::histogram(const QString &name, const QString &help,
+                                             const QString &labels)
+{
+  QMutexLocker locker (&m_lock);
+  Family &f = family(name, HISTOGRAM, help);
+  if (!f.histograms.contains(labels))
+    f.histograms.insert(labels, new LatencyHistogram());
+  return f.histograms.value(labels);
+}
+
+// {labels,extra}, or nothing for neither
+QByteArray labelSet(const QString &labels, const QByteArray &extra = QByteArray())
+{
+  QByteArray set = labels.toUtf8();
+  if (!extra.isEmpty()) {
+    if (!set.isEmpty())
+      set += ',';
+    set += extra;
+  }
+  if (set.isEmpty())
+    return set;
+  return '{' + set + '}';
+}
+
+void appendHistogram(QByteArray &out, const QByteArray &name, const QString &labels,
+                     const LatencyHistogram *histogram)
+{
+  // one copy, so the buckets, count and sum agree
+  // even while other threads record
+  QVector<int> counts;
+  histogram->snapshot(counts);
+
+  qint64 total = 0;
+  double sum = 0.;
+  int bound = 0;
+  for (int i = 0; i < counts.size(); ++i) {
+    double seconds = LatencyHistogram::bucketMiddle(i) / 1e9;
+    while (bound < LATENCY_BOUND_COUNT && seconds > LATENCY_BOUNDS[bound]) {
+      out += name + "_bucket" +
+        labelSet(labels, "le=\"" + QByteArray::number(LATENCY_BOUNDS[bound]) + '"') +
+        ' ' + QByteArray::number(total) + '\n';
+      ++bound;
+    }
+    total += counts.at(i);
+    sum += counts.at(i) * seconds;
+  }
+  for (; bound < LATENCY_BOUND_COUNT; ++bound) {
+    out += name + "_bucket" +
+      labelSet(labels, "le=\"" + QByteArray::number(LATENCY_BOUNDS[bound]) + '"') +
+      ' ' + QByteArray::number(total) + '\n';
+  }
+  out += name + "_bucket" + labelSet(labels, "le=\"+Inf\"") + ' ' + QByteArray::number(total) + '\n';
+  out += name + "_count" + labelSet(labels) + ' ' + QByteArray::number(total) + '\n';
+  out += name + "_sum" + labelSet(labels) + ' ' + QByteArray::number(sum) + '\n';
+}
+
+// from /proc, 0 where there is none
+qint64 residentBytes()
+{
+  QFile statm ("/proc/self/statm");
+  if (!statm.open(QIODevice::ReadOnly))
+    return 0;
+  QList<QByteArray> fields = statm.readAll().split(' ');
+  if (fields.size() < 2)
+    return 0;
+  return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+}
+
+QByteArray MetricsRegistry::openMetrics() const
+{
+  QByteArray out;
+  QMutexLocker locker (&m_lock);
+
+  QMapIterator<QString,Family> f (m_families);
+  while (f.hasNext()) {
+    f.next();
+    QByteArray name = f.key().toUtf8();
+    const Family &family = f.value();
+    QByteArray help = family.help.toUtf8();
+    help.replace('\\', "\\\\").replace('\n', "\\n");
+
+    switch (family.type) {
+    case COUNTER: {
+      out += "# TYPE " + name + " counter\n# HELP " + name + ' ' + help + '\n';
+      QMapIterator<QString,Counter*> i (family.counters);
+      while (i.hasNext()) {
+        i.next();
+        out += name + "_total" + labelSet(i.key()) + ' ' +
+          QByteArray::number(i.value()->value()) + '\n';
+      }
+      break;
+    }
+    case GAUGE: {
+      out += "# TYPE " + name + " gauge\n# HELP " + name + ' ' + help + '\n';
+      QMapIterator<QString,Gauge*> i (family.gauges);
+      while (i.hasNext()) {
+        i.next();
+        out += name + labelSet(i.key()) + ' ' +
+          QByteArray::number(i.value()->value()) + '\n';
+      }
+      break;
+    }
+    case HISTOGRAM: {
+      out += "# TYPE " + name + " histogram\n# HELP " + name + ' ' + help + '\n';
+      QMapIterator<QString,LatencyHistogram*> i (family.histograms);
+      while (i.hasNext()) {
+        i.next();
+        appendHistogram(out, name, i.key(), i.value());
+      }
+      break;
+    }
+    }
+  }
+
+  out += "# TYPE process_resident_memory_bytes gauge\n"
+    "# HELP process_resident_memory_bytes Resident memory size in bytes.\n"
+    "process_resident_memory_bytes " + QByteArray::number(residentBytes()) + '\n';
+  out += "# EOF\n";
+  return out;
+}
@@ -0,0 +1,114 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <QtCore>
+
+#include "latencyHistogram.h"
+
+// Counters and gauges are 64 bits wide, as byte counts outgrow Qt 4's
+// 32 bit QAtomicInt; they use the gcc atomic builtins instead.
+
+// Only ever goes up.  OpenMetrics names its sample <name>_total.
+class Counter
+{
+ public:
+  Counter() : m_value(0) {}
+
+  void increment(qint64 n = 1) { __sync_fetch_and_add(&m_value, n); }
+  qint64 value() const { return __sync_fetch_and_add(&m_value, 0); }
+
+ private:
+  mutable volatile qint64 m_value;
+
+  Q_DISABLE_COPY(Counter)
+};
+
+class Gauge
+{
+ public:
+  Gauge() : m_value(0) {}
+
+  void set(qint64 value) { __sync_lock_test_and_set(&m_value, value); }
+  void add(qint64 n) { __sync_fetch_and_add(&m_value, n); }
+  qint64 value() const { return __sync_fetch_and_add(&m_value, 0); }
+
+ private:
+  mutable volatile qint64 m_value;
+
+  Q_DISABLE_COPY(Gauge)
+};
+
+// The process's counters, gauges and latency histograms, served by
+// LocalServer as GET /metrics in OpenMetrics text format.
+//
+// A subsystem looks its metrics up once, usually when it is built, and
+// keeps the pointers; updating a metric is then one atomic operation,
+// cheap enough for the scan path and safe from any thread.  Metrics
+// live as long as the process, so the same name and labels always give
+// the same metric, shared by everyone who asks for it.
+//
+// Labels are given already formatted, as in: stage="Score",result="ok"
+class MetricsRegistry
+{
+ public:
+  MetricsRegistry() {}
+  ~MetricsRegistry();
+
+  Counter *counter(const QString &name, const QString &help, const QString &labels = QString());
+  Gauge *gauge(const QString &name, const QString &help, const QString &labels = QString());
+  // latencies, exported in seconds
+  LatencyHistogram *histogram(const QString &name, const QString &help,
+                              const QString &labels = QString());
+
+  QByteArray openMetrics() const;
+
+ private:
+  enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+  class Family
+  {
+   public:
+    Type type;
+    QString help;
+    // by labels
+    QMap<QString,Counter*> counters;
+    QMap<QString,Gauge*> gauges;
+    QMap<QString,LatencyHistogram*> histograms;
+  };
+
+  mutable QMutex m_lock;
+  QMap<QString,Family> m_families;
+
+  Family &family(const QString &name, Type type, const QString &help);
+
+  Q_DISABLE_COPY(MetricsRegistry)
+};
+
+// the registry every subsystem registers into
+MetricsRegistry *metrics();
+
+// Counts a reply from the map server.
+// request: areas, map, bind or proximity; result: ok, error or not_modified
+// Bytes and timings are in NetworkTelemetry.
+void countServerReply(const char *request, const char *result);
+
+const char OPENMETRICS_CONTENT_TYPE[] = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+#endif /* METRICS_H_ */
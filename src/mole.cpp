@@ -18,6 +18,9 @@
 #include "mole.h"
 
 #include <csignal>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 QString MOLE_ORGANIZATION = "Nokia";
 QString MOLE_APPLICATION  = "moled";
@@ -47,21 +50,39 @@ QSettings *settings;
 QNetworkAccessManager *networkAccessManager;
 QNetworkConfigurationManager *networkConfigurationManager;
 
-struct CleanExit{
-  CleanExit()
-  {
-    signal(SIGINT, &CleanExit::exitQt);
-    signal(SIGTERM, &CleanExit::exitQt);
-    signal(SIGHUP, &CleanExit::exitQt);
-  }
+int CleanExit::s_fds[2];
 
-  static void exitQt(int /*sig*/)
-  {
-    fprintf(logStream, "%s I: Exiting\n", QDateTime::currentDateTime().toString().toAscii().data());
-    fclose(logStream);
-    QCoreApplication::exit(0);
-  }
-};
+CleanExit::CleanExit(QObject *parent)
+  : QObject(parent)
+{
+  if (::socketpair(AF_UNIX, SOCK_STREAM, 0, s_fds) != 0)
+    qFatal("could not create exit signal socket pair");
+  // the handler must never block
+  ::fcntl(s_fds[0], F_SETFL, ::fcntl(s_fds[0], F_GETFL) | O_NONBLOCK);
+  m_notifier = new QSocketNotifier(s_fds[1], QSocketNotifier::Read, this);
+  connect(m_notifier, SIGNAL(activated(int)), SLOT(handleSignal()));
+
+  signal(SIGINT, &CleanExit::signalHandler);
+  signal(SIGTERM, &CleanExit::signalHandler);
+  signal(SIGHUP, &CleanExit::signalHandler);
+}
+
+void CleanExit::signalHandler(int)
+{
+  char c = 1;
+  // a full socket already has an exit pending
+  if (::write(s_fds[0], &c, sizeof(c)) != sizeof(c))
+    return;
+}
+
+void CleanExit::handleSignal()
+{
+  char c;
+  if (::read(s_fds[1], &c, sizeof(c)) != sizeof(c))
+    return;
+  qWarning("Exiting");
+  QCoreApplication::exit(0);
+}
 
 void initSettings()
 {
@@ -100,7 +121,7 @@ void initCommon(QObject *parent, const char* logFilename)
 
   // Set up shutdown handler
   initLogger(logFilename);
-  CleanExit cleanExit;
+  new CleanExit(parent);
   qInstallMsgHandler(outputHandler);
 
   networkAccessManager = new QNetworkAccessManager(parent);
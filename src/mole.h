@@ -49,4 +49,24 @@ extern QNetworkConfigurationManager *networkConfigurationManager;
 void initSettings();
 void initCommon(QObject *parent, const char* logFilename);
 
+// SIGINT, SIGTERM and SIGHUP quit the event loop.  The handler only
+// writes a byte to a socket, as in TraceDumpSignal; the logging and
+// the quitting happen on the event loop.
+class CleanExit : public QObject
+{
+  Q_OBJECT
+
+ public:
+  CleanExit(QObject *parent = 0);
+
+ private slots:
+  void handleSignal();
+
+ private:
+  QSocketNotifier *m_notifier;
+
+  static int s_fds[2];
+  static void signalHandler(int);
+};
+
 #endif /* MOLE_H_ */
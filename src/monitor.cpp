@@ -0,0 +1,129 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "monitor.h"
+
+Monitor::Monitor()
+  : encoding(JSON_ENCODING)
+  , hasPending(false)
+  , sent(0)
+  , dropped(0)
+  , m_delta(false)
+  , m_intervalMsec(0)
+  , m_deltasSinceSnapshot(0)
+{
+}
+
+bool Monitor::setParams(const QVariantMap &params, QString &error)
+{
+  if (params.contains("fields")) {
+    m_fields = params["fields"].toStringList();
+    foreach (const QString &field, m_fields) {
+      QString top = field.section('.', 0, 0);
+      if (top != "estimate" && top != "stats") {
+        error = "Error: unknown monitor field " + field;
+        return false;
+      }
+    }
+  }
+  if (params.contains("interval")) {
+    bool ok;
+    m_intervalMsec = params["interval"].toInt(&ok);
+    if (!ok || m_intervalMsec < 0) {
+      error = "Error: bad monitor interval";
+      return false;
+    }
+  }
+  if (params.contains("delta")) {
+    m_delta = params["delta"].toBool();
+  }
+  return true;
+}
+
+QVariantMap Monitor::filter(const QVariantMap &update) const
+{
+  if (m_fields.isEmpty())
+    return update;
+
+  QVariantMap view;
+  foreach (const QString &field, m_fields) {
+    QString top = field.section('.', 0, 0);
+    QString name = field.section('.', 1);
+    if (name.isEmpty()) {
+      view.insert(top, update.value(top));
+    } else {
+      QVariantMap part = view.value(top).toMap();
+      part.insert(name, update.value(top).toMap().value(name));
+      view.insert(top, part);
+    }
+  }
+  return view;
+}
+
+int Monitor::msecUntilDue() const
+{
+  if (m_intervalMsec == 0 || !m_lastWrite.isValid())
+    return 0;
+  return qMax((qint64)0, m_intervalMsec - m_lastWrite.elapsed());
+}
+
+// Keys that changed or appeared, nested maps compared key by key.
+// Keys that went away are sent as null.
+static QVariantMap diffMaps(const QVariantMap &before, const QVariantMap &after)
+{
+  QVariantMap diff;
+  QMapIterator<QString,QVariant> it (after);
+  while (it.hasNext()) {
+    it.next();
+    const QVariant old = before.value(it.key());
+    if (it.value().type() == QVariant::Map && old.type() == QVariant::Map) {
+      QVariantMap part = diffMaps(old.toMap(), it.value().toMap());
+      if (!part.isEmpty())
+        diff.insert(it.key(), part);
+    } else if (!before.contains(it.key()) || old != it.value()) {
+      diff.insert(it.key(), it.value());
+    }
+  }
+  QMapIterator<QString,QVariant> gone (before);
+  while (gone.hasNext()) {
+    gone.next();
+    if (!after.contains(gone.key()))
+      diff.insert(gone.key(), QVariant());
+  }
+  return diff;
+}
+
+QByteArray Monitor::encode(const QVariantMap &view)
+{
+  if (!m_delta)
+    return encodeVariant(view, encoding);
+
+  if (m_lastView.isEmpty() || m_deltasSinceSnapshot >= MONITOR_SNAPSHOT_UPDATES) {
+    m_lastView = view;
+    m_deltasSinceSnapshot = 0;
+    return encodeVariant(view, encoding);
+  }
+
+  QVariantMap diff = diffMaps(m_lastView, view);
+  if (diff.isEmpty())
+    return QByteArray();
+
+  m_lastView = view;
+  ++m_deltasSinceSnapshot;
+  diff.insert("delta", true);
+  return encodeVariant(diff, encoding);
+}
@@ -0,0 +1,73 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONITOR_H_
+#define MONITOR_H_
+
+#include <QtCore>
+
+#include "encoding.h"
+
+// A monitor's socket may hold this many bytes of unsent updates.
+// Past that, only the latest update is kept until the socket drains,
+// so a stuck reader costs at most this plus one update.
+const qint64 MAX_MONITOR_BACKLOG = 16*1024;
+
+// Delta monitors get a full snapshot after this many deltas.
+const int MONITOR_SNAPSHOT_UPDATES = 30;
+
+// One monitor subscription, see Localizer::emitEstimateToMonitors.
+// Updates are the map from Localizer::estimateAndStatsAsMap.
+class Monitor
+{
+ public:
+  Monitor();
+
+  // Reads the optional monitor request params:
+  // "fields": e.g. ["estimate"] or ["estimate.space", "stats.ScanRate"],
+  // "interval": minimum msec between updates,
+  // "delta": send only what changed since the last update.
+  bool setParams(const QVariantMap &params, QString &error);
+
+  // plain monitors all get the same bytes for the same encoding
+  bool isPlain() const { return m_fields.isEmpty() && !m_delta; }
+  QVariantMap filter(const QVariantMap &update) const;
+  // msec before the next update may be written
+  int msecUntilDue() const;
+  // Encodes the next update, as a delta if asked for.
+  // Returns an empty array if nothing changed.
+  QByteArray encode(const QVariantMap &view);
+  void written() { m_lastWrite.start(); ++sent; }
+
+  Encoding encoding;
+  // latest update that has not been written yet
+  QVariantMap pending;
+  bool hasPending;
+  quint32 sent;
+  quint32 dropped;
+
+ private:
+  QStringList m_fields;
+  bool m_delta;
+  int m_intervalMsec;
+  QElapsedTimer m_lastWrite;
+  // what the client has seen, for deltas
+  QVariantMap m_lastView;
+  int m_deltasSinceSnapshot;
+};
+
+#endif /* MONITOR_H_ */
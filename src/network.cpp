@@ -23,8 +23,6 @@
 
 void setNetworkRequestHeaders(QNetworkRequest &request)
 {
-  request.setRawHeader("Create-Stamp", (QTime::currentTime()).toString().toAscii());
-
   QString agent = "moled/";
   agent.append(MOLE_VERSION);
 
@@ -50,28 +48,3 @@ void setNetworkRequestHeaders(QNetworkRequest &request)
 
   qDebug() << "setting network request header...";
 }
-
-int findReplyLatencyMsec(QNetworkReply *reply)
-{
-  QNetworkRequest request = reply->request();
-
-  if (request.hasRawHeader("Create-Stamp")) {
-    QVariant header = request.rawHeader("Create-Stamp");
-    QTime sendTime = QTime::fromString(header.toString());
-
-    qDebug() << " raw sendTime " << sendTime.toString();
-
-    int elapsed = sendTime.elapsed();
-
-    // Because we are using QTime, we could potentially get very large
-    // values if midnight occurs in between sending and receiving, so
-    // this screens out those values
-    if (elapsed > 0 && elapsed < (10 * 60 * 1000)) {
-      qDebug() << "URL elapsed " << elapsed;
-      return elapsed;
-    }
-  }
-  return -1;
-}
-
-
@@ -22,6 +22,5 @@
 #include <QNetworkRequest>
 
 void setNetworkRequestHeaders(QNetworkRequest &request);
-int findReplyLatencyMsec(QNetworkReply *reply);
 
 #endif /* NETWORK_H_ */
@@ -0,0 +1,170 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "networkTelemetry.h"
+#include "metrics.h"
+
+const int MAX_BACKOFF_DOUBLINGS = 4;
+
+const char *networkEndpointName(NetworkEndpoint endpoint)
+{
+  switch (endpoint) {
+  case AREAS_ENDPOINT:
+    return "getAreas";
+  case MAP_ENDPOINT:
+    return "map";
+  case BIND_ENDPOINT:
+    return "bind";
+  case PROXIMITY_ENDPOINT:
+    return "proximity";
+  default:
+    return "unknown";
+  }
+}
+
+Q_GLOBAL_STATIC(NetworkTelemetry, globalNetworkTelemetry)
+
+NetworkTelemetry *networkTelemetry()
+{
+  return globalNetworkTelemetry();
+}
+
+int replyLatencyMsec(QNetworkReply *reply)
+{
+  RequestTimer *timer = reply->findChild<RequestTimer *>();
+  return timer ? timer->totalMsec() : -1;
+}
+
+RequestTimer::RequestTimer(QNetworkReply *reply, NetworkEndpoint endpoint)
+  : QObject(reply)
+  , m_endpoint(endpoint)
+  , m_firstByteNsec(-1)
+  , m_totalNsec(-1)
+  , m_bytesOut(0)
+  , m_bytesIn(0)
+  , m_status(0)
+{
+  m_timer.start();
+  connect(reply, SIGNAL(metaDataChanged()), SLOT(handleFirstByte()));
+  connect(reply, SIGNAL(readyRead()), SLOT(handleFirstByte()));
+  connect(reply, SIGNAL(uploadProgress(qint64,qint64)),
+          SLOT(handleUploadProgress(qint64,qint64)));
+  connect(reply, SIGNAL(downloadProgress(qint64,qint64)),
+          SLOT(handleDownloadProgress(qint64,qint64)));
+  connect(reply, SIGNAL(finished()), SLOT(handleFinished()));
+}
+
+void RequestTimer::handleFirstByte()
+{
+  if (m_firstByteNsec < 0)
+    m_firstByteNsec = m_timer.nsecsElapsed();
+}
+
+void RequestTimer::handleUploadProgress(qint64 sent, qint64 /*total*/)
+{
+  m_bytesOut = sent;
+}
+
+void RequestTimer::handleDownloadProgress(qint64 received, qint64 /*total*/)
+{
+  m_bytesIn = received;
+}
+
+void RequestTimer::handleFinished()
+{
+  if (m_totalNsec >= 0)
+    return;
+  m_totalNsec = m_timer.nsecsElapsed();
+
+  QNetworkReply *reply = qobject_cast<QNetworkReply *>(parent());
+  QVariant status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+  if (!status.isNull())
+    m_status = status.toInt();
+  // a reply read before finished() leaves nothing available
+  m_bytesIn = qMax(m_bytesIn, reply->bytesAvailable());
+
+  moleDebug(NETWORK_LOG) << "request" << networkEndpointName(m_endpoint) << "status" << m_status
+                         << "first byte msec" << firstByteMsec() << "total msec" << totalMsec()
+                         << "bytes out" << m_bytesOut << "in" << m_bytesIn;
+
+  networkTelemetry()->finished(this);
+}
+
+NetworkTelemetry::NetworkTelemetry()
+{
+  for (int i = 0; i < NETWORK_ENDPOINTS; ++i) {
+    QString endpoint = QString("endpoint=\"%1\"").arg(networkEndpointName((NetworkEndpoint) i));
+    const QString latencyHelp = "Time taken by requests to the map server.";
+    const QString bytesHelp = "Bytes sent to and received from the map server.";
+
+    Endpoint &e = m_endpoints[i];
+    e.failures = 0;
+    e.inFlight = metrics()->gauge
+      ("mole_network_in_flight", "Requests to the map server awaiting a reply.", endpoint);
+    e.firstByte = metrics()->histogram
+      ("mole_network_latency_seconds", latencyHelp, endpoint + ",phase=\"first_byte\"");
+    e.total = metrics()->histogram
+      ("mole_network_latency_seconds", latencyHelp, endpoint + ",phase=\"total\"");
+    e.bytesOut = metrics()->counter
+      ("mole_network_bytes", bytesHelp, endpoint + ",direction=\"out\"");
+    e.bytesIn = metrics()->counter
+      ("mole_network_bytes", bytesHelp, endpoint + ",direction=\"in\"");
+    e.retries = metrics()->counter
+      ("mole_network_retries", "Requests to the map server sent again after failing.", endpoint);
+  }
+}
+
+RequestTimer *NetworkTelemetry::watch(QNetworkReply *reply, NetworkEndpoint endpoint)
+{
+  m_endpoints[endpoint].inFlight->add(1);
+  return new RequestTimer(reply, endpoint);
+}
+
+void NetworkTelemetry::retried(NetworkEndpoint endpoint)
+{
+  m_endpoints[endpoint].retries->increment();
+}
+
+int NetworkTelemetry::backoffMsec(NetworkEndpoint endpoint, int msec) const
+{
+  return msec << qMin(m_endpoints[endpoint].failures, MAX_BACKOFF_DOUBLINGS);
+}
+
+void NetworkTelemetry::finished(const RequestTimer *timer)
+{
+  Endpoint &e = m_endpoints[timer->m_endpoint];
+  e.inFlight->add(-1);
+
+  // the server answering at all, even with a 404, is not a failure
+  if (timer->status() == 0 || timer->status() >= 500) {
+    ++e.failures;
+  } else {
+    e.failures = 0;
+  }
+
+  if (timer->m_firstByteNsec >= 0)
+    e.firstByte->record(timer->m_firstByteNsec);
+  e.total->record(timer->m_totalNsec);
+  e.bytesOut->increment(timer->m_bytesOut);
+  e.bytesIn->increment(timer->m_bytesIn);
+
+  QString status = timer->status() == 0 ? QString("none") : QString::number(timer->status());
+  metrics()->counter
+    ("mole_network_responses", "Replies from the map server by HTTP status.",
+     QString("endpoint=\"%1\",status=\"%2\"")
+     .arg(networkEndpointName(timer->m_endpoint)).arg(status))->increment();
+}
@@ -0,0 +1,128 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NETWORK_TELEMETRY_H_
+#define NETWORK_TELEMETRY_H_
+
+#include <QElapsedTimer>
+#include <QNetworkReply>
+
+class Counter;
+class Gauge;
+class LatencyHistogram;
+
+// The kinds of request sent to the map server.
+enum NetworkEndpoint {
+  // Localizer::fillAreaCache
+  AREAS_ENDPOINT,
+  // Localizer::requestAreaMap
+  MAP_ENDPOINT,
+  // Binder::xmitBind
+  BIND_ENDPOINT,
+  // Proximity::update
+  PROXIMITY_ENDPOINT,
+  NETWORK_ENDPOINTS
+};
+
+const char *networkEndpointName(NetworkEndpoint endpoint);
+
+// Times one request, from when it is sent until its reply has finished,
+// and counts its bytes both ways.  Qt does not say when the name lookup
+// and connect are done, so the first phase seen is the first byte:
+// the reply's headers arriving.
+//
+// Made by NetworkTelemetry::watch, as a child of the reply.
+class RequestTimer : public QObject
+{
+  Q_OBJECT
+
+ public:
+  RequestTimer(QNetworkReply *reply, NetworkEndpoint endpoint);
+
+  NetworkEndpoint endpoint() const { return m_endpoint; }
+  // -1 until known
+  int firstByteMsec() const { return m_firstByteNsec < 0 ? -1 : m_firstByteNsec / 1000000; }
+  int totalMsec() const { return m_totalNsec < 0 ? -1 : m_totalNsec / 1000000; }
+  // HTTP status of the reply, 0 if none arrived
+  int status() const { return m_status; }
+
+ private slots:
+  void handleFirstByte();
+  void handleUploadProgress(qint64 sent, qint64 total);
+  void handleDownloadProgress(qint64 received, qint64 total);
+  void handleFinished();
+
+ private:
+  friend class NetworkTelemetry;
+
+  NetworkEndpoint m_endpoint;
+  QElapsedTimer m_timer;
+  qint64 m_firstByteNsec;
+  qint64 m_totalNsec;
+  qint64 m_bytesOut;
+  qint64 m_bytesIn;
+  int m_status;
+};
+
+// What the requests to each endpoint have been doing.  Timings, bytes,
+// statuses, retries and requests in flight go into the metrics registry;
+// failures in a row are kept here for deciding when to send the next
+// request.  All requests are sent from the main thread.
+class NetworkTelemetry
+{
+ public:
+  NetworkTelemetry();
+
+  // Call right after sending and before connecting to the reply's
+  // finished(), so the timings are known when the reply is handled.
+  RequestTimer *watch(QNetworkReply *reply, NetworkEndpoint endpoint);
+  // the same request sent again after it failed
+  void retried(NetworkEndpoint endpoint);
+
+  // replies with no HTTP status or a server error
+  int failures(NetworkEndpoint endpoint) const { return m_endpoints[endpoint].failures; }
+  // msec, doubled for each failure in a row, up to 16 times
+  int backoffMsec(NetworkEndpoint endpoint, int msec) const;
+
+ private:
+  friend class RequestTimer;
+
+  class Endpoint
+  {
+   public:
+    int failures;
+    Gauge *inFlight;
+    LatencyHistogram *firstByte;
+    LatencyHistogram *total;
+    Counter *bytesOut;
+    Counter *bytesIn;
+    Counter *retries;
+  };
+
+  Endpoint m_endpoints[NETWORK_ENDPOINTS];
+
+  void finished(const RequestTimer *timer);
+
+  Q_DISABLE_COPY(NetworkTelemetry)
+};
+
+NetworkTelemetry *networkTelemetry();
+
+// total msec of a watched reply, -1 if it was not watched
+int replyLatencyMsec(QNetworkReply *reply);
+
+#endif /* NETWORK_TELEMETRY_H_ */
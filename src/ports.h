@@ -20,6 +20,10 @@
 
 #define DEFAULT_LOCAL_HOST          "localhost"
 #define DEFAULT_LOCAL_PORT          4411
+#define DEFAULT_LOCAL_SOCKET        "/var/run/mole.sock"
+// a daemon not run as root listens on this in $XDG_RUNTIME_DIR
+#define USER_LOCAL_SOCKET           "mole.sock"
+#define DEFAULT_LOCAL_SOCKET_MODE   0660
 #define DEFAULT_SCANNER_DAEMON_PORT 5950
 
 #endif /* MOLE_PORTS_H_ */
@@ -77,6 +77,7 @@ void Proximity::update() {
   setNetworkRequestHeaders(request);
 
   QNetworkReply *reply = networkAccessManager->post(request, json);
+  networkTelemetry()->watch(reply, PROXIMITY_ENDPOINT);
   connect(reply, SIGNAL(finished()), SLOT (handleUpdateResponse()));
   qDebug() << "P: sent update";
 
@@ -91,9 +92,11 @@ void Proximity::handleUpdateResponse()
     qWarning() << "P: handleUpdateResponse request failed "
                << reply->errorString()
                << " url " << reply->url();
+    countServerReply("proximity", "error");
   } else {
 
     QByteArray rawJson = reply->readAll();
+    countServerReply("proximity", "ok");
     QJson::Parser parser;
     bool ok;
     QVariantMap response = parser.parse(rawJson, &ok).toMap();
@@ -111,7 +114,7 @@ void Proximity::handleUpdateResponse()
       //double score = QString::number(it.value().toReal());
       double score = it.value().toDouble();
       proxMap.insert (name, score);
-      qDebug () << "P nearby: " << name << score;
+      moleDebug(NETWORK_LOG) << "P nearby: " << name << score;
     }
 
 #ifdef USE_MOLE_DBUS
@@ -0,0 +1,195 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mole.h"
+#include "util.h"
+#include "replay.h"
+#include "localizer.h"
+#include "scanQueue.h"
+#include "virtualAP.h"
+
+#include <cstdio>
+
+void usage();
+
+Replay::Replay(int argc, char *argv[])
+  : QCoreApplication(argc, argv)
+  , m_localizer(0)
+  , m_scanQueue(0)
+  , m_realTime(false)
+  , m_scoring(false)
+  , m_sessionStart(0)
+  , m_eventCount(0)
+  , m_scanCount(0)
+  , m_out(stdout)
+{
+  // as the daemon runs without a movement detector
+  int maxActiveQueueLength = 12;
+  bool runAllAlgorithms = false;
+  QString tracePath;
+
+  QStringList args = QCoreApplication::arguments();
+  QStringListIterator argsIter(args);
+  argsIter.next(); // mole-replay
+
+  while (argsIter.hasNext()) {
+    QString arg = argsIter.next();
+    if (arg == "-h") {
+      usage();
+    } else if (arg == "-d") {
+      debug = true;
+    } else if (arg == "-r" && argsIter.hasNext()) {
+      rootPathname = argsIter.next();
+    } else if (arg == "-t") {
+      m_realTime = true;
+    } else if (arg == "-q" && argsIter.hasNext()) {
+      maxActiveQueueLength = argsIter.next().toInt();
+    } else if (arg == "-A") {
+      runAllAlgorithms = true;
+    } else if (arg == "-V") {
+      groupVirtualAPs = true;
+    } else if (tracePath.isEmpty() && !arg.startsWith("-")) {
+      tracePath = arg;
+    } else {
+      usage();
+    }
+  }
+  if (tracePath.isEmpty())
+    usage();
+
+  initLogger(NULL);
+  qInstallMsgHandler(outputHandler);
+
+  if (!m_reader.open(tracePath))
+    ::exit(-1);
+
+  // maps come from the map cache under the root path
+  rootDir.setPath(rootPathname);
+  m_localizer = new Localizer(this, runAllAlgorithms);
+  m_localizer->setOffline();
+  m_scanQueue = new ScanQueue(this, m_localizer, maxActiveQueueLength);
+  connect(m_localizer, SIGNAL(scoringIdle()), this, SLOT(handleScoringIdle()));
+
+  m_replayClock.start();
+  m_sessionClock.start();
+  scheduleNext();
+}
+
+Replay::~Replay()
+{
+  delete m_scanQueue;
+  delete m_localizer;
+}
+
+// Reads the next event and runs it straight away, or in real time
+// once as much time has passed as in the recording.
+void Replay::scheduleNext()
+{
+  if (!m_reader.next(m_next)) {
+    finish();
+    return;
+  }
+
+  int delay = 0;
+  if (m_realTime && m_next.type != TRACE_START) {
+    qint64 due = (m_next.msec - m_sessionStart) - m_sessionClock.elapsed();
+    delay = qMax((qint64)0, due);
+  }
+  QTimer::singleShot(delay, this, SLOT(step()));
+}
+
+void Replay::step()
+{
+  ++m_eventCount;
+
+  switch (m_next.type) {
+  case TRACE_START:
+    qDebug() << "replaying session recorded" << m_next.started;
+    m_sessionStart = m_next.msec;
+    m_sessionClock.restart();
+    break;
+  case TRACE_SCAN:
+    foreach (const TraceReading &reading, m_next.readings) {
+      m_scanQueue->addReading(reading.mac, reading.ssid, reading.frequency, reading.strength);
+    }
+    ++m_scanCount;
+    if (m_scanQueue->scanCompleted() && m_localizer->scoringPending()) {
+      m_scoring = true;
+      return;
+    }
+    reportEstimate();
+    break;
+  case TRACE_MOTION:
+    m_scanQueue->handleMotionChange(m_next.motion);
+    break;
+  case TRACE_BIND:
+    m_localizer->bind(m_next.area, m_next.space);
+    break;
+  case TRACE_REMOVE:
+    m_localizer->removeSpace(m_next.area, m_next.space);
+    break;
+  }
+
+  scheduleNext();
+}
+
+void Replay::handleScoringIdle()
+{
+  if (!m_scoring)
+    return;
+  m_scoring = false;
+  reportEstimate();
+  scheduleNext();
+}
+
+// scan number, trace msec, estimated space and its score
+void Replay::reportEstimate()
+{
+  QSharedPointer<const LocalizerSnapshot> snapshot = m_localizer->snapshot();
+  m_out << m_scanCount << '\t' << m_next.msec << '\t'
+        << m_localizer->currentEstimate() << '\t'
+        << snapshot->estimate.value("score").toDouble() << endl;
+}
+
+void Replay::finish()
+{
+  qint64 elapsed = m_replayClock.elapsed();
+  fprintf(stderr, "replayed %d events, %d scans in %lld msec (%.1f scans/sec)\n",
+          m_eventCount, m_scanCount, (long long) elapsed,
+          elapsed > 0 ? m_scanCount * 1000. / elapsed : 0.);
+  QTimer::singleShot(0, this, SLOT(quit()));
+}
+
+int main(int argc, char *argv[])
+{
+  Replay app (argc, argv);
+  return app.exec();
+}
+
+void usage()
+{
+  qCritical() << "mole-replay usage: mole-replay [options] trace\n"
+              << "-h print usage\n"
+              << "-d debug\n"
+              << "-r root path, whose map cache is used [" << DEFAULT_ROOT_PATH << "]\n"
+              << "-t replay in real time (default: as fast as possible)\n"
+              << "-q scans used for localization, 0 to rely on motion events [12]\n"
+              << "-A run all localization algorithms for comparison\n"
+              << "-V group virtual APs (BSSIDs from the same radio)\n";
+
+  exit(0);
+}
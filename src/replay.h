@@ -0,0 +1,68 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+#include "scanTrace.h"
+
+class Localizer;
+class ScanQueue;
+
+// Feeds a scan trace recorded with moled -S through a ScanQueue and
+// Localizer, without a scanner, D-Bus or the network, and prints the
+// estimate after each scan.  Each scan is scored before the next one
+// is fed, so the same trace and maps always give the same estimates.
+class Replay : public QCoreApplication
+{
+  Q_OBJECT
+
+ public:
+  Replay(int argc, char *argv[]);
+  ~Replay();
+
+ private:
+  ScanTraceReader m_reader;
+  Localizer *m_localizer;
+  ScanQueue *m_scanQueue;
+  bool m_realTime;
+
+  TraceEvent m_next;
+  // waiting for the last scan to be scored
+  bool m_scoring;
+  // trace time of the current recording session's start
+  qint64 m_sessionStart;
+  QElapsedTimer m_sessionClock;
+  QElapsedTimer m_replayClock;
+  int m_eventCount;
+  int m_scanCount;
+  QTextStream m_out;
+
+  void scheduleNext();
+  void reportEstimate();
+  void finish();
+
+ private slots:
+  void step();
+  void handleScoringIdle();
+};
+
+#endif /* REPLAY_H_ */
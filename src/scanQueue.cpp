@@ -18,8 +18,12 @@
 #include "scanner.h"
 #include "scanQueue.h"
 
+#include "flightRecorder.h"
 #include "localizer.h"
+#include "logger.h"
+#include "metrics.h"
 #include "scan.h"
+#include "scanTrace.h"
 
 // Implements a circular queue of scans
 // with a fixed number of readings per scan.
@@ -32,20 +36,30 @@
 //const QRegExp LocallyAdministeredMAC ("^.[2367abef]:");
 //const QRegExp MacRegExp ("^[0-9a-f][0-9a-f]:[0-9a-f][0-9a-f]:[0-9a-f][0-9a-f]:[0-9a-f][0-9a-f]:[0-9a-f][0-9a-f]:[0-9a-f][0-9a-f]$");
 
-ScanQueue::ScanQueue(QObject *parent, Localizer *_localizer, int _maxActiveQueueLength, bool _recordScans)
+ScanQueue::ScanQueue(QObject *parent, Localizer *_localizer, int _maxActiveQueueLength, ScanTraceWriter *_trace)
   : QObject(parent)
   , maxActiveQueueLength(_maxActiveQueueLength)
   , m_localizer(_localizer)
   , m_currentScan(0)
   , m_currentReading(0)
   , m_activeScanCount(0)
-  , m_recordScans(_recordScans)
+  , m_trace(_trace)
   , m_seenMacsSize(0)
   , m_responseRateTotal(0)
   , m_movementDetected(false)
+  , m_recentIndex(0)
+  , m_readingCount(metrics()->counter("mole_scan_readings", "Readings the scanner reported."))
+  , m_scanCount(metrics()->counter("mole_scans", "Scans completed with readings."))
+  , m_duplicateScanCount(metrics()->counter("mole_duplicate_scans",
+                                            "Scans dropped as repeats of a recent scan."))
 {
   qDebug() << "ScanQueue maxActiveQueueLength" << maxActiveQueueLength;
 
+  for (int i = 0; i < DUPLICATE_SCAN_HISTORY; ++i) {
+    m_recentDigests[i] = 0;
+    m_recentSizes[i] = 0;
+  }
+
   // init scan queue
   clear(-1);
 
@@ -53,32 +67,25 @@ ScanQueue::ScanQueue(QObject *parent, Localizer *_localizer, int _maxActiveQueue
 
 bool ScanQueue::addReading(QString mac, QString ssid, qint16 frequency, qint8 strength)
 {
-  // virtual AP detection elimination
-
-  /*
-  LEAVING OFF
+  if (m_trace)
+    m_trace->addReading(mac, ssid, frequency, strength);
+  m_readingCount->increment();
 
-  simplest thing to do is to set to zero last digit
-  and only accept the first one that we've seen
-  and include the zeroed value in the sig
-
-  have two piles:
-  nonVirtualAPs, virtualAPs
-  if in either pile, return answer
-  take last digit and make it 0
-
-  keep using original mac (without 0)
-  */
   mac = mac.toLower();
   // TODO convert any - to :
 
   if (m_seenMacs.contains(mac)) {
-    qDebug() << "skipping duplicate mac" << mac;
+    moleDebug(SCAN_LOG) << "skipping duplicate mac" << mac;
   } else if (mac.contains(LocallyAdministeredMAC)) {
-    qDebug() << "dropping locally administered MAC" << mac;
+    moleDebug(SCAN_LOG) << "dropping locally administered MAC" << mac;
   } else if (!mac.contains(MacRegExp)) {
-    qDebug() << "skipping non MAC" << mac;
+    moleDebug(SCAN_LOG) << "skipping non MAC" << mac;
   } else {
+    // if we have just started a new scan, reset its digest
+    if (m_seenMacs.isEmpty())
+      m_scans[m_currentScan].digest = 0;
+    m_scans[m_currentScan].digest += readingDigest(mac, strength);
+
     if (m_currentReading < MAX_SCANQUEUE_READINGS) {
       // stash this reading in the current scan
       // but do not apply it to the fingerprint yet.
@@ -103,12 +110,17 @@ bool ScanQueue::addReading(QString mac, QString ssid, qint16 frequency, qint8 st
 
 bool ScanQueue::scanCompleted()
 {
-  qDebug() << Q_FUNC_INFO << "index=" << m_currentScan;
+  LatencyTimer latency (m_localizer ? m_localizer->latency(SCAN_STAGE) : 0);
+  qint64 traceStart = flightRecorder()->now();
+  moleDebug(SCAN_LOG) << Q_FUNC_INFO << "index=" << m_currentScan;
+
+  if (m_trace)
+    m_trace->scanCompleted();
 
   m_currentReading = 0;
 
   if (m_seenMacs.isEmpty()) {
-    qDebug() << "scanQueue: found no readings";
+    moleDebug(SCAN_LOG) << "scanQueue: found no readings";
     return false;
   }
 
@@ -116,40 +128,20 @@ bool ScanQueue::scanCompleted()
   m_seenMacsSize = m_seenMacs.size();
 
   m_seenMacs.clear();
+  m_scanCount->increment();
 
-  qDebug() << Q_FUNC_INFO << "scanSize previous" << previousSeenMacsSize << "current" << m_seenMacsSize;
+  moleDebug(SCAN_LOG) << Q_FUNC_INFO << "scanSize previous" << previousSeenMacsSize << "current" << m_seenMacsSize;
 
 
   // Check for duplicate scans.
-  // Duplicate readings appear to "appear" in the same order
-  // so we do not need to use a hash
-  // (we can just check the same index)
-
-  if (previousSeenMacsSize == m_seenMacsSize) {
-    int previousScan = m_currentScan - 1;
-    if (previousScan < 0)
-      previousScan = MAX_SCANQUEUE_SCANS -1;
-
-    if (m_scans[previousScan].state == ACTIVE) {
-      bool duplicateScan = true;
-      for (int i = 0; duplicateScan && i < MAX_SCANQUEUE_READINGS; ++i) {
-        APDesc* apC = m_scans[m_currentScan].readings[i].ap;
-        APDesc* apP = m_scans[previousScan].readings[i].ap;
-        if (apC && apP) {
-          if (apC->mac != apP->mac || m_scans[m_currentScan].readings[i].strength
-              != m_scans[previousScan].readings[i].strength)
-            duplicateScan = false;
-        }
-      }
-      if (duplicateScan) {
-        qDebug() << "rejecting duplicate scan";
-        return false;
-      }
-    }
-  }
-
-  if (m_recordScans) {
-    recordCurrentScan ();
+  // Some drivers return the previous results again,
+  // possibly in a different order.
+  if (isDuplicateScan(m_scans[m_currentScan].digest, m_seenMacsSize)) {
+    moleDebug(SCAN_LOG) << "rejecting duplicate scan";
+    m_duplicateScanCount->increment();
+    flightRecorder()->record(FLIGHT_DUPLICATE_SCAN, traceStart, m_seenMacsSize);
+    discardCurrentScan();
+    return false;
   }
 
   // apply the current readings to the fingerprint
@@ -184,7 +176,7 @@ bool ScanQueue::scanCompleted()
   // if we are only keeping a limited number of active scans
   // and not using the motion detector
   if (maxActiveQueueLength > 0) {
-    qDebug() << "starting expired";
+    moleDebug(SCAN_LOG) << "starting expired";
     int expiringScan = m_currentScan - maxActiveQueueLength;
     if (expiringScan < 0)
       expiringScan = MAX_SCANQUEUE_SCANS + expiringScan;
@@ -208,7 +200,7 @@ bool ScanQueue::scanCompleted()
       --m_activeScanCount;
       Q_ASSERT(m_activeScanCount > 0);
     }
-    qDebug() << "finished expired";
+    moleDebug(SCAN_LOG) << "finished expired";
   }
 
   // Finished processing this scan.
@@ -280,6 +272,7 @@ bool ScanQueue::scanCompleted()
   // We do tell the localizer however.
   m_localizer->localize(m_activeScanCount);
 
+  flightRecorder()->record(FLIGHT_SCAN, traceStart, m_seenMacsSize);
   return true;
 
 }
@@ -325,8 +318,40 @@ void ScanQueue::serialize(QDateTime oldestValidScan, QVariantList &scanList)
     }
   }
 
-  qDebug() << "scanQueue serialize scanCount " << scanCount << "readingCount" << readingCount;
+  moleDebug(SCAN_LOG) << "scanQueue serialize scanCount " << scanCount << "readingCount" << readingCount;
+
+}
+
+bool ScanQueue::isDuplicateScan(quint64 digest, int size)
+{
+  for (int i = 0; i < DUPLICATE_SCAN_HISTORY; ++i) {
+    if (m_recentDigests[i] == digest && m_recentSizes[i] == size)
+      return true;
+  }
+
+  m_recentDigests[m_recentIndex] = digest;
+  m_recentSizes[m_recentIndex] = size;
+  ++m_recentIndex;
+  if (m_recentIndex >= DUPLICATE_SCAN_HISTORY)
+    m_recentIndex = 0;
+  return false;
+}
 
+// Drop the readings of a rejected scan.
+// Its APs have not been applied to the fingerprint yet,
+// so any that are only used by this scan are removed again.
+void ScanQueue::discardCurrentScan()
+{
+  for (int i = 0; i < MAX_SCANQUEUE_READINGS; ++i) {
+    APDesc* ap = m_scans[m_currentScan].readings[i].ap;
+    if (ap) {
+      m_scans[m_currentScan].readings[i].ap = 0;
+      if (ap->useCount() <= 0 && m_localizer->fingerprint()->value(ap->mac) == ap) {
+        m_localizer->fingerprint()->remove(ap->mac);
+        delete ap;
+      }
+    }
+  }
 }
 
 APDesc* ScanQueue::getAP(QString mac, QString ssid, qint16 frequency)
@@ -342,7 +367,10 @@ APDesc* ScanQueue::getAP(QString mac, QString ssid, qint16 frequency)
 
 void ScanQueue::handleMotionChange(Motion motion)
 {
-  qDebug() << Q_FUNC_INFO << "motion=" << motion;
+  moleDebug(SCAN_LOG) << Q_FUNC_INFO << "motion=" << motion;
+
+  if (m_trace)
+    m_trace->motionChanged(motion);
 
   if (motion == MOVING) {
     m_movementDetected = true;
@@ -358,7 +386,7 @@ void ScanQueue::hibernate(bool /*goToSleep*/) {
 // scale back everything except for the current scan
 void ScanQueue::truncate()
 {
-  qDebug() << "sQ truncate start " << m_currentScan;
+  moleDebug(SCAN_LOG) << "sQ truncate start " << m_currentScan;
 
   // Create a new fingerprint object
   QMap<QString,APDesc*> *newFP = new QMap<QString,APDesc*> ();
@@ -383,18 +411,18 @@ void ScanQueue::truncate()
       m_scans[m_currentScan].readings[i].ap = newAP;
     }
   }
-  qDebug() << "sQ truncate before clear responseRateTotal" << m_responseRateTotal;
+  moleDebug(SCAN_LOG) << "sQ truncate before clear responseRateTotal" << m_responseRateTotal;
 
   // Mark all of the other scans as inactive
   clear(m_currentScan);
 
-  qDebug() << "sQ truncate after clear responseRateTotal" << m_responseRateTotal;
+  moleDebug(SCAN_LOG) << "sQ truncate after clear responseRateTotal" << m_responseRateTotal;
 
   // Delete the outgoing fingerprint and
   // swap in the newly created fingerprint
   m_localizer->replaceFingerprint(newFP);
 
-  qDebug() << "sQ truncate end " << m_currentScan << "responseRateTotal" << m_responseRateTotal;
+  moleDebug(SCAN_LOG) << "sQ truncate end " << m_currentScan << "responseRateTotal" << m_responseRateTotal;
 
 }
 
@@ -409,29 +437,6 @@ void ScanQueue::clear(int ignoreScan)
   }
 }
 
-// Was going to save all this to a sqlite db.
-// This would have been tidy and more compact, but probably overkill
-void ScanQueue::recordCurrentScan() {
-
-  QString scan;
-
-  for (int i = 0; i < MAX_SCANQUEUE_READINGS; ++i) {
-    APDesc* ap = m_scans[m_currentScan].readings[i].ap;
-    if (ap) {
-      scan.append (" ");
-      scan.append (ap->mac);
-      scan.append (" ");
-      qint8 rssi = m_scans[m_currentScan].readings[i].strength;
-      QString r = QString::number(rssi);
-      scan.append (r);
-      scan.append (" ");
-    }
-  }
-
-  qWarning() << "SCAN" << scan;
-
-}
-
 QDebug operator<<(QDebug dbg, const Reading &reading)
 {
   dbg.nospace() << "[";
@@ -20,12 +20,15 @@
 
 #include <QtCore>
 #include "motion.h"
+#include "scanner.h"
 
 const int MAX_SCANQUEUE_READINGS = 50;
 const int MAX_SCANQUEUE_SCANS = 60;
 
 class APDesc;
+class Counter;
 class Localizer;
+class ScanTraceWriter;
 
 class Reading
 {
@@ -59,6 +62,7 @@ class Scan
  public:
   ScanState state;
   QDateTime timestamp;
+  quint64 digest;
   Reading readings[MAX_SCANQUEUE_READINGS];
 };
 
@@ -68,8 +72,9 @@ class ScanQueue : public QObject
   Q_OBJECT
 
  public:
-  ScanQueue(QObject *parent = 0, Localizer *localizer = 0, int maxActiveQueueLength = 0, 
-	    bool recordScans = false);
+  // if trace is set, raw readings and motion changes are recorded to it
+  ScanQueue(QObject *parent = 0, Localizer *localizer = 0, int maxActiveQueueLength = 0,
+	    ScanTraceWriter *trace = 0);
 
   void serialize(QDateTime oldestValidScan, QVariantList &scanList);
   void hibernate(bool goToSleep);
@@ -87,20 +92,31 @@ class ScanQueue : public QObject
   qint8 m_currentScan;
   qint8 m_currentReading;
   qint8 m_activeScanCount;
-  bool m_recordScans;
+  ScanTraceWriter *m_trace;
   qint8 m_seenMacsSize;
   int m_responseRateTotal;
   bool m_movementDetected;
   bool m_hibernating;
 
   QSet<QString> m_seenMacs;
+
+  // digests and sizes of the most recently accepted scans
+  quint64 m_recentDigests[DUPLICATE_SCAN_HISTORY];
+  int m_recentSizes[DUPLICATE_SCAN_HISTORY];
+  int m_recentIndex;
   QSet<APDesc*> m_dirtyAPs;
 
   Scan m_scans[MAX_SCANQUEUE_SCANS];
 
+  // in the metrics registry
+  Counter *m_readingCount;
+  Counter *m_scanCount;
+  Counter *m_duplicateScanCount;
+
   APDesc* getAP(QString mac, QString ssid, qint16 frequency);
 
-  void recordCurrentScan();
+  bool isDuplicateScan(quint64 digest, int size);
+  void discardCurrentScan();
 
   void truncate();
   void clear(int ignoreScan);
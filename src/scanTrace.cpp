@@ -0,0 +1,233 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanTrace.h"
+
+static const int TRACE_MAGIC_SIZE = sizeof(TRACE_MAGIC) - 1;
+// length of a record's type and payload length
+static const int TRACE_RECORD_HEADER_SIZE = 5;
+
+ScanTraceWriter::ScanTraceWriter()
+{
+}
+
+bool ScanTraceWriter::open(const QString &path)
+{
+  m_file.setFileName(path);
+  if (!m_file.open(QIODevice::ReadWrite)) {
+    qWarning() << "cannot open scan trace" << path << m_file.errorString();
+    return false;
+  }
+  if (m_file.size() == 0) {
+    m_file.write(TRACE_MAGIC, TRACE_MAGIC_SIZE);
+  } else if (!truncateToLastRecord()) {
+    qWarning() << "not a scan trace, not recording" << path;
+    m_file.close();
+    return false;
+  }
+
+  m_clock.start();
+  QByteArray payload;
+  QDataStream out (&payload, QIODevice::WriteOnly);
+  out.setVersion(QDataStream::Qt_4_6);
+  out << (qint64) 0 << QDateTime::currentDateTime();
+  writeRecord(TRACE_START, payload);
+
+  qDebug() << "recording scan trace to" << path;
+  return true;
+}
+
+void ScanTraceWriter::addReading(const QString &mac, const QString &ssid,
+                                 qint16 frequency, qint8 strength)
+{
+  TraceReading reading;
+  reading.mac = mac;
+  reading.ssid = ssid;
+  reading.frequency = frequency;
+  reading.strength = strength;
+  m_readings.append(reading);
+}
+
+void ScanTraceWriter::scanCompleted()
+{
+  if (m_readings.isEmpty())
+    return;
+
+  QByteArray payload;
+  QDataStream out (&payload, QIODevice::WriteOnly);
+  out.setVersion(QDataStream::Qt_4_6);
+  out << (qint64) m_clock.elapsed() << (quint16) m_readings.size();
+  foreach (const TraceReading &reading, m_readings) {
+    out << reading.mac << reading.ssid << reading.frequency << reading.strength;
+  }
+  m_readings.clear();
+  writeRecord(TRACE_SCAN, payload);
+}
+
+void ScanTraceWriter::motionChanged(Motion motion)
+{
+  QByteArray payload;
+  QDataStream out (&payload, QIODevice::WriteOnly);
+  out.setVersion(QDataStream::Qt_4_6);
+  out << (qint64) m_clock.elapsed() << (qint32) motion;
+  writeRecord(TRACE_MOTION, payload);
+}
+
+void ScanTraceWriter::bound(const QString &area, const QString &space)
+{
+  QByteArray payload;
+  QDataStream out (&payload, QIODevice::WriteOnly);
+  out.setVersion(QDataStream::Qt_4_6);
+  out << (qint64) m_clock.elapsed() << area << space;
+  writeRecord(TRACE_BIND, payload);
+}
+
+void ScanTraceWriter::removed(const QString &area, const QString &space)
+{
+  QByteArray payload;
+  QDataStream out (&payload, QIODevice::WriteOnly);
+  out.setVersion(QDataStream::Qt_4_6);
+  out << (qint64) m_clock.elapsed() << area << space;
+  writeRecord(TRACE_REMOVE, payload);
+}
+
+// A crash can leave a record cut short at the end of the file.
+// Appending after it would make the next session's records read as its
+// payload, so cut the file back to the last complete record.
+bool ScanTraceWriter::truncateToLastRecord()
+{
+  if (m_file.read(TRACE_MAGIC_SIZE) != QByteArray(TRACE_MAGIC, TRACE_MAGIC_SIZE))
+    return false;
+
+  QDataStream in (&m_file);
+  in.setVersion(QDataStream::Qt_4_6);
+  qint64 end = TRACE_MAGIC_SIZE;
+  while (end + TRACE_RECORD_HEADER_SIZE <= m_file.size()) {
+    quint8 type;
+    quint32 length;
+    in >> type >> length;
+    if (end + TRACE_RECORD_HEADER_SIZE + length > m_file.size())
+      break;
+    end += TRACE_RECORD_HEADER_SIZE + length;
+    m_file.seek(end);
+  }
+
+  if (end < m_file.size()) {
+    qWarning() << "scan trace ends in a partial record, dropping"
+               << m_file.size() - end << "bytes";
+    m_file.resize(end);
+  }
+  m_file.seek(end);
+  return true;
+}
+
+// One write per record, flushed, so a crash loses at most the
+// record being written; open() drops it before appending.
+void ScanTraceWriter::writeRecord(TraceRecordType type, const QByteArray &payload)
+{
+  if (!m_file.isOpen())
+    return;
+
+  QByteArray record;
+  QDataStream out (&record, QIODevice::WriteOnly);
+  out.setVersion(QDataStream::Qt_4_6);
+  out << (quint8) type << (quint32) payload.size();
+  record.append(payload);
+
+  if (m_file.write(record) != record.size() || !m_file.flush()) {
+    qWarning() << "scan trace write failed, no longer recording" << m_file.errorString();
+    m_file.close();
+  }
+}
+
+bool ScanTraceReader::open(const QString &path)
+{
+  m_file.setFileName(path);
+  if (!m_file.open(QIODevice::ReadOnly)) {
+    qWarning() << "cannot open scan trace" << path << m_file.errorString();
+    return false;
+  }
+  if (m_file.read(TRACE_MAGIC_SIZE) != QByteArray(TRACE_MAGIC, TRACE_MAGIC_SIZE)) {
+    qWarning() << "not a scan trace" << path;
+    m_file.close();
+    return false;
+  }
+  return true;
+}
+
+bool ScanTraceReader::next(TraceEvent &event)
+{
+  while (m_file.isOpen()) {
+    QByteArray header = m_file.read(TRACE_RECORD_HEADER_SIZE);
+    if (header.isEmpty())
+      return false;
+
+    quint8 type = 0;
+    quint32 length = 0;
+    QDataStream headerIn (header);
+    headerIn.setVersion(QDataStream::Qt_4_6);
+    headerIn >> type >> length;
+
+    QByteArray payload = m_file.read(length);
+    if (header.size() < TRACE_RECORD_HEADER_SIZE || payload.size() != (int) length) {
+      qWarning() << "scan trace ends in a partial record at" << m_file.pos();
+      return false;
+    }
+
+    event = TraceEvent();
+    event.type = type;
+    QDataStream in (payload);
+    in.setVersion(QDataStream::Qt_4_6);
+    in >> event.msec;
+
+    switch (type) {
+    case TRACE_START:
+      in >> event.started;
+      break;
+    case TRACE_SCAN: {
+      quint16 count = 0;
+      in >> count;
+      for (int i = 0; i < count; ++i) {
+        TraceReading reading;
+        in >> reading.mac >> reading.ssid >> reading.frequency >> reading.strength;
+        event.readings.append(reading);
+      }
+      break;
+    }
+    case TRACE_MOTION: {
+      qint32 motion = 0;
+      in >> motion;
+      event.motion = (Motion) motion;
+      break;
+    }
+    case TRACE_BIND:
+    case TRACE_REMOVE:
+      in >> event.area >> event.space;
+      break;
+    default:
+      qDebug() << "skipping unknown scan trace record" << type;
+      continue;
+    }
+
+    if (in.status() != QDataStream::Ok) {
+      qWarning() << "bad scan trace record at" << m_file.pos();
+      return false;
+    }
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,111 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SCAN_TRACE_H_
+#define SCAN_TRACE_H_
+
+#include <QtCore>
+
+#include "motion.h"
+
+// A scan trace records what the daemon fed the localizer, so that a
+// walk can be replayed offline by mole-replay.
+//
+// The file is the magic TRACE_MAGIC followed by records.  A record is
+// a quint8 type and a quint32 payload length, then the payload in
+// QDataStream (Qt_4_6) encoding.  Every payload starts with a qint64
+// msec on a monotonic clock that starts with the recording session.
+// Readers skip record types they do not know, so the format can grow.
+// Traces are only appended to; each recording session starts with a
+// TRACE_START record holding the wall clock time.
+
+const char TRACE_MAGIC[] = "MOLETRC1";
+
+enum TraceRecordType {
+  TRACE_START = 1,   // QDateTime started
+  TRACE_SCAN = 2,    // quint16 count, then count of
+                     // (QString mac, QString ssid, qint16 frequency, qint8 strength)
+  TRACE_MOTION = 3,  // qint32 Motion
+  TRACE_BIND = 4,    // QString area, QString space
+  TRACE_REMOVE = 5   // QString area, QString space
+};
+
+class TraceReading
+{
+ public:
+  QString mac;
+  QString ssid;
+  qint16 frequency;
+  qint8 strength;
+};
+
+class TraceEvent
+{
+ public:
+  TraceEvent() : type(0), msec(0), motion(STATIONARY) {}
+
+  int type;
+  qint64 msec;
+  QDateTime started;
+  // raw scanner readings, before ScanQueue filters them
+  QList<TraceReading> readings;
+  Motion motion;
+  QString area;
+  QString space;
+};
+
+class ScanTraceWriter
+{
+ public:
+  ScanTraceWriter();
+
+  bool open(const QString &path);
+
+  // readings are held until their scan completes
+  void addReading(const QString &mac, const QString &ssid, qint16 frequency, qint8 strength);
+  void scanCompleted();
+  void motionChanged(Motion motion);
+  void bound(const QString &area, const QString &space);
+  void removed(const QString &area, const QString &space);
+
+ private:
+  QFile m_file;
+  QElapsedTimer m_clock;
+  QList<TraceReading> m_readings;
+
+  bool truncateToLastRecord();
+  void writeRecord(TraceRecordType type, const QByteArray &payload);
+
+  Q_DISABLE_COPY(ScanTraceWriter)
+};
+
+class ScanTraceReader
+{
+ public:
+  ScanTraceReader() {}
+
+  bool open(const QString &path);
+  // false at the end of the trace, or at a record cut short
+  bool next(TraceEvent &event);
+
+ private:
+  QFile m_file;
+
+  Q_DISABLE_COPY(ScanTraceReader)
+};
+
+#endif /* SCAN_TRACE_H_ */
@@ -24,3 +24,16 @@ const int SCAN_INTERVAL_MSEC_HIBERNATE = 60000;
 
 const QRegExp LocallyAdministeredMAC ("^.[2367abef]:");
 const QRegExp MacRegExp ("^[0-9a-f][0-9a-f]:[0-9a-f][0-9a-f]:[0-9a-f][0-9a-f]:[0-9a-f][0-9a-f]:[0-9a-f][0-9a-f]:[0-9a-f][0-9a-f]$");
+
+quint64 readingDigest(const QString &mac, qint8 strength)
+{
+  QString hex = mac;
+  hex.remove(':');
+  quint64 x = (hex.toULongLong(0, 16) << 8) ^ (quint8)strength;
+
+  // splitmix64 finalizer
+  x += Q_UINT64_C(0x9e3779b97f4a7c15);
+  x = (x ^ (x >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+  x = (x ^ (x >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+  return x ^ (x >> 31);
+}
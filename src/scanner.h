@@ -26,4 +26,12 @@ extern const int SCAN_INTERVAL_MSEC_HIBERNATE;
 extern const QRegExp LocallyAdministeredMAC;
 extern const QRegExp MacRegExp;
 
+// Number of recently accepted scans checked for duplicates.
+const int DUPLICATE_SCAN_HISTORY = 4;
+
+// Order-independent hash of one (bssid, rssi) reading.
+// A scan's digest is the sum of these over its readings,
+// so reordered duplicates produce the same digest.
+quint64 readingDigest(const QString &mac, qint8 strength);
+
 #endif // SCANNER_H
@@ -33,6 +33,8 @@
 #endif
 
 const int  BUFFER_SIZE = 1024;
+// stop pushing to a subscriber with this much unsent data
+const qint64 MAX_SUBSCRIBER_BACKLOG = 64*1024;
 #define DEFAULT_LOG_FILE     "/var/log/mole-scanner.log"
 #define APPLICATION_NAME     "mole-scanner"
 
@@ -140,12 +142,14 @@ void usage() {
 /////////////////////////////////////////////////////////////////
 LocalServer::LocalServer(QObject *parent, SimpleScanQueue *scanQueue, int port)
   :QTcpServer(parent), m_scanQueue(scanQueue)
+  , m_epoch(QString::number(QDateTime::currentMSecsSinceEpoch()))
 {
   bool ok = listen(QHostAddress::LocalHost, port);
   if (!ok)
     qFatal ("LocalServer cannot listen on port");
 
   connect(this, SIGNAL(newConnection()), this, SLOT(handleRequest()));
+  connect(m_scanQueue, SIGNAL(scanQueueCompleted()), this, SLOT(handleScanQueueCompleted()));
 
   if (!isListening())
     qFatal ("LS: not listening");
@@ -181,8 +185,29 @@ void LocalServer::handleRequest()
 
 
     QJson::Serializer serializer;
+    QRegExp scansSince ("^/?scans\\?since=(\\d+)$");
+    QRegExp subscribeSince ("^/?subscribe(\\?since=(\\d+))?$");
 
-    if (requestString == "scans" ||
+    if (subscribeSince.exactMatch(requestString)) {
+
+      quint32 since = m_scanQueue->lastSeq();
+      if (!subscribeSince.cap(2).isEmpty())
+        since = subscribeSince.cap(2).toUInt();
+      addSubscriber(socket, since);
+      return;
+
+    } else if (scansSince.exactMatch(requestString)) {
+
+      QVariantList list;
+      quint32 cursor;
+      m_scanQueue->serialize(scansSince.cap(1).toUInt(), list, cursor);
+      QVariantMap map;
+      map.insert("epoch", m_epoch);
+      map.insert("cursor", cursor);
+      map.insert("scans", list);
+      reply = serializer.serialize(map);
+
+    } else if (requestString == "scans" ||
 	requestString == "/scans") {
 
       QVariantList list;
@@ -206,3 +231,73 @@ void LocalServer::handleRequest()
 }
 
 
+
+/////////////////////////////////////////////////////////////////
+// Subscribers keep their connection open and are sent each
+// completed scan as a record: a 32-bit big-endian length followed
+// by the same json as a "scans?since=" reply.
+// A subscriber that does not keep up is not written to until its
+// backlog drains; it then catches up from its cursor in one record.
+void LocalServer::addSubscriber(QTcpSocket *socket, quint32 since)
+{
+  qDebug() << "LS: adding subscriber from port" << socket->peerPort() << "since" << since;
+  m_subscribers.insert(socket, since);
+  connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(handleSubscriberWritten()));
+  connect(socket, SIGNAL(disconnected()), this, SLOT(handleSubscriberDisconnected()));
+  pushScans(socket);
+}
+
+void LocalServer::pushScans(QTcpSocket *socket)
+{
+  quint32 since = m_subscribers.value(socket);
+  if (since == m_scanQueue->lastSeq())
+    return;
+
+  if (socket->bytesToWrite() > MAX_SUBSCRIBER_BACKLOG) {
+    qDebug() << "LS: subscriber backlog" << socket->bytesToWrite() << "deferring push";
+    return;
+  }
+
+  QVariantList list;
+  quint32 cursor;
+  m_scanQueue->serialize(since, list, cursor);
+  m_subscribers.insert(socket, cursor);
+  if (list.isEmpty())
+    return;
+
+  QVariantMap map;
+  map.insert("epoch", m_epoch);
+  map.insert("cursor", cursor);
+  map.insert("scans", list);
+  QJson::Serializer serializer;
+  QByteArray json = serializer.serialize(map);
+
+  QByteArray record;
+  QDataStream stream (&record, QIODevice::WriteOnly);
+  stream << (quint32)json.size();
+  record.append(json);
+  socket->write(record);
+}
+
+void LocalServer::handleScanQueueCompleted()
+{
+  QMapIterator<QTcpSocket*,quint32> it (m_subscribers);
+  while (it.hasNext()) {
+    it.next();
+    pushScans(it.key());
+  }
+}
+
+void LocalServer::handleSubscriberWritten()
+{
+  QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+  if (socket && m_subscribers.contains(socket))
+    pushScans(socket);
+}
+
+void LocalServer::handleSubscriberDisconnected()
+{
+  QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+  qDebug() << "LS: subscriber disconnected";
+  m_subscribers.remove(socket);
+}
@@ -34,9 +34,21 @@ class LocalServer : public QTcpServer
 
  private:
   SimpleScanQueue *m_scanQueue;
+  // sent with every cursor; cursors from another epoch mean nothing,
+  // as a restarted daemon numbers its scans afresh
+  QString m_epoch;
+
+  // subscribed sockets and the newest scan each has been sent
+  QMap<QTcpSocket*,quint32> m_subscribers;
+
+  void addSubscriber(QTcpSocket *socket, quint32 since);
+  void pushScans(QTcpSocket *socket);
 
  private slots:
   void handleRequest();
+  void handleScanQueueCompleted();
+  void handleSubscriberWritten();
+  void handleSubscriberDisconnected();
 
 };
 
@@ -0,0 +1,340 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sessionEngine.h"
+#include "localizer.h"
+#include "scan.h"
+#include "scanner.h"
+#include "scanQueue.h"
+#include "virtualAP.h"
+
+Session::Session()
+  : m_readingCount(0)
+{
+  m_lastActivity.start();
+}
+
+Session::~Session()
+{
+  qDeleteAll(m_fingerprint);
+}
+
+bool Session::areaFetchDue()
+{
+  if (m_fingerprint.isEmpty() ||
+      (m_lastAreaFetch.isValid() && m_lastAreaFetch.elapsed() < SESSION_AREA_FETCH_MSEC))
+    return false;
+  m_lastAreaFetch.start();
+  return true;
+}
+
+bool Session::addScan(const QVariantMap &scan)
+{
+  m_lastActivity.restart();
+
+  SessionScan readings;
+  QSet<QString> seenMacs;
+  QSet<APDesc*> dirtyAPs;
+
+  foreach (const QVariant &value, scan.value("readings").toList()) {
+    QVariantMap reading = value.toMap();
+    QString mac = reading.value("bssid").toString().toLower();
+    if (seenMacs.contains(mac) || mac.contains(LocallyAdministeredMAC) ||
+        !mac.contains(MacRegExp) || readings.size() >= MAX_SCANQUEUE_READINGS)
+      continue;
+    seenMacs.insert(mac);
+
+    qint16 frequency = reading.value("frequency").toInt();
+    qint8 strength = qBound(-128, reading.value("level").toInt(), 127);
+
+    APDesc *ap = m_fingerprint.value(mac);
+    if (!ap) {
+      ap = new APDesc(mac, reading.value("ssid").toString(), frequency);
+      m_fingerprint.insert(mac, ap);
+    }
+    ap->incrementUse();
+    ap->addSignalStrength(strength);
+    dirtyAPs.insert(ap);
+    readings.append(qMakePair(ap, strength));
+  }
+
+  if (readings.isEmpty())
+    return false;
+
+  m_readingCount += readings.size();
+  m_scans.enqueue(readings);
+
+  // the oldest scan drops out of the histograms
+  if (m_scans.size() > MAX_SESSION_SCANS) {
+    SessionScan expired = m_scans.dequeue();
+    m_readingCount -= expired.size();
+    for (int i = 0; i < expired.size(); ++i) {
+      APDesc *ap = expired.at(i).first;
+      ap->removeSignalStrength(expired.at(i).second);
+      ap->decrementUse();
+      if (ap->useCount() <= 0) {
+        m_fingerprint.remove(ap->mac);
+        dirtyAPs.remove(ap);
+        delete ap;
+      } else {
+        dirtyAPs.insert(ap);
+      }
+    }
+  }
+
+  foreach (APDesc *ap, dirtyAPs) {
+    ap->normalizeHistogram();
+  }
+  foreach (APDesc *ap, m_fingerprint) {
+    ap->setWeight(m_readingCount);
+  }
+  return true;
+}
+
+// Scores one session's fingerprint on the pool.
+// The job owns its fingerprint copy and pins its spaces,
+// so the session may be evicted meanwhile.
+class SessionScoring : public QRunnable
+{
+ public:
+  SessionScoring(SessionEngine *engine, quint32 ticket, int index, const ScoringJob &job)
+    : m_engine(engine), m_ticket(ticket), m_index(index), m_job(job) {}
+
+  void run()
+  {
+    QElapsedTimer timer;
+    timer.start();
+
+    SessionEngine::Scored scored;
+    scored.ticket = m_ticket;
+    scored.index = m_index;
+    Overlap overlap;
+    LocalizerWorker::score(overlap, m_job, scored.result);
+
+    qDeleteAll(m_job.fingerprint);
+    m_job.fingerprint.clear();
+    m_job.spaces.clear();
+
+    scored.nsec = timer.nsecsElapsed();
+    m_engine->addScored(scored);
+  }
+
+ private:
+  SessionEngine *m_engine;
+  quint32 m_ticket;
+  int m_index;
+  ScoringJob m_job;
+};
+
+SessionEngine::SessionEngine(QObject *parent, Localizer *localizer, int idleMsec, int threads)
+  : QObject(parent)
+  , m_localizer(localizer)
+  , m_idleMsec(idleMsec)
+  , m_nextTicket(1)
+  , m_localizedCount(0)
+  , m_evictedCount(0)
+  , m_scoringNsec(0)
+{
+  if (threads > 0)
+    m_pool.setMaxThreadCount(threads);
+
+  connect(&m_evictTimer, SIGNAL(timeout()), this, SLOT(evictIdleSessions()));
+  m_evictTimer.start(qMax(1000, m_idleMsec/2));
+
+  qDebug() << "SessionEngine threads" << m_pool.maxThreadCount()
+           << "idleMsec" << m_idleMsec;
+}
+
+SessionEngine::~SessionEngine()
+{
+  m_pool.waitForDone();
+  qDeleteAll(m_sessions);
+  m_sessions.clear();
+}
+
+quint32 SessionEngine::submit(const QVariantList &entries, QString &error)
+{
+  if (entries.isEmpty()) {
+    error = "Error: no sessions in request";
+    return 0;
+  }
+  // check every entry first, so a bad one does not half apply the request
+  foreach (const QVariant &entry, entries) {
+    if (entry.toMap().value("session").toString().isEmpty()) {
+      error = "Error: session without a name in request";
+      return 0;
+    }
+  }
+
+  quint32 ticketId = m_nextTicket++;
+  if (m_nextTicket == 0)
+    m_nextTicket = 1;
+  Ticket ticket;
+
+  for (int i = 0; i < entries.size(); ++i) {
+    QVariantMap entry = entries.at(i).toMap();
+    QString name = entry.value("session").toString();
+
+    Session *session = m_sessions.value(name);
+    if (!session) {
+      session = new Session();
+      m_sessions.insert(name, session);
+      moleDebug(LOCALIZE_LOG) << "new session" << name;
+    }
+    foreach (const QVariant &scan, entry.value("scans").toList()) {
+      session->addScan(scan.toMap());
+    }
+
+    // nothing else fetches maps while sessions run
+    if (session->areaFetchDue())
+      m_localizer->fetchAreasFor(session->fingerprint());
+
+    // stays unknown unless scoring replaces it
+    ticket.replies.append(resultAsMap(name, ScoringResult()));
+
+    QMap<QString,SpaceDescPtr> spaces = m_localizer->candidateSpaces(session->fingerprint());
+    if (spaces.isEmpty())
+      continue;
+
+    ScoringJob job;
+    job.seq = ticketId;
+    job.penalty = BEST_PENALTY;
+    QMapIterator<QString,APDesc*> f (*session->fingerprint());
+    while (f.hasNext()) {
+      f.next();
+      job.fingerprint.insert(f.key(), new Sig(f.value()));
+    }
+    if (groupVirtualAPs)
+      groupVirtualAPSigs(&job.fingerprint);
+    QMapIterator<QString,SpaceDescPtr> s (spaces);
+    while (s.hasNext()) {
+      s.next();
+      job.spaces.append(qMakePair(s.key(), s.value()));
+    }
+
+    m_pool.start(new SessionScoring(this, ticketId, i, job));
+    ++ticket.outstanding;
+  }
+
+  m_tickets.insert(ticketId, ticket);
+  // always answer from the event loop, after the caller has the ticket
+  if (ticket.outstanding == 0)
+    QMetaObject::invokeMethod(this, "handleScored", Qt::QueuedConnection);
+  return ticketId;
+}
+
+// called on the pool threads
+void SessionEngine::addScored(const Scored &scored)
+{
+  QMutexLocker locker (&m_scoredLock);
+  m_scored.append(scored);
+  if (m_scored.size() == 1)
+    QMetaObject::invokeMethod(this, "handleScored", Qt::QueuedConnection);
+}
+
+void SessionEngine::handleScored()
+{
+  QList<Scored> scored;
+  {
+    QMutexLocker locker (&m_scoredLock);
+    scored = m_scored;
+    m_scored.clear();
+  }
+
+  foreach (const Scored &s, scored) {
+    m_scoringNsec += s.nsec;
+    ++m_localizedCount;
+    if (!m_tickets.contains(s.ticket))
+      continue;
+    Ticket &ticket = m_tickets[s.ticket];
+    QString name = ticket.replies.at(s.index).toMap().value("session").toString();
+    ticket.replies[s.index] = resultAsMap(name, s.result);
+    --ticket.outstanding;
+  }
+
+  QMutableMapIterator<quint32,Ticket> it (m_tickets);
+  while (it.hasNext()) {
+    it.next();
+    if (it.value().outstanding > 0)
+      continue;
+    quint32 ticketId = it.key();
+    QVariantList replies = it.value().replies;
+    it.remove();
+    emit localized(ticketId, replies);
+  }
+}
+
+static bool scoreGreaterThan(const QPair<QString,double> &a, const QPair<QString,double> &b)
+{
+  return a.second > b.second;
+}
+
+QVariantMap SessionEngine::resultAsMap(const QString &session, const ScoringResult &result) const
+{
+  QVariantMap map;
+  map["session"] = session;
+  map["status"] = "OK";
+  if (result.maxSpace.isEmpty()) {
+    map["space"] = unknownSpace;
+    map["score"] = -1;
+  } else {
+    map["space"] = result.maxSpace;
+    map["score"] = result.maxScore;
+  }
+
+  QList<QPair<QString,double> > scores = result.scores;
+  qSort(scores.begin(), scores.end(), scoreGreaterThan);
+  QVariantList ranks;
+  for (int i = 0; i < scores.size() && i < MAX_SESSION_RANKS; ++i) {
+    QVariantMap rank;
+    rank["space"] = scores.at(i).first;
+    rank["score"] = scores.at(i).second;
+    ranks.append(rank);
+  }
+  map["ranks"] = ranks;
+  return map;
+}
+
+void SessionEngine::evictIdleSessions()
+{
+  QMutableHashIterator<QString,Session*> it (m_sessions);
+  while (it.hasNext()) {
+    it.next();
+    if (it.value()->idleMsec() > m_idleMsec) {
+      qDebug() << "evicting idle session" << it.key();
+      delete it.value();
+      it.remove();
+      ++m_evictedCount;
+    }
+  }
+}
+
+QVariantMap SessionEngine::stats() const
+{
+  QVariantMap map;
+  map["Sessions"] = m_sessions.size();
+  map["Threads"] = m_pool.maxThreadCount();
+  map["Localized"] = (qlonglong) m_localizedCount;
+  map["Evicted"] = (qlonglong) m_evictedCount;
+  map["ScoringMsec"] = (qlonglong) (m_scoringNsec / 1000000);
+  // scoring throughput of one core; the fingerprint updates and
+  // candidate selection on the main thread are not included
+  if (m_scoringNsec > 0) {
+    map["SessionsPerCoreSecond"] = m_localizedCount * 1000000000. / m_scoringNsec;
+  }
+  return map;
+}
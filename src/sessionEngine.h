@@ -0,0 +1,135 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SESSION_ENGINE_H_
+#define SESSION_ENGINE_H_
+
+#include <QtCore>
+
+#include "localizerWorker.h"
+
+class APDesc;
+class Localizer;
+
+// Scans kept per session, as the daemon keeps without a motion detector.
+const int MAX_SESSION_SCANS = 12;
+// Sessions without a scan for this long are dropped.
+const int DEFAULT_SESSION_IDLE_MSEC = 10*60*1000;
+// Ranked spaces returned per session.
+const int MAX_SESSION_RANKS = 10;
+// How often a session asks the server for the areas around it,
+// as the daemon's own area cache fill does.
+const int SESSION_AREA_FETCH_MSEC = 60000;
+
+// The fingerprint of one remote device, built from the scans it sends
+// in the same way ScanQueue builds the local one: each AP's histogram
+// holds the readings of the last MAX_SESSION_SCANS scans.
+class Session
+{
+ public:
+  Session();
+  ~Session();
+
+  // scan is {"readings":[{"bssid","ssid","frequency","level"}]},
+  // as the web service client sends them.
+  // Returns false if the scan had no usable readings.
+  bool addScan(const QVariantMap &scan);
+  const QMap<QString,APDesc*> *fingerprint() const { return &m_fingerprint; }
+  qint64 idleMsec() const { return m_lastActivity.elapsed(); }
+  // true at most once per SESSION_AREA_FETCH_MSEC
+  bool areaFetchDue();
+
+ private:
+  typedef QList<QPair<APDesc*,qint8> > SessionScan;
+
+  QMap<QString,APDesc*> m_fingerprint;
+  QQueue<SessionScan> m_scans;
+  int m_readingCount;
+  QElapsedTimer m_lastActivity;
+  QElapsedTimer m_lastAreaFetch;
+
+  Q_DISABLE_COPY(Session)
+};
+
+// Localizes many remote devices at once.
+// Every session has its own fingerprint, while all of them share the
+// localizer's signal maps and one pool of scoring threads.
+// Sessions are only touched on the main thread; the pool scores
+// private copies of their fingerprints against pinned spaces.
+class SessionEngine : public QObject
+{
+  Q_OBJECT
+
+ public:
+  SessionEngine(QObject *parent = 0, Localizer *localizer = 0,
+                int idleMsec = DEFAULT_SESSION_IDLE_MSEC, int threads = 0);
+  ~SessionEngine();
+
+  // Adds each {"session","scans"} entry's scans to its session and
+  // queues the sessions for scoring.  Returns a ticket that
+  // localized() reports back with, or 0 and an error.
+  quint32 submit(const QVariantList &entries, QString &error);
+  QVariantMap stats() const;
+
+ signals:
+  // one reply per entry, in the order submitted
+  void localized(quint32 ticket, const QVariantList &replies);
+
+ private:
+  class Ticket
+  {
+   public:
+    Ticket() : outstanding(0) {}
+    int outstanding;
+    QVariantList replies;
+  };
+
+  class Scored
+  {
+   public:
+    quint32 ticket;
+    int index;
+    qint64 nsec;
+    ScoringResult result;
+  };
+
+  Localizer *m_localizer;
+  int m_idleMsec;
+  QHash<QString,Session*> m_sessions;
+  QMap<quint32,Ticket> m_tickets;
+  quint32 m_nextTicket;
+
+  QThreadPool m_pool;
+  // filled by the pool, drained on the main thread
+  QMutex m_scoredLock;
+  QList<Scored> m_scored;
+
+  QTimer m_evictTimer;
+  quint64 m_localizedCount;
+  quint64 m_evictedCount;
+  qint64 m_scoringNsec;
+
+  friend class SessionScoring;
+  void addScored(const Scored &scored);
+  QVariantMap resultAsMap(const QString &session, const ScoringResult &result) const;
+
+ private slots:
+  void handleScored();
+  void evictIdleSessions();
+};
+
+#endif /* SESSION_ENGINE_H_ */
@@ -16,6 +16,7 @@
  */
 
 #include "sig.h"
+#include "logger.h"
 
 const unsigned int kernelHalfWidth = 4;
 
@@ -175,7 +176,7 @@ void Sig::setWeight(int totalHistogramCount)
     qFatal("totalHistogramCount is larger than a single histogram total %d c %d", totalHistogramCount, c);
   }
   if (c == totalHistogramCount) {
-    qDebug() << "totalHistogramCount equals single histogram total c" << c;
+    moleDebug(MAP_LOG) << "totalHistogramCount equals single histogram total c" << c;
   }
 
   m_weight = c / (float)totalHistogramCount;
@@ -254,7 +255,7 @@ Histogram::Histogram(QString histogramStr)
 
   parseHistogram(histogramStr, kernelizedValues, count);
 
-  qDebug() << "parsed" << histogramStr << "count" << count;
+  moleDebug(MAP_LOG) << "parsed" << histogramStr << "count" << count;
   normalizeValues(kernelizedValues, normalizedValues, count);
 
   m_min -= kernelHalfWidth;
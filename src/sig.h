@@ -87,6 +87,7 @@ class Sig
   bool isEmpty();
   void normalizeHistogram();
   void setWeight(int totalHistogramCount);
+  void addWeight(float weight) { m_weight += weight; }
 
   int loudest() const { return m_histogram->min(); }
 
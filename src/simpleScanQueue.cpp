@@ -23,51 +23,29 @@
 SimpleScanQueue::SimpleScanQueue(QObject *parent)
   : QObject(parent)
   , m_currentScan(0)
+  , m_recentIndex(0)
+  , m_written(0)
+  , m_lastSeq(0)
 {
-  //segFaultBugFirstTime = true;
-  qWarning() << "Creating simpleScanQueue for" 
-	     << MAX_SCANQUEUE_SCANS << "scans and"
-	     << MAX_SCANQUEUE_READINGS << "readings";
-    
-}
-
-Scan::Scan() : m_currentReading(0) {
-  m_timestamp = QDateTime();
-}
-
-Scan& Scan::operator= (const Scan &scan) {
-  if (this == &scan)
-    return *this;
-
-  m_timestamp = scan.m_timestamp;
-  m_currentReading = scan.m_currentReading;
-  for (int i = 0; i < MAX_SCANQUEUE_READINGS; i++) {
-    m_readings[i] = scan.m_readings[i];
+  for (int i = 0; i < DUPLICATE_SCAN_HISTORY; ++i) {
+    m_recentDigests[i] = 0;
+    m_recentSizes[i] = 0;
   }
-  return *this;
-}
-
-void Scan::addReading(QString mac, QString ssid, qint16 frequency, qint8 strength) {
-  //qDebug() << Q_FUNC_INFO << " reading=" << m_currentReading;
-  if (m_currentReading < MAX_SCANQUEUE_READINGS) {
-    m_readings[m_currentReading].set (mac, ssid, frequency, strength);
-    ++m_currentReading;
-  } else {
-    qWarning("too many readings in this scan");
+  for (int i = 0; i < MAX_SCANQUEUE_RING_READINGS; ++i) {
+    m_readings[i].ssid = NO_SSID;
   }
-}
-
-void Scan::clear() {
-  for (int i = 0; i < MAX_SCANQUEUE_READINGS; i++) {
-    m_readings[i].clear();
+  for (int i = 0; i < MAX_SCANQUEUE_SCANS; ++i) {
+    m_scans[i].clear();
   }
-  m_currentReading = 0;
-  m_timestamp = QDateTime();
+
+  qWarning() << "Creating simpleScanQueue for" 
+	     << MAX_SCANQUEUE_SCANS << "scans and"
+	     << MAX_SCANQUEUE_RING_READINGS << "readings";
+    
 }
 
 void SimpleScanQueue::addReading(QString mac, QString ssid, qint16 frequency, qint8 strength)
 {
-  //qDebug() << Q_FUNC_INFO << " scan=" << m_currentScan;
   mac = mac.toLower();
   // TODO convert any - to :
 
@@ -78,7 +56,34 @@ void SimpleScanQueue::addReading(QString mac, QString ssid, qint16 frequency, qi
   } else if (!mac.contains(MacRegExp)) {
     qDebug() << "skipping non MAC" << mac;
   } else {
-    m_scans[m_currentScan].addReading(mac, ssid, frequency, strength);
+    Scan &scan = m_scans[m_currentScan];
+    if (scan.size >= MAX_SCANQUEUE_READINGS) {
+      qWarning("too many readings in this scan");
+      return;
+    }
+    if (scan.size == 0) {
+      scan.start = m_written;
+      scan.digest = 0;
+    }
+
+    // overwrite the oldest reading in the ring
+    PackedReading &reading = m_readings[m_written % MAX_SCANQUEUE_RING_READINGS];
+    if (reading.ssid != NO_SSID) {
+      m_ssids.release(reading.ssid);
+    }
+
+    QString hex = mac;
+    hex.remove(':');
+    quint64 bssid = hex.toULongLong(0, 16);
+    reading.bssidHigh = (quint32)(bssid >> 16);
+    reading.bssidLow = (quint16)(bssid & 0xffff);
+    reading.ssid = m_ssids.intern(ssid);
+    reading.frequency = frequency;
+    reading.strength = strength;
+
+    ++m_written;
+    ++scan.size;
+    scan.digest += readingDigest(mac, strength);
     m_seenMacs.insert(mac);
   }
 }
@@ -94,30 +99,17 @@ void SimpleScanQueue::scanCompleted()
 
   m_seenMacs.clear();
 
-  // Reject duplicate scans.
-  int previousScan = m_currentScan-1;
-  if (previousScan < 0) {
-    previousScan = MAX_SCANQUEUE_SCANS-1;
-  }
-
-  if (m_scans[m_currentScan] == m_scans[previousScan]) {
+  // Reject duplicate scans, including reordered ones.
+  // Its readings stay in the ring until they are overwritten.
+  if (isDuplicateScan(m_scans[m_currentScan])) {
     qDebug() << "rejecting duplicate scan";
     m_scans[m_currentScan].clear();
     return;
   }
 
   // mark this scan as valid
-  m_scans[m_currentScan].stamp();
-
-  /*
-  if (segFaultBugFirstTime) {
-    for (int i = 0; i < 125; i++) {
-      m_scans[m_currentScan+1] = m_scans[m_currentScan];
-      m_currentScan++;
-    }
-    segFaultBugFirstTime = false;  
-  }
-  */
+  m_scans[m_currentScan].stamp = QDateTime::currentDateTime().toTime_t();
+  m_scans[m_currentScan].seq = ++m_lastSeq;
 
   m_currentScan++;
   if (m_currentScan >= MAX_SCANQUEUE_SCANS) {
@@ -146,69 +138,82 @@ void SimpleScanQueue::handleMotionChange(Motion motion) {
   }
 }
 
-
-bool operator== (Reading &s1, Reading &s2) {
-  if (s1.m_mac == s2.m_mac &&
-      s1.m_ssid == s2.m_ssid &&
-      s1.m_frequency == s2.m_frequency &&
-      s1.m_strength == s2.m_strength) {
-    return true;
+bool SimpleScanQueue::isDuplicateScan(const Scan &scan) {
+  for (int i = 0; i < DUPLICATE_SCAN_HISTORY; ++i) {
+    if (m_recentDigests[i] == scan.digest && m_recentSizes[i] == scan.size)
+      return true;
   }
+
+  m_recentDigests[m_recentIndex] = scan.digest;
+  m_recentSizes[m_recentIndex] = scan.size;
+  ++m_recentIndex;
+  if (m_recentIndex >= DUPLICATE_SCAN_HISTORY)
+    m_recentIndex = 0;
   return false;
 }
 
-
-bool operator== (Scan &s1, Scan &s2) {
-  if (s1.m_currentReading != s2.m_currentReading)
-    return false;
-  for (int i = 0; i < s1.m_currentReading; ++i) {
-    if (! (s1.m_readings[i] == s2.m_readings[i])) {
-      return false;
-    }
-  }
-  return true;
+// A scan is only valid while none of its readings have been overwritten.
+bool SimpleScanQueue::isValid(const Scan &scan) const {
+  return scan.stamp != 0 && scan.size > 0 &&
+    (quint32)(m_written - scan.start) <= (quint32)MAX_SCANQUEUE_RING_READINGS;
 }
 
-Reading::Reading() : m_mac(), m_ssid(), m_frequency(0), m_strength(0) {
+quint16 SsidDictionary::intern(const QString &ssid) {
+  QHash<QString,quint16>::const_iterator it = m_ids.constFind(ssid);
+  if (it != m_ids.constEnd()) {
+    ++m_refs[it.value()];
+    return it.value();
+  }
 
+  quint16 id;
+  if (!m_freeIds.isEmpty()) {
+    id = m_freeIds.last();
+    m_freeIds.pop_back();
+    m_names[id] = ssid;
+    m_refs[id] = 1;
+  } else {
+    id = m_names.size();
+    m_names.append(ssid);
+    m_refs.append(1);
+  }
+  m_ids.insert(ssid, id);
+  return id;
 }
 
-Reading& Reading::operator= (const Reading &reading) {
-  if (this == &reading)
-    return *this;
-  m_mac = reading.m_mac;
-  m_ssid = reading.m_ssid;
-  m_frequency = reading.m_frequency;
-  m_strength = reading.m_strength;
-  return *this;
+void SsidDictionary::release(quint16 id) {
+  --m_refs[id];
+  Q_ASSERT(m_refs[id] >= 0);
+  if (m_refs[id] == 0) {
+    m_ids.remove(m_names.at(id));
+    m_names[id].clear();
+    m_freeIds.append(id);
+  }
 }
 
-void Reading::set(QString _mac, QString _ssid, qint16 _frequency, qint8 _strength) {
-  m_mac = _mac;
-  m_ssid = _ssid;
-  m_frequency = _frequency;
-  m_strength = _strength;
+QString PackedReading::mac() const {
+  QString mac;
+  mac.sprintf("%02x:%02x:%02x:%02x:%02x:%02x",
+	      (bssidHigh >> 24) & 0xff, (bssidHigh >> 16) & 0xff,
+	      (bssidHigh >> 8) & 0xff, bssidHigh & 0xff,
+	      (bssidLow >> 8) & 0xff, bssidLow & 0xff);
+  return mac;
 }
 
-
-void Reading::serialize(QVariantMap &map) {
-  map.insert ("bssid", m_mac);
-  map.insert ("ssid", m_ssid);
-  map.insert ("frequency", m_frequency);
-  map.insert ("level", m_strength);
+void PackedReading::serialize(QVariantMap &map, const SsidDictionary &ssids) const {
+  map.insert ("bssid", mac());
+  map.insert ("ssid", ssids.name(ssid));
+  map.insert ("frequency", frequency);
+  map.insert ("level", strength);
 }
 
-void Scan::serialize(QVariantMap &map) {
-  if (m_currentReading == 0) { 
-    return;
-  }
+void SimpleScanQueue::serialize(const Scan &scan, QVariantMap &map) const {
   QVariantList readingsList;
-  for (int j = 0; j < m_currentReading; ++j) {
+  for (int j = 0; j < scan.size; ++j) {
     QVariantMap readingMap;
-    m_readings[j].serialize (readingMap);
+    m_readings[(scan.start + j) % MAX_SCANQUEUE_RING_READINGS].serialize (readingMap, m_ssids);
     readingsList << readingMap;
   }
-  //map.insert("stamp", m_timestamp.toTime_t());
+  //map.insert("stamp", scan.stamp);
   map.insert("readings", readingsList);
 }
 
@@ -219,11 +224,44 @@ void SimpleScanQueue::serialize(QVariantList &list) {
   if (i == MAX_SCANQUEUE_SCANS)
     i = 0;
   while (i != m_currentScan) {
-    qDebug() << "serialize" << i;
-    if (m_scans[i].isValid()) {
-      qDebug() << "serialize valid" << i;
+    if (isValid(m_scans[i])) {
+      QVariantMap map;
+      serialize (m_scans[i], map);
+      list << map;
+      validCount++;
+    }
+    i++;
+    if (i == MAX_SCANQUEUE_SCANS)
+      i = 0;
+  }
+  qDebug() << Q_FUNC_INFO << "validCount=" << validCount
+	   << "ssids=" << m_ssids.size();
+}
+
+// Only send scans completed after the client's cursor.
+// Walk back from the newest scan to find the first new one,
+// so the cost depends on the number of new scans, not the window.
+void SimpleScanQueue::serialize(quint32 since, QVariantList &list, quint32 &cursor) {
+  // a cursor from before we restarted
+  if (since > m_lastSeq)
+    since = 0;
+
+  int first = m_currentScan;
+  int i = m_currentScan-1;
+  if (i < 0)
+    i = MAX_SCANQUEUE_SCANS-1;
+  while (i != m_currentScan && m_scans[i].seq > since) {
+    first = i;
+    i--;
+    if (i < 0)
+      i = MAX_SCANQUEUE_SCANS-1;
+  }
+
+  int validCount = 0;
+  for (i = first; i != m_currentScan; ) {
+    if (isValid(m_scans[i])) {
       QVariantMap map;
-      m_scans[i].serialize (map);    
+      serialize (m_scans[i], map);
       list << map;
       validCount++;
     }
@@ -231,5 +269,7 @@ void SimpleScanQueue::serialize(QVariantList &list) {
     if (i == MAX_SCANQUEUE_SCANS)
       i = 0;
   }
-  qDebug() << Q_FUNC_INFO << "validCount=" << validCount;
+  cursor = m_lastSeq;
+  qDebug() << Q_FUNC_INFO << "since=" << since << "cursor=" << cursor
+	   << "validCount=" << validCount;
 }
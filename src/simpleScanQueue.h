@@ -20,6 +20,7 @@
 
 #include <QtCore>
 #include "motion.h"
+#include "scanner.h"
 
 //const int MAX_SCANQUEUE_READINGS = 2;
 //const int MAX_SCANQUEUE_SCANS = 2;
@@ -27,42 +28,53 @@
 const int MAX_SCANQUEUE_READINGS = 50;
 const int MAX_SCANQUEUE_SCANS = 200;
 
+// Readings of all scans share one ring.
+// Scans average well under MAX_SCANQUEUE_READINGS readings,
+// so the ring is half the size of the worst case.  If a burst of large
+// scans wraps it, the oldest scans become invalid.
+const int MAX_SCANQUEUE_RING_READINGS = MAX_SCANQUEUE_SCANS * MAX_SCANQUEUE_READINGS / 2;
 
-class Reading
-{
-  friend bool operator== (Reading &s1, Reading &s2);
+const quint16 NO_SSID = 0xffff;
 
+// SSIDs repeat across almost every scan, so each one is stored once.
+// A reading holds a reference to its SSID until its slot in the
+// ring is overwritten.
+class SsidDictionary
+{
  public:
-  Reading();
-  Reading& operator= (const Reading &reading);
-  void serialize(QVariantMap &map);
-  void set(QString _mac, QString _ssid, qint16 _frequency, qint8 _strength);
-  void clear() { m_mac.clear(); m_ssid.clear(); m_frequency = 0; m_strength = 0; }
+  quint16 intern(const QString &ssid);
+  void release(quint16 id);
+  QString name(quint16 id) const { return m_names.at(id); }
+  int size() const { return m_ids.size(); }
 
  private:
-  QString m_mac;
-  QString m_ssid;
-  qint16 m_frequency;
-  qint8 m_strength;
+  QHash<QString,quint16> m_ids;
+  QVector<QString> m_names;
+  QVector<int> m_refs;
+  QVector<quint16> m_freeIds;
 };
 
-class Scan
+struct PackedReading
 {
- public:
-  Scan();
-  Scan& operator= (const Scan &scan);
-  void addReading(QString mac, QString ssid, qint16 frequency, qint8 strength);
-  void serialize(QVariantMap &map);
-  void clear();
-  bool isValid() { return m_timestamp.isValid(); }
-  void stamp() { m_timestamp = QDateTime::currentDateTime(); }
-  friend bool operator== (Scan &s1, Scan &s2);
+  quint32 bssidHigh;   // first four octets
+  quint16 bssidLow;    // last two octets
+  quint16 ssid;        // SsidDictionary id
+  qint16 frequency;
+  qint8 strength;
+
+  QString mac() const;
+  void serialize(QVariantMap &map, const SsidDictionary &ssids) const;
+};
 
- private:
-  int m_currentReading;
-  QDateTime m_timestamp;
-  Reading m_readings[MAX_SCANQUEUE_READINGS];
+struct Scan
+{
+  quint32 start;       // position of its first reading in the ring
+  quint32 stamp;       // seconds since epoch; zero if not a valid scan
+  quint32 seq;         // increases with each completed scan; zero if none
+  quint64 digest;
+  quint8 size;
 
+  void clear() { stamp = 0; seq = 0; size = 0; digest = 0; }
 };
 
 class SimpleScanQueue : public QObject
@@ -72,6 +84,8 @@ class SimpleScanQueue : public QObject
  public:
   SimpleScanQueue(QObject *parent = 0);
   void serialize(QVariantList &list);
+  void serialize(quint32 since, QVariantList &list, quint32 &cursor);
+  quint32 lastSeq() const { return m_lastSeq; }
 
  public slots:
   void addReading(QString mac, QString ssid, qint16 frequency, qint8 strength);
@@ -85,9 +99,22 @@ class SimpleScanQueue : public QObject
   qint16 m_currentScan;
   QSet<QString> m_seenMacs;
 
+  // digests and sizes of the most recently accepted scans
+  quint64 m_recentDigests[DUPLICATE_SCAN_HISTORY];
+  int m_recentSizes[DUPLICATE_SCAN_HISTORY];
+  int m_recentIndex;
+
+  // total number of readings ever written to the ring
+  quint32 m_written;
+  quint32 m_lastSeq;
+
+  SsidDictionary m_ssids;
+  PackedReading m_readings[MAX_SCANQUEUE_RING_READINGS];
   Scan m_scans[MAX_SCANQUEUE_SCANS];
 
-  //bool segFaultBugFirstTime;
+  bool isDuplicateScan(const Scan &scan);
+  bool isValid(const Scan &scan) const;
+  void serialize(const Scan &scan, QVariantMap &map) const;
 };
 
 #endif /* SIMPLESCANQUEUE_H_ */
@@ -15,7 +15,10 @@
  * limitations under the License.
  */
 
+#include "flightRecorder.h"
 #include "localizer.h"
+#include "logger.h"
+#include "virtualAP.h"
 
 bool MapParser::startElement(const QString&, const QString&,
                              const QString &name,
@@ -70,9 +73,9 @@ bool MapParser::startElement(const QString&, const QString&,
       if (attrs.localName(i) == "name")
         spaceName.append(attrs.value(i));
     }
-    m_areaDesc->spaces()->insert(spaceName, m_currentSpaceDesc);
+    m_areaDesc->insertSpace(spaceName, SpaceDescPtr(m_currentSpaceDesc));
 
-    qDebug() << "parsing space" << spaceName;
+    moleDebug(MAP_LOG) << "parsing space" << spaceName;
 
   } else if (name == "mac") {
     double avg = 0.;
@@ -99,10 +102,10 @@ bool MapParser::startElement(const QString&, const QString&,
     if (!bssid.isEmpty()) {
       // TODO sanity check that all values are set...
       if (stddev <= 0. || stddev > 100.0)
-        qDebug() << bssid << " avg=" << avg << " stddev=" << stddev;
+        moleDebug(MAP_LOG) << bssid << " avg=" << avg << " stddev=" << stddev;
 
       if (stddev == 0.) {
-        qDebug() << "MapParser::startElement setting stddev";
+        moleDebug(MAP_LOG) << "MapParser::startElement setting stddev";
         stddev = 1.0;
       }
 
@@ -116,15 +119,33 @@ bool MapParser::startElement(const QString&, const QString&,
       Q_ASSERT (weight < 1.);
 
       m_currentSpaceDesc->signatures()->insert(bssid, new Sig(avg, stddev, weight, histogram));
-      m_areaDesc->insertMac(bssid);
     }
   }
 
   return true;
 }
 
+bool MapParser::endElement(const QString&, const QString&, const QString &name)
+{
+  if (name == "spaces") {
+    // the area's macs are the macs of its spaces, as heard
+    QMapIterator<QString,Sig*> i (*(m_currentSpaceDesc->signatures()));
+    while (i.hasNext()) {
+      i.next();
+      m_areaDesc->insertMac(i.key());
+    }
+
+    if (groupVirtualAPs) {
+      m_currentSpaceDesc->groupSignatures();
+    }
+  }
+  return true;
+}
+
 bool Localizer::parseMap(const QByteArray &mapAsByteArray, const QDateTime lastModified)
 {
+  LatencyTimer latency (m_stats->latency(PARSE_MAP_STAGE));
+  qint64 traceStart = flightRecorder()->now();
   bool ok = false;
   QString mapAsXml(mapAsByteArray);
 
@@ -143,15 +164,12 @@ bool Localizer::parseMap(const QByteArray &mapAsByteArray, const QDateTime lastM
   if (!parser.fqArea().isEmpty()) {
     QString fqArea = parser.fqArea();
     if (parser.areaDesc()) {
-      // out with the old
+      // in with the new; readers still holding the old map keep it
+      // until they are done
       if (m_signalMaps->contains(fqArea)) {
         qDebug() << "dropping old map fq_area=" << fqArea;
-        AreaDesc *oldMap = m_signalMaps->value(fqArea);
-        delete oldMap;
       }
-
-      // in with the new
-      AreaDesc *newMap = parser.areaDesc();
+      AreaDescPtr newMap (parser.areaDesc());
       newMap->setLastModifiedTime(lastModified);
       m_signalMaps->insert(fqArea, newMap);
       qDebug() << "inserted new map fq_area=" << fqArea
@@ -167,6 +185,12 @@ bool Localizer::parseMap(const QByteArray &mapAsByteArray, const QDateTime lastM
     qWarning() << "xml parse: no fq_area";
   }
 
+  if (ok) {
+    m_mapParseCount->increment();
+  } else {
+    m_mapParseErrorCount->increment();
+  }
+  flightRecorder()->record(FLIGHT_MAP_PARSE, traceStart, mapAsByteArray.size(), parser.fqArea());
   return ok;
 
 }
@@ -258,8 +282,7 @@ void Localizer::loadMaps()
 }
 
 AreaDesc::AreaDesc()
-  : m_macs(new QSet<QString>())
-  , m_spaces(new QMap<QString,SpaceDesc*>())
+  : m_mapVersion(0)
   , m_touch(false)
 {
   m_lastAccessTime = QDateTime::currentDateTime();
@@ -267,15 +290,6 @@ AreaDesc::AreaDesc()
   qDebug () << "new map area desc ctor";
 }
 
-AreaDesc::~AreaDesc()
-{
-  m_macs->clear();
-  delete m_macs;
-  qDeleteAll(m_spaces->begin(), m_spaces->end());
-  m_spaces->clear();
-  delete m_spaces;
-}
-
 SpaceDesc::SpaceDesc()
   : m_sigs(new QMap<QString,Sig*> ())
 {
@@ -297,6 +311,12 @@ SpaceDesc::SpaceDesc(QMap<QString,Sig*> *fingerprint)
 
 }
 
+void SpaceDesc::groupSignatures()
+{
+  m_macs = m_sigs->keys();
+  groupVirtualAPSigs(m_sigs);
+}
+
 SpaceDesc::~SpaceDesc()
 {
   qDeleteAll(m_sigs->begin(), m_sigs->end());
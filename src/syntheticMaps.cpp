@@ -0,0 +1,204 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "syntheticMaps.h"
+#include "scan.h"
+#include "sig.h"
+#include "math.h"
+
+#include <math.h>
+
+// readings behind each histogram of a generated map
+const int MAP_READINGS = 40;
+
+QVariantMap SyntheticMapConfig::toVariant() const
+{
+  QVariantMap map;
+  map.insert("buildings", buildings);
+  map.insert("floors", floors);
+  map.insert("spaces_per_floor", spacesPerFloor);
+  map.insert("aps_per_space", apsPerSpace);
+  map.insert("histogram_width", histogramWidth);
+  map.insert("seed", seed);
+  map.insert("areas", areaCount());
+  map.insert("spaces", spaceCount());
+  return map;
+}
+
+SyntheticMapConfig SyntheticMapConfig::withSpaces(int spaces) const
+{
+  SyntheticMapConfig config = *this;
+  config.spacesPerFloor = qBound(1, spacesPerFloor, spaces);
+  int areas = (spaces + config.spacesPerFloor - 1) / config.spacesPerFloor;
+  config.floors = qBound(1, floors, areas);
+  config.buildings = (areas + config.floors - 1) / config.floors;
+  return config;
+}
+
+SyntheticMaps::SyntheticMaps(const SyntheticMapConfig &config)
+  : m_config(config)
+{
+  qsrand(m_config.seed);
+}
+
+QString SyntheticMaps::fqArea(int area) const
+{
+  return QString("XX/Synthetic/Bench/Building %1/%2")
+    .arg(area / m_config.floors).arg(area % m_config.floors);
+}
+
+QString SyntheticMaps::fqSpace(int space) const
+{
+  int area = space / m_config.spacesPerFloor;
+  return QString("%1/Room %2").arg(fqArea(area)).arg(space % m_config.spacesPerFloor);
+}
+
+// 00:<area>:<ap>, unique across all buildings and floors
+QString SyntheticMaps::mac(int area, int ap) const
+{
+  return QString("00:%1:%2:%3:%4:%5")
+    .arg((area >> 16) & 0xff, 2, 16, QChar('0'))
+    .arg((area >> 8) & 0xff, 2, 16, QChar('0'))
+    .arg(area & 0xff, 2, 16, QChar('0'))
+    .arg((ap >> 8) & 0xff, 2, 16, QChar('0'))
+    .arg(ap & 0xff, 2, 16, QChar('0'));
+}
+
+double SyntheticMaps::meanStrength(int slot, int ap) const
+{
+  double centre = slot + (m_config.apsPerSpace - 1) / 2.;
+  return qBound(30., 45. + 4. * qAbs(ap - centre), 90.);
+}
+
+// Box-Muller
+double SyntheticMaps::gaussian()
+{
+  double u;
+  while ((u = randPct()) == 0.);
+  return sqrt(-2. * log(u)) * cos(2. * M_PI * randPct());
+}
+
+qint8 SyntheticMaps::sampleStrength(double mean)
+{
+  double strength = mean + gaussian() * m_config.histogramWidth;
+  return (qint8) qBound(21., floor(strength + 0.5), 99.);
+}
+
+// "strength=count ..." as in the map xml
+QString SyntheticMaps::histogram(double mean, int readings)
+{
+  QMap<int,int> counts;
+  for (int i = 0; i < readings; ++i) {
+    ++counts[sampleStrength(mean)];
+  }
+
+  QStringList buckets;
+  QMapIterator<int,int> i (counts);
+  while (i.hasNext()) {
+    i.next();
+    buckets << QString("%1=%2").arg(i.key()).arg(i.value());
+  }
+  return buckets.join(" ");
+}
+
+QByteArray SyntheticMaps::areaXml(int area)
+{
+  QByteArray xml;
+  QXmlStreamWriter writer (&xml);
+  writer.writeStartDocument();
+  writer.writeStartElement("area");
+  writer.writeAttribute("country", "XX");
+  writer.writeAttribute("region", "Synthetic");
+  writer.writeAttribute("city", "Bench");
+  writer.writeAttribute("area", QString("Building %1").arg(area / m_config.floors));
+  writer.writeAttribute("floor", QString::number(area % m_config.floors));
+  writer.writeAttribute("map_version", "1");
+  writer.writeAttribute("builder_version", "1");
+
+  double weight = qMin(0.99, 1. / m_config.apsPerSpace);
+  double stddev = qMax(0.5, m_config.histogramWidth);
+
+  for (int slot = 0; slot < m_config.spacesPerFloor; ++slot) {
+    writer.writeStartElement("spaces");
+    writer.writeAttribute("name", QString("Room %1").arg(slot));
+    for (int ap = slot; ap < slot + m_config.apsPerSpace; ++ap) {
+      double mean = meanStrength(slot, ap);
+      writer.writeEmptyElement("mac");
+      writer.writeAttribute("name", mac(area, ap));
+      writer.writeAttribute("avg", QString::number(mean));
+      writer.writeAttribute("stddev", QString::number(stddev));
+      writer.writeAttribute("weight", QString::number(weight));
+      writer.writeAttribute("histogram", histogram(mean, MAP_READINGS));
+    }
+    writer.writeEndElement();
+  }
+
+  writer.writeEndElement();
+  writer.writeEndDocument();
+  return xml;
+}
+
+bool SyntheticMaps::writeMap(const QDir &mapRoot, int area, const QByteArray &xml)
+{
+  QString path = fqArea(area);
+  if (!mapRoot.mkpath(path)) {
+    qWarning() << "could not create map directory" << path;
+    return false;
+  }
+
+  QFile file (mapRoot.absoluteFilePath(path + "/sig.xml"));
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    qWarning() << "could not write map" << file.fileName();
+    return false;
+  }
+  QDataStream stream (&file);
+  stream << xml;
+  file.close();
+  return true;
+}
+
+bool SyntheticMaps::writeMapCache(const QDir &mapRoot)
+{
+  for (int area = 0; area < m_config.areaCount(); ++area) {
+    if (!writeMap(mapRoot, area, areaXml(area)))
+      return false;
+  }
+  return true;
+}
+
+QMap<QString,APDesc*> *SyntheticMaps::fingerprint(int space, int scans)
+{
+  int area = space / m_config.spacesPerFloor;
+  int slot = space % m_config.spacesPerFloor;
+
+  QMap<QString,APDesc*> *fp = new QMap<QString,APDesc*>();
+  for (int ap = slot; ap < slot + m_config.apsPerSpace; ++ap) {
+    double mean = meanStrength(slot, ap);
+    APDesc *apDesc = new APDesc(mac(area, ap), "bench", 2437);
+    for (int i = 0; i < scans; ++i) {
+      apDesc->addSignalStrength(sampleStrength(mean));
+    }
+    apDesc->normalizeHistogram();
+    fp->insert(apDesc->mac, apDesc);
+  }
+
+  int readingCount = scans * m_config.apsPerSpace;
+  foreach (APDesc *apDesc, *fp) {
+    apDesc->setWeight(readingCount);
+  }
+  return fp;
+}
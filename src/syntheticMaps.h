@@ -0,0 +1,94 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYNTHETIC_MAPS_H_
+#define SYNTHETIC_MAPS_H_
+
+#include <QtCore>
+
+class APDesc;
+
+// Shape of a synthetic deployment: every building has the same floors,
+// every floor the same number of spaces.
+class SyntheticMapConfig
+{
+ public:
+  SyntheticMapConfig()
+    : buildings(4), floors(3), spacesPerFloor(20), apsPerSpace(12),
+      histogramWidth(4.), seed(1) {}
+
+  int buildings;
+  int floors;
+  int spacesPerFloor;
+  // APs heard in each space
+  int apsPerSpace;
+  // standard deviation of an AP's readings within a space (dB)
+  double histogramWidth;
+  uint seed;
+
+  int areaCount() const { return buildings * floors; }
+  int spaceCount() const { return areaCount() * spacesPerFloor; }
+  // The same floor plan scaled to about this many spaces,
+  // adding buildings rather than floors or spaces per floor.
+  SyntheticMapConfig withSpaces(int spaces) const;
+  QVariantMap toVariant() const;
+};
+
+// Generates maps in the format the map server sends, and scans heard
+// in their spaces, for benchmarking without a map server or a scanner.
+//
+// The spaces of a floor lie in a row with an AP between each pair of
+// neighbours, so a space shares most of its APs with the spaces next
+// to it, as rooms along a corridor do.  Signals weaken with distance
+// from the space.  The same config and seed give the same maps and
+// the same scans.
+class SyntheticMaps
+{
+ public:
+  SyntheticMaps(const SyntheticMapConfig &config);
+
+  const SyntheticMapConfig &config() const { return m_config; }
+
+  QString fqArea(int area) const;
+  QString fqSpace(int space) const;
+
+  // the area's map xml, as fetched from the map server
+  QByteArray areaXml(int area);
+
+  // Writes an area's map into the map cache under mapRoot, laid out as
+  // the localizer saves fetched maps and loads them at startup.
+  bool writeMap(const QDir &mapRoot, int area, const QByteArray &xml);
+  // generates and writes every area
+  bool writeMapCache(const QDir &mapRoot);
+
+  // A fingerprint heard in the space over this many scans,
+  // as ScanQueue would build it.  Caller owns the APDescs.
+  QMap<QString,APDesc*> *fingerprint(int space, int scans);
+
+ private:
+  SyntheticMapConfig m_config;
+
+  int apsPerFloor() const { return m_config.spacesPerFloor + m_config.apsPerSpace; }
+  QString mac(int area, int ap) const;
+  // mean signal strength of a floor AP in a space slot, as a positive dBm
+  double meanStrength(int slot, int ap) const;
+  qint8 sampleStrength(double mean);
+  QString histogram(double mean, int readings);
+  double gaussian();
+};
+
+#endif /* SYNTHETIC_MAPS_H_ */
@@ -17,50 +17,6 @@
 
 #include "util.h"
 
-bool debug = false;
-FILE *logStream = NULL;
-
-//////////////////////////////////////////////////////////
-void initLogger(const char* logFilename) {
-  // Initialize logger
-  if (logFilename != NULL) {
-    if((logStream = fopen(logFilename, "a")) == NULL) {
-      fprintf(stderr, "Could not open log file %s.\n\n", logFilename);
-      exit(-1);
-    }
-  } else {
-    logStream = stderr;
-  }
-}
-
-
-
-//////////////////////////////////////////////////////////////////////////////
-// Set up logging
-void outputHandler(QtMsgType type, const char *msg)
-{
-  switch(type) {
-  case QtDebugMsg:
-    if(debug) {
-      fprintf(logStream, "%s D: %s\n", QDateTime::currentDateTime().toString().toAscii().data(), msg);
-      fflush(logStream);
-    }
-    break;
-  case QtWarningMsg:
-    fprintf(logStream, "%s I: %s\n", QDateTime::currentDateTime().toString().toAscii().data(), msg);
-    fflush(logStream);
-    break;
-  case QtCriticalMsg:
-    fprintf(logStream, "%s C: %s\n", QDateTime::currentDateTime().toString().toAscii().data(), msg);
-    fflush(logStream);
-    break;
-  case QtFatalMsg:
-    fprintf(logStream, "%s F: %s\n", QDateTime::currentDateTime().toString().toAscii().data(), msg);
-    fflush(logStream);
-    exit(-1);
-  }
-}
-
 //////////////////////////////////////////////////////////////////////////////
 void daemonize(QString exec)
 {
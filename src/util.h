@@ -34,12 +34,9 @@
 #include <QFile>
 #include <QVariantMap>
 
+#include "logger.h"
 #include "version.h"
 
-extern bool debug;
-extern FILE *logStream;
-extern void outputHandler(QtMsgType type, const char *msg);
 extern void daemonize(QString exec);
-extern void initLogger(const char* logFilename);
 
 #endif // MOLE_UTIL_H
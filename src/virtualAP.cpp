@@ -0,0 +1,70 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "virtualAP.h"
+#include "logger.h"
+#include "sig.h"
+
+bool groupVirtualAPs = false;
+
+QString virtualAPKey(const QString &mac)
+{
+  QString key = mac.toLower();
+  key[key.length()-1] = '0';
+  return key;
+}
+
+void groupVirtualAPSigs(QMap<QString,Sig*> *sigs)
+{
+  // bucket the signatures by their group key, lowest mac first
+  QMap<QString,QMap<QString,Sig*> > groups;
+  QMapIterator<QString,Sig*> i (*sigs);
+  while (i.hasNext()) {
+    i.next();
+    groups[virtualAPKey(i.key())].insert(i.key().toLower(), i.value());
+  }
+
+  QMap<QString,Sig*> grouped;
+  QMapIterator<QString,QMap<QString,Sig*> > g (groups);
+  while (g.hasNext()) {
+    g.next();
+    const QString &key = g.key();
+
+    QMapIterator<QString,Sig*> m (g.value());
+    m.next();
+    Sig *leader = m.value();
+    grouped.insert(key, leader);
+
+    while (m.hasNext()) {
+      m.next();
+      Sig *sig = m.value();
+      if (qAbs(sig->mean() - leader->mean()) > VIRTUAL_AP_RSSI_TOLERANCE) {
+        moleDebug(MAP_LOG) << "virtual AP" << m.key() << "is a separate radio from" << key
+                           << "mean" << sig->mean() << leader->mean();
+        grouped.insert(m.key(), sig);
+      } else {
+        // the total weight is kept, so grouped fingerprints and
+        // grouped spaces stay comparable
+        leader->addWeight(sig->weight());
+        delete sig;
+      }
+    }
+  }
+
+  moleDebug(MAP_LOG) << "groupVirtualAPSigs" << sigs->size() << "->" << grouped.size();
+  *sigs = grouped;
+}
@@ -0,0 +1,49 @@
+/*
+ * Mole - Mobile Organic Localisation Engine
+ * Copyright 2010-2012 Nokia Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VIRTUAL_AP_H_
+#define VIRTUAL_AP_H_
+
+#include <QtCore>
+
+class Sig;
+
+// Enterprise APs often broadcast several BSSIDs (one per SSID) from
+// the same radio.  These only differ in the last hex digit of the mac
+// and otherwise look the same: nearly the same signal strength.
+// When grouping is on, all of these are collapsed into one logical AP,
+// named by the mac with its last digit set to zero.
+//
+// Scans, binds and uploads always keep the macs as heard.  Grouping is
+// applied only where a fingerprint is scored against a map, with the
+// same rule on both sides: groupVirtualAPSigs.
+extern bool groupVirtualAPs;
+
+// Readings from the same radio should not differ by more than this (dB).
+const int VIRTUAL_AP_RSSI_TOLERANCE = 6;
+
+// 00:1A:2B:3C:4D:5E -> 00:1a:2b:3c:4d:50
+QString virtualAPKey(const QString &mac);
+
+// Collapses a fingerprint's or a space's signatures.
+// The lowest mac of each group leads it and is stored under the group
+// key.  Every other member whose mean is within VIRTUAL_AP_RSSI_TOLERANCE
+// of the leader's is folded into it, adding its weight; the others are
+// separate radios and keep their own (lowercase) mac.
+void groupVirtualAPSigs(QMap<QString,Sig*> *sigs);
+
+#endif /* VIRTUAL_AP_H_ */
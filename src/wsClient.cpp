@@ -54,6 +54,7 @@ int main(int argc, char *argv[]) {
   QString poi;
   int targetScanCount = 0;
   int port = DEFAULT_SCANNER_DAEMON_PORT;
+  bool continuous = false;
 
   QCoreApplication *app = new QCoreApplication(argc,argv);
   QStringList args = QCoreApplication::arguments();
@@ -78,6 +79,8 @@ int main(int argc, char *argv[]) {
       targetScanCount = argsIter.next().toInt();
     } else if (arg == "-l") {
       port = argsIter.next().toInt();
+    } else if (arg == "--continuous" || arg == "-C") {
+      continuous = true;
     } else if (arg == "--query" || arg == "-q") {
       request = "query";
     } else if (arg == "--bind" || arg == "-b") {
@@ -109,9 +112,14 @@ int main(int argc, char *argv[]) {
     usage();
   }
 
+  if (continuous && (request != "query" || targetScanCount != 0)) {
+    qWarning() << "Error: continuous mode is only for 'query' via the scanner daemon";
+    usage();
+  }
+
   WSClient *client = NULL;
   if (targetScanCount == 0) {
-    client = new WSClient(request, container, poi, serverUrl, port);
+    client = new WSClient(request, container, poi, serverUrl, port, continuous);
   } else {
     client = new WSClientSelfScanner(request, container, poi, serverUrl, targetScanCount);
   }
@@ -122,12 +130,18 @@ int main(int argc, char *argv[]) {
 
 //////////////////////////////////////////////////////////
 
-WSClient::WSClient(QString request, QString container, QString poi, QString serverUrl, int localScannerPort) :
+WSClient::WSClient(QString request, QString container, QString poi, QString serverUrl, int localScannerPort,
+		   bool continuous) :
   m_request(request),
   m_container(container),
   m_poi(poi),
   m_serverUrl (serverUrl),
   m_localScannerPort(localScannerPort),
+  m_scanCursor(0),
+  m_continuous(continuous),
+  m_requestInFlight(false),
+  m_requestPending(false),
+  m_subscription(0),
   m_networkAccessManager(0) {
   m_networkAccessManager = new QNetworkAccessManager;
 }
@@ -144,13 +158,116 @@ void WSClient::start() {
 
   }
 
+  if (m_continuous) {
+    subscribe();
+    return;
+  }
+
   if (m_request == "bind" || m_request == "query") {
-    m_scans = getDataFromDaemon("/scans").toList();
+    fetchScans();
     m_requestMap["scans"] = m_scans;
   }
   sendRequest();
 }
 
+//////////////////////////////////////////////////////////
+// Only ask the daemon for scans newer than our cursor
+// and add them to the scans we already hold.
+void WSClient::fetchScans() {
+  QString request = "/scans?since=";
+  request.append(QString::number(m_scanCursor));
+  if (!addScans(getDataFromDaemon(request).toMap())) {
+    // our cursor meant nothing to the new daemon, so take its whole window
+    addScans(getDataFromDaemon("/scans?since=0").toMap());
+  }
+}
+
+// Returns false if the daemon restarted since our cursor was set,
+// in which case the held scans are dropped and the cursor reset.
+bool WSClient::addScans(const QVariantMap &reply) {
+  QString epoch = reply["epoch"].toString();
+  quint32 cursor = reply["cursor"].toUInt();
+  if (epoch != m_scanEpoch || cursor < m_scanCursor) {
+    bool restarted = (m_scanCursor != 0);
+    m_scans.clear();
+    m_scanEpoch = epoch;
+    m_scanCursor = 0;
+    if (restarted) {
+      qWarning() << "scanner daemon restarted, dropping held scans";
+      return false;
+    }
+  }
+  m_scanCursor = cursor;
+
+  m_scans.append(reply["scans"].toList());
+  while (m_scans.size() > MAX_SCANQUEUE_SCANS) {
+    m_scans.removeFirst();
+  }
+  qDebug() << "fetched scans cursor=" << m_scanCursor << "held=" << m_scans.size();
+  return true;
+}
+
+//////////////////////////////////////////////////////////
+// Keep one connection open to the scanner daemon.
+// It pushes new scans to us as length-prefixed records.
+void WSClient::subscribe() {
+  m_subscription = new QTcpSocket(this);
+  connect(m_subscription, SIGNAL(readyRead()), SLOT(handleSubscriptionData()));
+  connect(m_subscription, SIGNAL(disconnected()), SLOT(handleSubscriptionClosed()));
+  m_subscription->connectToHost(DEFAULT_LOCAL_HOST, m_localScannerPort);
+
+  const int timeout = 5*1000;
+  if (!m_subscription->waitForConnected(timeout)) {
+    qFatal("Error connecting to local daemon: %s\n", qPrintable(m_subscription->errorString()));
+    exit(-1);
+  }
+
+  QString request = "/subscribe?since=";
+  request.append(QString::number(m_scanCursor));
+  m_subscription->write(request.toAscii());
+  qDebug() << "subscribed to scanner daemon since" << m_scanCursor;
+}
+
+void WSClient::handleSubscriptionData() {
+  m_subscriptionBuffer.append(m_subscription->readAll());
+
+  bool haveNewScans = false;
+  while (m_subscriptionBuffer.size() >= (int)sizeof(quint32)) {
+    QDataStream stream (m_subscriptionBuffer);
+    quint32 length;
+    stream >> length;
+    if (m_subscriptionBuffer.size() < (int)(sizeof(quint32) + length))
+      break;
+
+    QByteArray json = m_subscriptionBuffer.mid(sizeof(quint32), length);
+    m_subscriptionBuffer.remove(0, sizeof(quint32) + length);
+
+    QJson::Parser parser;
+    bool ok;
+    QVariantMap reply = parser.parse (json, &ok).toMap();
+    if (!ok) {
+      qWarning() << "Could not parse record from scanner daemon";
+      continue;
+    }
+    addScans(reply);
+    haveNewScans = true;
+  }
+
+  if (haveNewScans) {
+    m_requestMap["scans"] = m_scans;
+    if (m_requestInFlight) {
+      m_requestPending = true;
+    } else {
+      sendRequest();
+    }
+  }
+}
+
+void WSClient::handleSubscriptionClosed() {
+  qWarning() << "Scanner daemon closed the subscription";
+  QCoreApplication::quit();
+}
+
 //////////////////////////////////////////////////////////
 // Fetch either scans or our uuid from the daemon
 //QByteArray WSClient::getDataFromDaemon(QString request) {
@@ -279,6 +396,7 @@ void WSClient::sendRequest() {
 
   QNetworkReply *reply = m_networkAccessManager->post(request, requestJson);
   connect(reply, SIGNAL(finished()), SLOT (handleResponse()));
+  m_requestInFlight = true;
   qDebug() << "sent request to" << urlStr;
 }
 
@@ -326,7 +444,15 @@ void WSClient::handleResponse() {
     }
   }
   reply->deleteLater();
-  QCoreApplication::quit();
+  m_requestInFlight = false;
+
+  if (!m_continuous) {
+    QCoreApplication::quit();
+  } else if (m_requestPending) {
+    // scans arrived while this request was in flight
+    m_requestPending = false;
+    sendRequest();
+  }
 }
 
 //////////////////////////////////////////////////////////  
@@ -355,6 +481,7 @@ void usage()
     << "-t scan this many times before sending to remote server\n"
     << "   Otherwise contact scanner daemon for scans\n"
     << "-l Contact scanner daemon on this port (default=" << DEFAULT_SCANNER_DAEMON_PORT << ")\n"
+    << "--continuous (-C) keep querying as the scanner daemon pushes new scans\n"
     << "Bind and Remove require container and poi\n"
     << "-d produce debug output\n";
   exit (-1);
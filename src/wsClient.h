@@ -21,6 +21,7 @@
 #include <QCoreApplication>
 #include <QNetworkAccessManager>
 #include <QNetworkConfigurationManager>
+#include <QTcpSocket>
 
 #include "simpleScanQueue.h"
 #ifdef Q_WS_MAEMO_5
@@ -110,7 +111,8 @@ class WSClient : public QObject {
   Q_OBJECT
 
 public:
-  WSClient(QString request, QString container, QString poi, QString serverUrl, int port);
+  WSClient(QString request, QString container, QString poi, QString serverUrl, int port,
+	   bool continuous = false);
   virtual void start();
 
 
@@ -120,17 +122,33 @@ protected:
   QString m_poi;
   QString m_serverUrl;
   int m_localScannerPort;
+  quint32 m_scanCursor;
+  // the scanner daemon instance m_scanCursor belongs to
+  QString m_scanEpoch;
+
+  // continuous mode: subscribe to the scanner daemon and
+  // re-send the request whenever new scans arrive
+  bool m_continuous;
+  bool m_requestInFlight;
+  bool m_requestPending;
+  QTcpSocket *m_subscription;
+  QByteArray m_subscriptionBuffer;
 
   QVariantList m_scans;
   QVariantMap m_source;
   QVariantMap m_requestMap;
   QNetworkAccessManager *m_networkAccessManager;
   void sendRequest();
+  void fetchScans();
+  bool addScans(const QVariantMap &reply);
+  void subscribe();
   //QByteArray getDataFromDaemon(QString request);
   QVariant getDataFromDaemon(QString request);
 
 public slots:
   void handleResponse();
+  void handleSubscriptionData();
+  void handleSubscriptionClosed();
 
 };
 
@@ -14,6 +14,7 @@ HEADERS += \
     ../src/ports.h \
     ../src/version.h \
     ../src/dbus.h \
+    ../src/logger.h \
     ../src/util.h \
     ../src/source.h \
     ../src/scanner.h \
@@ -22,6 +23,7 @@ HEADERS += \
 SOURCES += \
     ../src/wsClient.cpp \
     ../src/scanner.cpp \
+    ../src/logger.cpp \
     ../src/util.cpp \
     ../src/source.cpp \
     ../src/simpleScanQueue.cpp